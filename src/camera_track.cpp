@@ -0,0 +1,196 @@
+#include "camera_track.h"
+#include <macros.h>
+#include <gtc/matrix_transform.hpp>
+#include <stdio.h>
+#include <string.h>
+
+// On-disk header, followed by frame_count CameraTrackFrame.
+struct CameraTrackHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frame_count;
+	float    timestep;
+	CameraTrackSettings settings;
+};
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+CameraTrack::CameraTrack()
+{
+	memset(&m_settings, 0, sizeof(m_settings));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CameraTrack::begin_record(const CameraTrackSettings& settings)
+{
+	m_settings = settings;
+	m_frames.clear();
+	m_timestep = 1.0 / CAMERA_TRACK_RATE;
+	m_record_time = 0.0;
+	m_recording = true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+static CameraTrackFrame lerp_frame(const CameraTrackFrame& a, const CameraTrackFrame& b, float t)
+{
+	CameraTrackFrame frame;
+
+	frame.position = glm::mix(a.position, b.position, t);
+	frame.forward = glm::normalize(glm::mix(a.forward, b.forward, t));
+	frame.up = glm::normalize(glm::mix(a.up, b.up, t));
+	frame.light_direction = glm::normalize(glm::mix(a.light_direction, b.light_direction, t));
+
+	return frame;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CameraTrack::record(const CameraTrackFrame& frame, double delta_seconds)
+{
+	if (!m_recording)
+		return;
+
+	if (m_frames.empty())
+	{
+		m_frames.push_back(frame);
+		m_last_input = frame;
+		m_record_time = 0.0;
+		return;
+	}
+
+	// Emit every sample falling between the previous input and this one, interpolated between the two.
+	double time = m_record_time + delta_seconds;
+
+	while (m_frames.size() * m_timestep <= time)
+	{
+		double sample_time = m_frames.size() * m_timestep;
+		float t = delta_seconds > 0.0 ? float((sample_time - m_record_time) / delta_seconds) : 1.0f;
+
+		m_frames.push_back(lerp_frame(m_last_input, frame, t));
+	}
+
+	m_last_input = frame;
+	m_record_time = time;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CameraTrack::end_record()
+{
+	m_recording = false;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CameraTrack::save(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+
+	if (!file)
+	{
+		DW_LOG_ERROR("Failed to open " + path + " for writing");
+		return false;
+	}
+
+	CameraTrackHeader header;
+	header.magic = CAMERA_TRACK_MAGIC;
+	header.version = CAMERA_TRACK_VERSION;
+	header.frame_count = frame_count();
+	header.timestep = float(m_timestep);
+	header.settings = m_settings;
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	if (success && !m_frames.empty())
+		success = fwrite(m_frames.data(), sizeof(CameraTrackFrame), m_frames.size(), file) == m_frames.size();
+
+	fclose(file);
+
+	if (!success)
+		DW_LOG_ERROR("Failed to write camera track " + path);
+
+	return success;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CameraTrack::load(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+
+	if (!file)
+	{
+		DW_LOG_ERROR("Failed to open camera track " + path);
+		return false;
+	}
+
+	CameraTrackHeader header;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CAMERA_TRACK_MAGIC || header.version != CAMERA_TRACK_VERSION)
+	{
+		DW_LOG_ERROR("Invalid camera track " + path);
+		fclose(file);
+		return false;
+	}
+
+	// Check the frame count against the size of the file before allocating, a corrupt header could ask for any amount of memory.
+	fseek(file, 0, SEEK_END);
+	long file_size = ftell(file);
+	fseek(file, sizeof(header), SEEK_SET);
+
+	if (file_size < 0 || uint64_t(file_size) < sizeof(header) + uint64_t(header.frame_count) * sizeof(CameraTrackFrame))
+	{
+		DW_LOG_ERROR("Truncated camera track " + path);
+		fclose(file);
+		return false;
+	}
+
+	std::vector<CameraTrackFrame> frames(header.frame_count);
+
+	if (header.frame_count > 0 && fread(frames.data(), sizeof(CameraTrackFrame), frames.size(), file) != frames.size())
+	{
+		DW_LOG_ERROR("Truncated camera track " + path);
+		fclose(file);
+		return false;
+	}
+
+	fclose(file);
+
+	m_settings = header.settings;
+	m_timestep = header.timestep;
+	m_frames.swap(frames);
+	m_recording = false;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+CameraTrackFrame CameraTrack::capture(dw::Camera* camera, const glm::vec3& light_direction)
+{
+	CameraTrackFrame frame;
+
+	frame.position = camera->m_position;
+	frame.forward = camera->m_forward;
+	frame.up = camera->m_up;
+	frame.light_direction = light_direction;
+
+	return frame;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CameraTrack::apply(dw::Camera* camera, const CameraTrackFrame& frame)
+{
+	// Set the pose directly instead of going through the input deltas, so that replaying does not depend on how the camera integrates
+	// its rotation.
+	camera->m_position = frame.position;
+	camera->m_forward = frame.forward;
+	camera->m_up = frame.up;
+	camera->m_right = glm::normalize(glm::cross(frame.forward, frame.up));
+	camera->m_view = glm::lookAt(frame.position, frame.position + frame.forward, frame.up);
+	camera->m_view_projection = camera->m_projection * camera->m_view;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glm.hpp>
+#include <camera.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define CAMERA_TRACK_MAGIC 0x4b525443 // "CTRK"
+#define CAMERA_TRACK_VERSION 1
+#define CAMERA_TRACK_RATE 60.0
+
+// Shadow settings in effect when the track was recorded.
+struct CameraTrackSettings
+{
+	float   lambda;
+	float   near_offset;
+	int32_t split_count;
+	int32_t shadow_map_size;
+	int32_t shadow_filter;
+	int32_t pcf_kernel;
+	uint8_t stable_pssm;
+	uint8_t sdsm;
+	uint8_t fit_scene_depth;
+	uint8_t padding;
+};
+
+// Camera pose and light direction at one step of the track.
+struct CameraTrackFrame
+{
+	glm::vec3 position;
+	glm::vec3 forward;
+	glm::vec3 up;
+	glm::vec3 light_direction;
+};
+
+// Camera flythrough sampled at a fixed rate. Recording resamples the live, variable rate camera to CAMERA_TRACK_RATE, replaying advances
+// exactly one sample per rendered frame so that every replay submits the same sequence of views whatever the frame rate. Stored as a
+// small header followed by the raw frames.
+struct CameraTrack
+{
+	CameraTrackSettings m_settings;
+	std::vector<CameraTrackFrame> m_frames;
+	double m_timestep = 1.0 / CAMERA_TRACK_RATE;
+
+	// Recording state.
+	bool m_recording = false;
+	double m_record_time = 0.0;   // Time of the last recorded input.
+	CameraTrackFrame m_last_input;
+
+	CameraTrack();
+	void begin_record(const CameraTrackSettings& settings);
+	void record(const CameraTrackFrame& frame, double delta_seconds);
+	void end_record();
+	bool save(const std::string& path);
+	bool load(const std::string& path);
+
+	inline uint32_t frame_count() { return (uint32_t)m_frames.size(); }
+	inline const CameraTrackFrame& frame(uint32_t i) { return m_frames[i]; }
+
+	static CameraTrackFrame capture(dw::Camera* camera, const glm::vec3& light_direction);
+	static void apply(dw::Camera* camera, const CameraTrackFrame& frame);
+};
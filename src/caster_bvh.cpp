@@ -0,0 +1,260 @@
+#include "caster_bvh.h"
+#include "simd.h"
+#include <algorithm>
+#include <string.h>
+
+CasterBVH::CasterBVH()
+{
+	memset(m_planes, 0, sizeof(m_planes));
+	memset(m_abs_normals, 0, sizeof(m_abs_normals));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CasterBVH::build(dw::Mesh* mesh)
+{
+	uint32_t count = mesh->sub_mesh_count();
+	const dw::Vertex* vertices = mesh->vertices();
+	const uint32_t* indices = mesh->indices();
+
+	m_draw_min.resize(count);
+	m_draw_max.resize(count);
+	m_draw_triangles.resize(count);
+	m_draw_indices.resize(count);
+	m_total_triangles = 0;
+
+	// Bounds of the vertices actually referenced by each submesh.
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const dw::SubMesh& submesh = mesh->sub_meshes()[i];
+
+		glm::vec3 min(INFINITY);
+		glm::vec3 max(-INFINITY);
+
+		for (uint32_t j = 0; j < submesh.index_count; j++)
+		{
+			const glm::vec3& position = vertices[submesh.base_vertex + indices[submesh.base_index + j]].position;
+
+			min = glm::min(min, position);
+			max = glm::max(max, position);
+		}
+
+		m_draw_min[i] = min;
+		m_draw_max[i] = max;
+		m_draw_triangles[i] = submesh.index_count / 3;
+		m_draw_indices[i] = i;
+		m_total_triangles += m_draw_triangles[i];
+	}
+
+	m_nodes.clear();
+
+	if (count == 0)
+		return;
+
+	m_nodes.reserve(2 * count);
+	m_nodes.push_back(CasterBVHNode());
+
+	build_node(0, 0, count);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CasterBVH::build_node(uint32_t node, uint32_t first, uint32_t count)
+{
+	glm::vec3 min(INFINITY);
+	glm::vec3 max(-INFINITY);
+	glm::vec3 centroid_min(INFINITY);
+	glm::vec3 centroid_max(-INFINITY);
+
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		uint32_t draw = m_draw_indices[i];
+		glm::vec3 centroid = (m_draw_min[draw] + m_draw_max[draw]) * 0.5f;
+
+		min = glm::min(min, m_draw_min[draw]);
+		max = glm::max(max, m_draw_max[draw]);
+		centroid_min = glm::min(centroid_min, centroid);
+		centroid_max = glm::max(centroid_max, centroid);
+	}
+
+	m_nodes[node].min = min;
+	m_nodes[node].max = max;
+
+	if (count <= CASTER_BVH_LEAF_SIZE)
+	{
+		m_nodes[node].first = first;
+		m_nodes[node].count = count;
+		return;
+	}
+
+	// Median split along the axis of largest centroid spread.
+	glm::vec3 extent = centroid_max - centroid_min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	uint32_t half = count / 2;
+
+	std::nth_element(m_draw_indices.begin() + first, m_draw_indices.begin() + first + half, m_draw_indices.begin() + first + count, [&](uint32_t a, uint32_t b)
+	{
+		return m_draw_min[a][axis] + m_draw_max[a][axis] < m_draw_min[b][axis] + m_draw_max[b][axis];
+	});
+
+	uint32_t left = (uint32_t)m_nodes.size();
+
+	m_nodes.push_back(CasterBVHNode());
+	m_nodes.push_back(CasterBVHNode());
+
+	m_nodes[node].first = left;
+	m_nodes[node].count = 0;
+
+	build_node(left, first, half);
+	build_node(left + 1, first + half, count - half);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint32_t CasterBVH::overlap(const glm::vec3& min, const glm::vec3& max, uint32_t cascade_mask)
+{
+	glm::vec3 center = (min + max) * 0.5f;
+	glm::vec3 extent = (max - min) * 0.5f;
+
+	simd_float cx = simd_set1(center.x);
+	simd_float cy = simd_set1(center.y);
+	simd_float cz = simd_set1(center.z);
+	simd_float ex = simd_set1(extent.x);
+	simd_float ey = simd_set1(extent.y);
+	simd_float ez = simd_set1(extent.z);
+	simd_float zero = simd_set1(0.0f);
+
+	uint32_t result = 0;
+
+	for (int i = 0; i < m_cascade_count; i += CSM_SIMD_WIDTH)
+	{
+		simd_float inside = simd_cmp_eq(zero, zero);
+
+		// The box is outside if it lies entirely behind any plane.
+		for (int p = 0; p < CASTER_CULL_PLANES; p++)
+		{
+			simd_float distance = simd_add(simd_add(simd_mul(simd_load(&m_planes[p][0][i]), cx),
+													simd_mul(simd_load(&m_planes[p][1][i]), cy)),
+										   simd_add(simd_mul(simd_load(&m_planes[p][2][i]), cz),
+													simd_load(&m_planes[p][3][i])));
+
+			simd_float radius = simd_add(simd_add(simd_mul(simd_load(&m_abs_normals[p][0][i]), ex),
+												  simd_mul(simd_load(&m_abs_normals[p][1][i]), ey)),
+										 simd_mul(simd_load(&m_abs_normals[p][2][i]), ez));
+
+			inside = simd_and(inside, simd_cmp_ge(simd_add(distance, radius), zero));
+		}
+
+		result |= uint32_t(simd_mask(inside)) << i;
+	}
+
+	return result & cascade_mask;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CasterBVH::cull(const glm::mat4* crop_matrices, int cascade_count, const glm::mat4& model, CasterVisibility& visibility)
+{
+	m_cascade_count = cascade_count;
+
+	// Extract the planes from the rows of the object to clip space transform of every cascade.
+	for (int i = 0; i < MAX_SHADOW_CASCADES; i++)
+	{
+		glm::vec4 planes[CASTER_CULL_PLANES];
+
+		if (i < cascade_count)
+		{
+			glm::mat4 m = glm::transpose(crop_matrices[i] * model);
+
+			planes[0] = m[3] + m[0];
+			planes[1] = m[3] - m[0];
+			planes[2] = m[3] + m[1];
+			planes[3] = m[3] - m[1];
+			planes[4] = m[3] - m[2];
+		}
+		else
+		{
+			for (int p = 0; p < CASTER_CULL_PLANES; p++)
+				planes[p] = glm::vec4(0.0f);
+		}
+
+		for (int p = 0; p < CASTER_CULL_PLANES; p++)
+		{
+			for (int c = 0; c < 4; c++)
+				m_planes[p][c][i] = planes[p][c];
+
+			for (int c = 0; c < 3; c++)
+				m_abs_normals[p][c][i] = fabsf(planes[p][c]);
+		}
+	}
+
+	visibility.m_cascade_count = cascade_count;
+	visibility.m_visible_union.clear();
+	visibility.m_cascade_masks.assign(draw_count(), 0);
+
+	for (int i = 0; i < cascade_count; i++)
+		visibility.m_visible[i].clear();
+
+	if (!m_nodes.empty())
+	{
+		// Pairs of (node, cascade mask still overlapping the parent).
+		m_stack.clear();
+		m_stack.push_back(0);
+		m_stack.push_back((1u << cascade_count) - 1);
+
+		while (!m_stack.empty())
+		{
+			uint32_t parent_mask = m_stack.back();
+			m_stack.pop_back();
+			const CasterBVHNode& node = m_nodes[m_stack.back()];
+			m_stack.pop_back();
+
+			uint32_t mask = overlap(node.min, node.max, parent_mask);
+
+			if (mask == 0)
+				continue;
+
+			if (node.count == 0)
+			{
+				m_stack.push_back(node.first);
+				m_stack.push_back(mask);
+				m_stack.push_back(node.first + 1);
+				m_stack.push_back(mask);
+				continue;
+			}
+
+			// Leaves hold a handful of draws, test them individually.
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				uint32_t draw = m_draw_indices[i];
+				uint32_t draw_mask = overlap(m_draw_min[draw], m_draw_max[draw], mask);
+
+				if (draw_mask == 0)
+					continue;
+
+				visibility.m_cascade_masks[draw] = draw_mask;
+				visibility.m_visible_union.push_back(draw);
+
+				for (int c = 0; c < cascade_count; c++)
+				{
+					if (draw_mask & (1 << c))
+						visibility.m_visible[c].push_back(draw);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < cascade_count; i++)
+	{
+		CasterCullStats& stats = visibility.m_stats[i];
+
+		stats.visible_draws = (uint32_t)visibility.m_visible[i].size();
+		stats.culled_draws = draw_count() - stats.visible_draws;
+		stats.visible_triangles = 0;
+
+		for (uint32_t draw : visibility.m_visible[i])
+			stats.visible_triangles += m_draw_triangles[draw];
+
+		stats.culled_triangles = m_total_triangles - stats.visible_triangles;
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "shadow_lights.h"
+#include <macros.h>
+#include <mesh.h>
+#include <vector>
+
+#define CASTER_BVH_LEAF_SIZE 4
+
+// Planes of a cascade volume tested by the culling: left, right, bottom, top and far. The near plane is left out so that the volume
+// extends toward the light and casters outside of the view still cast into the cascade.
+#define CASTER_CULL_PLANES 5
+
+// A node covers either two children (count == 0, children at first and first + 1) or a range of leaf draws (count > 0).
+struct CasterBVHNode
+{
+	glm::vec3 min;
+	uint32_t  first;
+	glm::vec3 max;
+	uint32_t  count;
+};
+
+struct CasterCullStats
+{
+	uint32_t visible_draws;
+	uint32_t culled_draws;
+	uint32_t visible_triangles;
+	uint32_t culled_triangles;
+};
+
+// Casters found by a traversal. Kept apart from the hierarchy so that a frame can be culled while the previous one is drawn.
+struct CasterVisibility
+{
+	std::vector<uint32_t> m_cascade_masks; // Bit i set if the draw is visible in cascade i.
+	std::vector<uint32_t> m_visible[MAX_SHADOW_CASCADES];
+	std::vector<uint32_t> m_visible_union;
+	CasterCullStats m_stats[MAX_SHADOW_CASCADES];
+	int m_cascade_count = 0;
+};
+
+// Bounding volume hierarchy over the object-space AABBs of the submeshes of a mesh, built once at load. Each frame a single traversal
+// tests every node against all cascade volumes at once, one cascade per SIMD lane, and only descends into children for the cascades
+// that still overlap. Produces the visible draws of every cascade, their union and a per-draw cascade mask.
+struct CasterBVH
+{
+	std::vector<CasterBVHNode> m_nodes;
+	std::vector<uint32_t> m_draw_indices; // Draws referenced by the leaves.
+	std::vector<glm::vec3> m_draw_min;
+	std::vector<glm::vec3> m_draw_max;
+	std::vector<uint32_t> m_draw_triangles;
+	std::vector<uint32_t> m_stack;
+	int m_cascade_count = 0;
+	uint32_t m_total_triangles = 0;
+
+	// Object-space planes, one lane per cascade. Absolute normals give the projected extent of a box in a single multiply-add.
+	DW_ALIGNED(32) float m_planes[CASTER_CULL_PLANES][4][MAX_SHADOW_CASCADES];
+	DW_ALIGNED(32) float m_abs_normals[CASTER_CULL_PLANES][3][MAX_SHADOW_CASCADES];
+
+	CasterBVH();
+	void build(dw::Mesh* mesh);
+	void cull(const glm::mat4* crop_matrices, int cascade_count, const glm::mat4& model, CasterVisibility& visibility);
+	void build_node(uint32_t node, uint32_t first, uint32_t count);
+	uint32_t overlap(const glm::vec3& min, const glm::vec3& max, uint32_t cascade_mask);
+
+	inline uint32_t draw_count() { return (uint32_t)m_draw_min.size(); }
+};
@@ -1,15 +1,39 @@
 #include "csm.h"
+#include "shadow_lights.h"
 #include <gtc/matrix_transform.hpp>
 #include <macros.h>
+#include <string.h>
 
-CSM::CSM()
+struct ShadowDepthFormatDesc
+{
+	GLenum internal_format;
+	GLenum type;
+	int bytes_per_texel;
+};
+
+// D24 is padded to 32 bits by every implementation, it only saves memory over D32F on paper.
+static const ShadowDepthFormatDesc g_depth_formats[] =
 {
-	m_shadow_maps = nullptr;
+	{ GL_DEPTH_COMPONENT16, GL_UNSIGNED_SHORT, 2 },
+	{ GL_DEPTH_COMPONENT24, GL_UNSIGNED_INT, 4 },
+	{ GL_DEPTH_COMPONENT32F, GL_FLOAT, 4 }
+};
 
+CSM::CSM()
+{
 	for (int i = 0; i < 8; i++)
 	{
-		m_shadow_fbos[i] = nullptr;
+		m_atlas_matrices[i] = glm::mat4(1.0f);
+		m_dirty[i] = true;
+		m_pending[i] = false;
+		m_widened[i] = false;
+		m_refresh_intervals[i] = 1;
+		m_last_centers[i] = glm::vec3(0.0f);
 	}
+
+	m_depth_range.min_depth = 0.0f;
+	m_depth_range.max_depth = 0.0f;
+	m_depth_range.valid = false;
 }
 
 CSM::~CSM()
@@ -18,36 +42,32 @@ CSM::~CSM()
 }
 
 void CSM::initialize(float lambda, float near_offset, int split_count, int shadow_map_size, dw::Camera* camera, int _width, int _height, glm::vec3 dir)
+{
+	configure(lambda, near_offset, split_count, shadow_map_size, camera, _width, _height);
+	update_resources();
+	update(camera, dir);
+
+	// The cascade layout may have changed: the next regular update has to redraw every cascade, even if nothing moved in between.
+	invalidate();
+	m_generation++;
+}
+
+void CSM::configure(float lambda, float near_offset, int split_count, int shadow_map_size, dw::Camera* camera, int _width, int _height)
 {
 	m_lambda = lambda;
 	m_near_offset = near_offset;
 	m_split_count = split_count;
 	m_shadow_map_size = shadow_map_size;
-    
-    if (m_shadow_maps)
-    {
-        DW_SAFE_DELETE(m_shadow_maps);
-        m_shadow_maps = nullptr;
-    }
+	m_force_update = true;
 
-	for (int i = 0; i < 8; i++)
+	// Pick the cascade resolutions on the CPU so that the solver does not depend on the GL resources. A secondary light changes the
+	// layout of the shared atlas, whose texture is then reacquired by the group; the primary updates its own right after.
+	if (m_group)
+		m_group->allocate(!m_owns_atlas);
+	else
 	{
-		if (m_shadow_fbos[i])
-        {
-            DW_SAFE_DELETE(m_shadow_fbos[i]);
-            m_shadow_fbos[i] = nullptr;
-        }
-	}
-
-    m_shadow_maps = new dw::Texture2D(m_shadow_map_size, m_shadow_map_size, m_split_count, 1, 1, GL_DEPTH_STENCIL, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
-    m_shadow_maps->set_min_filter(GL_NEAREST);
-    m_shadow_maps->set_mag_filter(GL_NEAREST);
-    m_shadow_maps->set_wrapping(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
-    
-	for (int i = 0; i < m_split_count; i++)
-	{
-        m_shadow_fbos[i] = new dw::Framebuffer();
-        m_shadow_fbos[i]->attach_depth_stencil_target(m_shadow_maps, i, 0);
+		m_atlas.allocate(m_shadow_map_size, m_split_count, m_memory_budget, bytes_per_texel());
+		update_atlas_matrices();
 	}
 
 	float camera_fov = camera->m_fov;
@@ -68,22 +88,203 @@ void CSM::initialize(float lambda, float near_offset, int split_count, int shado
                        0.0f, 0.5f, 0.0f, 0.0f,
                        0.0f, 0.0f, 0.5f, 0.0f,
                        0.5f, 0.5f, 0.5f, 1.0f);
+}
 
-	update(camera, dir);
+void CSM::update_atlas_matrices()
+{
+	for (int i = 0; i < m_split_count; i++)
+	{
+		glm::vec4 rect = m_atlas.uv_rect(i);
+
+		m_atlas_matrices[i] = glm::mat4(rect.z, 0.0f, 0.0f, 0.0f,
+										0.0f, rect.w, 0.0f, 0.0f,
+										0.0f, 0.0f, 1.0f, 0.0f,
+										rect.x, rect.y, 0.0f, 1.0f);
+	}
+}
+
+int CSM::bytes_per_texel()
+{
+	return g_depth_formats[m_depth_format].bytes_per_texel;
+}
+
+void CSM::update_resources()
+{
+	if (!m_owns_atlas || !m_pool)
+		return;
+
+	const ShadowDepthFormatDesc& format = g_depth_formats[m_depth_format];
+	RenderTargetDesc desc = { m_atlas.m_width, m_atlas.m_height, 1, 1, format.internal_format, GL_DEPTH_COMPONENT, format.type };
+
+	// Parameter changes that keep the atlas size and format keep the texture as well.
+	if (!m_atlas_target || m_atlas_target->m_desc != desc)
+	{
+		m_pool->release(m_atlas_target);
+
+		// Single depth-only texture, every cascade is rendered into its own rect through the viewport.
+		m_atlas_target = m_pool->acquire(desc, "shadow atlas");
+		m_atlas_target->texture()->set_min_filter(GL_NEAREST);
+		m_atlas_target->texture()->set_mag_filter(GL_NEAREST);
+		m_atlas_target->texture()->set_wrapping(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+
+		// A texture coming back from the pool holds the cascades of an older configuration.
+		m_force_update = true;
+	}
+
+	// Sampler for hardware depth comparison with bilinear PCF. Kept separate from the texture state so that the raw depth stays
+	// readable through the texture's own nearest filtering.
+	if (!m_compare_sampler)
+	{
+		glGenSamplers(1, &m_compare_sampler);
+		glSamplerParameteri(m_compare_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(m_compare_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(m_compare_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(m_compare_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(m_compare_sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glSamplerParameteri(m_compare_sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
 }
 
 void CSM::shutdown()
 {
-	for (int i = 0; i < 8; i++)
+	if (m_compare_sampler)
 	{
-		if (m_shadow_fbos[i])
-			DW_SAFE_DELETE(m_shadow_fbos[i]);
+		glDeleteSamplers(1, &m_compare_sampler);
+		m_compare_sampler = 0;
 	}
 
-	DW_SAFE_DELETE(m_shadow_maps);
+	if (m_pool)
+		m_pool->release(m_atlas_target);
 }
 
 void CSM::update(dw::Camera* camera, glm::vec3 dir)
+{
+	if (!begin_update(camera, dir))
+		return;
+
+	update_light_view(camera, dir);
+	update_splits(camera);
+	update_frustum_corners(camera);
+	update_crop_matrices(m_light_view, camera);
+    update_texture_matrices(camera);
+    update_far_bounds(camera);
+	schedule_cascades();
+}
+
+bool CSM::begin_update(dw::Camera* camera, glm::vec3 dir)
+{
+	m_frame_index++;
+
+	for (int i = 0; i < m_split_count; i++)
+		m_dirty[i] = false;
+
+	CSMUpdateState state;
+	state.position = camera->m_position;
+	state.forward = camera->m_forward;
+	state.up = camera->m_up;
+	state.direction = dir;
+	state.projection = camera->m_projection;
+	state.lambda = m_lambda;
+	state.stable_pssm = m_stable_pssm;
+	state.sdsm = m_sdsm;
+
+	bool changed = m_force_update || !m_dirty_tracking ||
+				   state.position != m_last_state.position ||
+				   state.forward != m_last_state.forward ||
+				   state.up != m_last_state.up ||
+				   state.direction != m_last_state.direction ||
+				   state.projection != m_last_state.projection ||
+				   state.lambda != m_last_state.lambda ||
+				   state.stable_pssm != m_last_state.stable_pssm ||
+				   state.sdsm != m_last_state.sdsm;
+
+	m_last_state = state;
+
+	if (changed)
+		return true;
+
+	// Nothing moved, but cascades deferred by their refresh interval still have to catch up, and cascades widened for the
+	// camera motion have to be tightened again.
+	for (int i = 0; i < m_split_count; i++)
+	{
+		if (m_pending[i] || m_widened[i])
+			return true;
+	}
+
+	return false;
+}
+
+void CSM::schedule_cascades()
+{
+	for (int i = 0; i < m_split_count; i++)
+	{
+		// Distance the split moved since the previous update.
+		float motion = m_force_update ? 0.0f : glm::length(m_splits[i].center - m_last_centers[i]);
+		m_last_centers[i] = m_splits[i].center;
+
+		bool changed = m_force_update || !m_dirty_tracking || m_crop_matrices[i] != m_committed_crop_matrices[i];
+
+		if (!changed)
+		{
+			m_pending[i] = false;
+			continue;
+		}
+
+		// Offset by the cascade index so that cascades sharing an interval are spread over different frames.
+		int interval = m_refresh_intervals[i];
+		bool due = m_force_update || interval <= 1 || (m_frame_index + i) % interval == 0;
+
+		if (due)
+		{
+			// The cascade is sampled for the next interval - 1 frames without being re-rendered, widen it by the distance the
+			// split moves meanwhile at the current speed so that it still covers the split when the camera keeps moving.
+			m_widened[i] = interval > 1 && motion > 0.0f;
+
+			if (m_widened[i])
+				widen_crop_matrix(i, motion * (interval - 1));
+
+			m_committed_crop_matrices[i] = m_crop_matrices[i];
+			m_committed_proj_matrices[i] = m_proj_matrices[i];
+			m_committed_far_bounds[i] = m_far_bounds[i];
+			m_dirty[i] = true;
+			m_pending[i] = false;
+		}
+		else
+		{
+			// Keep sampling with the matrices the shadow map was last rendered with, and select the cascade over the depth range
+			// it was rendered for.
+			m_crop_matrices[i] = m_committed_crop_matrices[i];
+			m_proj_matrices[i] = m_committed_proj_matrices[i];
+			m_texture_matrices[i] = m_atlas_matrices[i] * m_bias * m_crop_matrices[i];
+			m_far_bounds[i] = m_committed_far_bounds[i];
+			m_pending[i] = true;
+		}
+	}
+
+	m_force_update = false;
+}
+
+void CSM::widen_crop_matrix(int i, float margin)
+{
+	// Scale the crop about its center so that it covers margin more world units on every side. The rows of the crop hold the
+	// clip space units per world unit along x and y.
+	glm::mat4& crop = m_crop_matrices[i];
+	float scale_x = glm::length(glm::vec3(crop[0][0], crop[1][0], crop[2][0]));
+	float scale_y = glm::length(glm::vec3(crop[0][1], crop[1][1], crop[2][1]));
+
+	glm::mat4 widen = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / (1.0f + margin * scale_x), 1.0f / (1.0f + margin * scale_y), 1.0f));
+
+	m_crop_matrices[i] = widen * m_crop_matrices[i];
+	m_proj_matrices[i] = widen * m_proj_matrices[i];
+	m_texture_matrices[i] = m_atlas_matrices[i] * m_bias * m_crop_matrices[i];
+}
+
+void CSM::invalidate()
+{
+	m_force_update = true;
+}
+
+void CSM::update_light_view(dw::Camera* camera, glm::vec3 dir)
 {
 	dir = glm::normalize(dir);
 	m_light_direction = dir;
@@ -97,12 +298,6 @@ void CSM::update(dw::Camera* camera, glm::vec3 dir)
 	glm::mat4 modelview = glm::lookAt(light_pos, center, up);
 
 	m_light_view = modelview;
-
-	update_splits(camera);
-	update_frustum_corners(camera);
-	update_crop_matrices(modelview, camera);
-    update_texture_matrices(camera);
-    update_far_bounds(camera);
 }
 
 void CSM::update_splits(dw::Camera* camera)
@@ -110,6 +305,13 @@ void CSM::update_splits(dw::Camera* camera)
 	float nd = camera->m_near;
 	float fd = 200.0f;// camera->m_far;
 
+	// Sample Distribution Shadow Maps: only partition the depth range that is actually visible.
+	if (m_sdsm && m_depth_range.valid)
+	{
+		nd = glm::max(camera->m_near, m_depth_range.min_depth);
+		fd = glm::max(nd * 1.01f, glm::min(camera->m_far, m_depth_range.max_depth));
+	}
+
 	float lambda = m_lambda;
 	float ratio = fd / nd;
 	m_splits[0].near_plane = nd;
@@ -126,6 +328,110 @@ void CSM::update_splits(dw::Camera* camera)
 	}
 
 	m_splits[m_split_count - 1].far_plane = fd;
+
+	for (int i = 0; i < m_split_count; i++)
+		m_splits[i].selection_far = m_splits[i].far_plane;
+
+	if (m_sdsm && m_depth_range.valid && m_depth_histogram_valid)
+		tighten_splits();
+}
+
+void CSM::set_depth_range(const DepthRange& range, const uint32_t* histogram)
+{
+	if (range.valid != m_depth_range.valid || range.min_depth != m_depth_range.min_depth || range.max_depth != m_depth_range.max_depth ||
+		(histogram != nullptr) != m_depth_histogram_valid || (histogram && memcmp(histogram, m_depth_histogram, sizeof(m_depth_histogram)) != 0))
+		m_force_update = true;
+
+	m_depth_range = range;
+	m_depth_histogram_valid = histogram != nullptr;
+
+	if (histogram)
+		memcpy(m_depth_histogram, histogram, sizeof(m_depth_histogram));
+}
+
+void CSM::set_scene_bounds(const glm::vec3& caster_min, const glm::vec3& caster_max, const glm::vec3& receiver_min, const glm::vec3& receiver_max)
+{
+	if (m_scene_bounds_valid && caster_min == m_caster_min && caster_max == m_caster_max && receiver_min == m_receiver_min && receiver_max == m_receiver_max)
+		return;
+
+	m_caster_min = caster_min;
+	m_caster_max = caster_max;
+	m_receiver_min = receiver_min;
+	m_receiver_max = receiver_max;
+	m_scene_bounds_valid = true;
+	m_force_update = true;
+}
+
+static void view_depth_extents(const glm::mat4& view, const glm::vec3& min, const glm::vec3& max, float& near_plane, float& far_plane)
+{
+	near_plane = INFINITY;
+	far_plane = -INFINITY;
+
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec3 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+		float depth = -(view * glm::vec4(corner, 1.0f)).z;
+
+		near_plane = glm::min(near_plane, depth);
+		far_plane = glm::max(far_plane, depth);
+	}
+}
+
+bool CSM::scene_depth_range(const glm::mat4& view, float receiver_near, float receiver_far, float& near_plane, float& far_plane)
+{
+	if (!m_fit_scene_depth || !m_scene_bounds_valid)
+		return false;
+
+	float caster_near, caster_far;
+	float scene_near, scene_far;
+
+	view_depth_extents(view, m_caster_min, m_caster_max, caster_near, caster_far);
+	view_depth_extents(view, m_receiver_min, m_receiver_max, scene_near, scene_far);
+
+	// Only receivers inside the split need depth precision. Casters between the light and the near plane are flattened onto it by
+	// depth clamping, so the near plane can move up to the first receiver, or the first caster if that is further away.
+	near_plane = glm::max(receiver_near, glm::max(scene_near, caster_near));
+	far_plane = glm::min(receiver_far, scene_far);
+
+	// The split does not overlap the scene, keep its own range.
+	if (near_plane >= far_plane)
+	{
+		near_plane = receiver_near;
+		far_plane = receiver_far;
+	}
+
+	return true;
+}
+
+void CSM::tighten_splits()
+{
+	float bin_size = (m_depth_range.max_depth - m_depth_range.min_depth) / DEPTH_HISTOGRAM_BINS;
+
+	if (bin_size <= 0.0f)
+		return;
+
+	// Shrink every split to the bins holding visible pixels, keeping one bin of margin to cover the frames of latency of the readback.
+	// The histogram counts every pixel of the depth buffer, so no visible receiver selects a cascade outside of its tightened range even
+	// though the selection range is left untouched to keep cascade selection continuous.
+	for (int i = 0; i < m_split_count; i++)
+	{
+		FrustumSplit& split = m_splits[i];
+
+		int first = glm::max(0, int((split.near_plane - m_depth_range.min_depth) / bin_size));
+		int last = glm::min(DEPTH_HISTOGRAM_BINS - 1, int((split.far_plane - m_depth_range.min_depth) / bin_size));
+
+		while (first <= last && m_depth_histogram[first] == 0)
+			first++;
+
+		while (last >= first && m_depth_histogram[last] == 0)
+			last--;
+
+		if (first > last)
+			continue;
+
+		split.near_plane = glm::max(split.near_plane, m_depth_range.min_depth + (first - 1) * bin_size);
+		split.far_plane = glm::min(split.far_plane, m_depth_range.min_depth + (last + 2) * bin_size);
+	}
 }
 
 void CSM::update_frustum_corners(dw::Camera* camera)
@@ -168,7 +474,7 @@ void CSM::update_frustum_corners(dw::Camera* camera)
 void CSM::update_texture_matrices(dw::Camera* camera)
 {
     for (int i = 0; i < m_split_count; i++)
-        m_texture_matrices[i] = m_bias * m_crop_matrices[i];
+        m_texture_matrices[i] = m_atlas_matrices[i] * m_bias * m_crop_matrices[i];
 }
 
 void CSM::update_far_bounds(dw::Camera* camera)
@@ -181,7 +487,7 @@ void CSM::update_far_bounds(dw::Camera* camera)
         // cam_proj * (0, 0, f[i].fard, 1)^t and then normalize to [0; 1]
         
         FrustumSplit& split = m_splits[i];
-		glm::vec4 pos = camera->m_projection * glm::vec4(0.0f, 0.0f, -split.far_plane, 1.0f);
+		glm::vec4 pos = camera->m_projection * glm::vec4(0.0f, 0.0f, -split.selection_far, 1.0f);
 		glm::vec4 ndc = pos / pos.w;
 
         m_far_bounds[i] = ndc.z * 0.5f + 0.5f;
@@ -190,7 +496,6 @@ void CSM::update_far_bounds(dw::Camera* camera)
 
 void CSM::update_crop_matrices(glm::mat4 t_modelview, dw::Camera* camera)
 {
-	glm::mat4 t_projection;
 	for (int i = 0; i < m_split_count; i++) 
 	{
 		FrustumSplit& t_frustum = m_splits[i];
@@ -215,7 +520,8 @@ void CSM::update_crop_matrices(glm::mat4 t_modelview, dw::Camera* camera)
 			if (t_transf.z < tmin.z) { tmin.z = t_transf.z; }
 		}
 
-		//tmax.z += 50; // TODO: This solves the dissapearing shadow problem. but how to fix?
+		// Casters outside of this z-range are handled by fitting the depth range to the scene bounds and clamping depth, see
+		// scene_depth_range.
 
 		// Calculate frustum split center
 		t_frustum.center = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -238,46 +544,22 @@ void CSM::update_crop_matrices(glm::mat4 t_modelview, dw::Camera* camera)
 
 			radius = ceil(radius * 16.0f) / 16.0f;
 
-			// Find bounding box that fits the sphere
-			glm::vec3 radius3(radius, radius, radius);
-
-			glm::vec3 max = radius3;
-			glm::vec3 min = -radius3;
-
-			glm::vec3 cascade_extents = max - min;
-
-			// Push the light position back along the light direction by the near offset.
-			glm::vec3 shadow_camera_pos = t_frustum.center - m_light_direction * m_near_offset;
-
-			// Add the near offset to the Z value of the cascade extents to make sure the orthographic frustum captures the entire frustum split (else it will exhibit cut-off issues).
-			glm::mat4 ortho = glm::ortho(min.x, max.x, min.y, max.y, -m_near_offset, m_near_offset + cascade_extents.z);
-			glm::mat4 view = glm::lookAt(shadow_camera_pos, t_frustum.center, camera->m_up);
-
-			m_proj_matrices[i] = ortho;
-			m_crop_matrices[i] = ortho * view;
+			glm::mat4 view;
+			stable_crop_matrix(i, radius, camera, view);
 
 			glm::vec4 shadow_origin = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 			shadow_origin = m_crop_matrices[i] * shadow_origin;
-			shadow_origin = shadow_origin * (m_shadow_map_size / 2.0f);
+			shadow_origin = shadow_origin * (cascade_size(i) / 2.0f);
 
 			glm::vec4 rounded_origin = glm::round(shadow_origin);
 			glm::vec4 round_offset = rounded_origin - shadow_origin;
-			round_offset = round_offset * (2.0f / m_shadow_map_size);
-			round_offset.z = 0.0f;
-			round_offset.w = 0.0f;
-
-			glm::mat4& shadow_proj = m_proj_matrices[i];
-
-			shadow_proj[3][0] += round_offset.x;
-			shadow_proj[3][1] += round_offset.y;
-			shadow_proj[3][2] += round_offset.z;
-			shadow_proj[3][3] += round_offset.w;
+			round_offset = round_offset * (2.0f / cascade_size(i));
 
-			m_crop_matrices[i] = shadow_proj * view;
+			snap_crop_matrix(i, glm::vec2(round_offset.x, round_offset.y), view);
 		}
 		else
 		{
-			glm::mat4 t_ortho = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, -m_near_offset, -tmin.z);
+			glm::mat4 t_ortho = non_stable_ortho(tmin.z, tmax.z);
 			glm::mat4 t_shad_mvp = t_ortho * t_modelview;
 
 			// find the extends of the frustum slice as projected in light's homogeneous coordinates
@@ -294,21 +576,77 @@ void CSM::update_crop_matrices(glm::mat4 t_modelview, dw::Camera* camera)
 				if (t_transf.y < tmin.y) { tmin.y = t_transf.y; }
 			}
 
-			glm::vec2 tscale(2.0f / (tmax.x - tmin.x), 2.0f / (tmax.y - tmin.y));
-			glm::vec2 toffset(-0.5f * (tmax.x + tmin.x) * tscale.x, -0.5f * (tmax.y + tmin.y) * tscale.y);
+			non_stable_crop_matrix(i, glm::vec2(tmin.x, tmin.y), glm::vec2(tmax.x, tmax.y), t_ortho, t_modelview);
+		}
+	}
+}
 
-			glm::mat4 t_shad_crop = glm::mat4(1.0f);
-			t_shad_crop[0][0] = tscale.x;
-			t_shad_crop[1][1] = tscale.y;
-			t_shad_crop[0][3] = toffset.x;
-			t_shad_crop[1][3] = toffset.y;
-			t_shad_crop = glm::transpose(t_shad_crop);
+void CSM::stable_crop_matrix(int i, float radius, dw::Camera* camera, glm::mat4& view)
+{
+	FrustumSplit& t_frustum = m_splits[i];
 
-			t_projection = t_shad_crop * t_ortho;
+	// Find bounding box that fits the sphere
+	glm::vec3 radius3(radius, radius, radius);
 
-			// Store the projection matrix
-			m_proj_matrices[i] = t_projection;
-			m_crop_matrices[i] = t_projection * t_modelview;
-		}
-	}
+	glm::vec3 max = radius3;
+	glm::vec3 min = -radius3;
+
+	glm::vec3 cascade_extents = max - min;
+
+	// Push the light position back along the light direction by the near offset.
+	glm::vec3 shadow_camera_pos = t_frustum.center - m_light_direction * m_near_offset;
+
+	view = glm::lookAt(shadow_camera_pos, t_frustum.center, camera->m_up);
+
+	// Add the near offset to the Z value of the cascade extents to make sure the orthographic frustum captures the entire frustum split (else it will exhibit cut-off issues).
+	float near_plane = -m_near_offset;
+	float far_plane = m_near_offset + cascade_extents.z;
+
+	// Fit to the scene instead, the bounding sphere of the split lies at m_near_offset from the shadow camera.
+	scene_depth_range(view, m_near_offset - radius, m_near_offset + radius, near_plane, far_plane);
+
+	glm::mat4 ortho = glm::ortho(min.x, max.x, min.y, max.y, near_plane, far_plane);
+
+	m_proj_matrices[i] = ortho;
+	m_crop_matrices[i] = ortho * view;
+}
+
+void CSM::snap_crop_matrix(int i, glm::vec2 round_offset, const glm::mat4& view)
+{
+	// Move the projection by the sub-texel offset of the shadow origin so that the cascade only ever moves in whole texels.
+	glm::mat4& shadow_proj = m_proj_matrices[i];
+
+	shadow_proj[3][0] += round_offset.x;
+	shadow_proj[3][1] += round_offset.y;
+
+	m_crop_matrices[i] = shadow_proj * view;
+}
+
+glm::mat4 CSM::non_stable_ortho(float tmin_z, float tmax_z)
+{
+	float near_plane = -m_near_offset;
+	float far_plane = -tmin_z;
+
+	scene_depth_range(m_light_view, -tmax_z, -tmin_z, near_plane, far_plane);
+
+	return glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, near_plane, far_plane);
+}
+
+void CSM::non_stable_crop_matrix(int i, glm::vec2 tmin, glm::vec2 tmax, const glm::mat4& t_ortho, const glm::mat4& t_modelview)
+{
+	glm::vec2 tscale(2.0f / (tmax.x - tmin.x), 2.0f / (tmax.y - tmin.y));
+	glm::vec2 toffset(-0.5f * (tmax.x + tmin.x) * tscale.x, -0.5f * (tmax.y + tmin.y) * tscale.y);
+
+	glm::mat4 t_shad_crop = glm::mat4(1.0f);
+	t_shad_crop[0][0] = tscale.x;
+	t_shad_crop[1][1] = tscale.y;
+	t_shad_crop[0][3] = toffset.x;
+	t_shad_crop[1][3] = toffset.y;
+	t_shad_crop = glm::transpose(t_shad_crop);
+
+	glm::mat4 t_projection = t_shad_crop * t_ortho;
+
+	// Store the projection matrix
+	m_proj_matrices[i] = t_projection;
+	m_crop_matrices[i] = t_projection * t_modelview;
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "depth_reduction.h"
+#include "shadow_atlas.h"
+#include "render_target_pool.h"
 #include <glm.hpp>
 #include <camera.h>
 #include <ogl.h>
@@ -7,24 +10,55 @@
 
 #define MAX_FRUSTUM_SPLITS 8
 
+struct ShadowLights;
+
 struct FrustumSplit
 {
 	float near_plane;
 	float far_plane;
+	float selection_far; // Far distance used for cascade selection. Equals far_plane unless SDSM tightened the split.
 	float ratio;
 	float fov;
 	glm::vec3 center;
 	glm::vec3 corners[8];
 };
 
+// Depth format of the shadow atlas. None of them carries stencil.
+enum ShadowDepthFormat
+{
+	SHADOW_DEPTH_D16 = 0,
+	SHADOW_DEPTH_D24,
+	SHADOW_DEPTH_D32F
+};
+
+// Inputs of the last solve, used to skip CSM::update when nothing moved.
+struct CSMUpdateState
+{
+	glm::vec3 position;
+	glm::vec3 forward;
+	glm::vec3 up;
+	glm::vec3 direction;
+	glm::mat4 projection;
+	float lambda;
+	bool stable_pssm;
+	bool sdsm;
+};
+
 struct CSM
 {
-    dw::Texture2D* m_shadow_maps = nullptr;
-	dw::Framebuffer* m_shadow_fbos[MAX_FRUSTUM_SPLITS];
+	RenderTargetPool* m_pool = nullptr; // Provides the atlas texture. Without one the CSM only solves the cascades.
+	RenderTarget* m_atlas_target = nullptr; // Atlas holding every cascade.
+	GLuint m_compare_sampler = 0;
 	float m_lambda;
-	float m_near_offset;
+	float m_near_offset; // Distance from the shadow camera to the split center, the depth range of a cascade when not fitted to the scene.
 	int   m_split_count;
-	int   m_shadow_map_size;
+	int   m_shadow_map_size; // Size of the largest cascade, the others may be reduced to fit the memory budget.
+	int   m_depth_format = SHADOW_DEPTH_D24;
+	size_t m_memory_budget = 0; // Bytes, zero for no limit.
+	ShadowAtlas m_atlas; // When part of a ShadowLights group, the slice of the shared atlas holding the cascades of this light.
+	ShadowLights* m_group = nullptr; // Packs the cascades of several lights into the atlas of its primary light.
+	bool m_owns_atlas = true; // False for the secondary lights of a group, which render into the atlas of the primary.
+	glm::mat4 m_atlas_matrices[MAX_FRUSTUM_SPLITS]; // Maps the [0, 1] texture space of a cascade to its rect of the atlas.
 	FrustumSplit m_splits[MAX_FRUSTUM_SPLITS];
     float m_far_bounds[MAX_FRUSTUM_SPLITS];
 	glm::vec3 m_light_direction;
@@ -32,26 +66,73 @@ struct CSM
 	glm::mat4 m_light_view;
 	glm::mat4 m_crop_matrices[MAX_FRUSTUM_SPLITS]; // crop * proj * view
 	glm::mat4 m_proj_matrices[MAX_FRUSTUM_SPLITS]; // crop * proj * light_view * inv_view
-    glm::mat4 m_texture_matrices[MAX_FRUSTUM_SPLITS];
+    glm::mat4 m_texture_matrices[MAX_FRUSTUM_SPLITS]; // atlas * bias * crop
 	bool m_stable_pssm = true;
+	bool m_sdsm = false;
+	DepthRange m_depth_range;
+	uint32_t m_depth_histogram[DEPTH_HISTOGRAM_BINS];
+	bool m_depth_histogram_valid = false;
+	bool m_dirty_tracking = true;
+	bool m_force_update = true;
+	bool m_dirty[MAX_FRUSTUM_SPLITS];   // Cascade has to be re-rendered this frame.
+	bool m_pending[MAX_FRUSTUM_SPLITS]; // Cascade changed but its refresh was deferred by the interval.
+	bool m_widened[MAX_FRUSTUM_SPLITS]; // Cascade was rendered widened by the camera motion over its refresh interval.
+	int  m_refresh_intervals[MAX_FRUSTUM_SPLITS]; // Refresh cascade i at most every m_refresh_intervals[i] frames.
+	uint32_t m_frame_index = 0;
+	uint32_t m_generation = 0; // Incremented every time the atlas and cascade layout are recreated.
+	CSMUpdateState m_last_state;
+	glm::mat4 m_committed_crop_matrices[MAX_FRUSTUM_SPLITS];
+	glm::mat4 m_committed_proj_matrices[MAX_FRUSTUM_SPLITS];
+	float m_committed_far_bounds[MAX_FRUSTUM_SPLITS];
+	glm::vec3 m_last_centers[MAX_FRUSTUM_SPLITS]; // Split centers of the previous update.
+	bool m_fit_scene_depth = true;
+	bool m_scene_bounds_valid = false;
+	glm::vec3 m_caster_min;
+	glm::vec3 m_caster_max;
+	glm::vec3 m_receiver_min;
+	glm::vec3 m_receiver_max;
 
 	CSM();
 	~CSM();
 	void initialize(float lambda, float near_offset, int split_count, int shadow_map_size, dw::Camera* camera, int _width, int _height, glm::vec3 dir);
+	void configure(float lambda, float near_offset, int split_count, int shadow_map_size, dw::Camera* camera, int _width, int _height);
+	void update_resources();
+	void update_atlas_matrices();
 	void shutdown();
 	void update(dw::Camera* camera, glm::vec3 dir);
+	bool begin_update(dw::Camera* camera, glm::vec3 dir);
+	void schedule_cascades();
+	void widen_crop_matrix(int i, float margin);
+	void invalidate();
+	void update_light_view(dw::Camera* camera, glm::vec3 dir);
 	void update_splits(dw::Camera* camera);
+	void set_depth_range(const DepthRange& range, const uint32_t* histogram);
+	void set_scene_bounds(const glm::vec3& caster_min, const glm::vec3& caster_max, const glm::vec3& receiver_min, const glm::vec3& receiver_max);
+	bool scene_depth_range(const glm::mat4& view, float receiver_near, float receiver_far, float& near_plane, float& far_plane);
+	void tighten_splits();
 	void update_frustum_corners(dw::Camera* camera);
 	void update_crop_matrices(glm::mat4 t_modelview, dw::Camera* camera);
     void update_texture_matrices(dw::Camera* camera);
     void update_far_bounds(dw::Camera* camera);
+	void stable_crop_matrix(int i, float radius, dw::Camera* camera, glm::mat4& view);
+	void snap_crop_matrix(int i, glm::vec2 round_offset, const glm::mat4& view);
+	glm::mat4 non_stable_ortho(float tmin_z, float tmax_z);
+	void non_stable_crop_matrix(int i, glm::vec2 tmin, glm::vec2 tmax, const glm::mat4& t_ortho, const glm::mat4& t_modelview);
 	
     inline FrustumSplit* frustum_splits() { return &m_splits[0]; }
     inline glm::mat4 split_view_proj(int i) { return m_crop_matrices[i]; }
     inline glm::mat4 texture_matrix(int i) { return m_texture_matrices[i]; }
     inline float far_bound(int i) { return m_far_bounds[i]; }
-	inline dw::Texture2D* shadow_map() { return m_shadow_maps; }
-	inline dw::Framebuffer** framebuffers() { return &m_shadow_fbos[0]; }
+	inline dw::Texture2D* shadow_map() { return m_atlas_target ? m_atlas_target->texture() : nullptr; }
+	inline GLuint framebuffer() { return m_atlas_target->framebuffer(); }
+	inline const ShadowAtlasRect& atlas_rect(int i) { return m_atlas.m_rects[i]; }
+	inline glm::vec4 atlas_uv_rect(int i) { return m_atlas.uv_rect(i); }
+	inline int cascade_size(int i) { return m_atlas.m_sizes[i]; }
+	inline size_t memory_used() { return m_atlas.m_memory_used; }
+	int bytes_per_texel();
+	inline GLuint compare_sampler() { return m_compare_sampler; }
+	inline bool cascade_dirty(int i) { return m_dirty[i]; }
+	inline bool depth_clamp() { return m_fit_scene_depth && m_scene_bounds_valid; }
 	inline uint32_t frustum_split_count() { return m_split_count; }
 	inline uint32_t near_offset() { return m_near_offset; }
 	inline uint32_t lambda() { return m_lambda; }
@@ -0,0 +1,381 @@
+#include "csm_batch.h"
+#include "simd.h"
+#include <gtc/matrix_transform.hpp>
+#include <string.h>
+
+// Row r of a matrix transforming a point (x, y, z, 1). Evaluated in the same order as glm's mat4 * vec4.
+inline simd_float simd_transform_row(const float (&row)[4][MAX_BATCH_LANES], int lane, simd_float x, simd_float y, simd_float z)
+{
+	simd_float a = simd_add(simd_mul(simd_load(&row[0][lane]), x), simd_mul(simd_load(&row[1][lane]), y));
+	simd_float b = simd_add(simd_mul(simd_load(&row[2][lane]), z), simd_load(&row[3][lane]));
+	return simd_add(a, b);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+const char* CSMBatch::simd_name()
+{
+	return CSM_SIMD_NAME;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int CSMBatch::simd_width()
+{
+	return CSM_SIMD_WIDTH;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CSMBatch::update(CSMBatchView* views, int count)
+{
+	// Larger batches are solved MAX_BATCH_VIEWS views at a time.
+	while (count > MAX_BATCH_VIEWS)
+	{
+		update(views, MAX_BATCH_VIEWS);
+		views += MAX_BATCH_VIEWS;
+		count -= MAX_BATCH_VIEWS;
+	}
+
+	// Scalar fallback: solve every view one cascade at a time.
+	if (!m_simd)
+	{
+		for (int i = 0; i < count; i++)
+			views[i].csm->update(views[i].camera, views[i].direction);
+
+		return;
+	}
+
+	m_view_count = 0;
+
+	// Only solve the views whose inputs changed since the last update.
+	for (int i = 0; i < count; i++)
+	{
+		CSM* csm = views[i].csm;
+
+		if (!csm->begin_update(views[i].camera, views[i].direction))
+			continue;
+
+		m_views[m_view_count++] = views[i];
+
+		csm->update_light_view(views[i].camera, views[i].direction);
+		csm->update_splits(views[i].camera);
+	}
+
+	count = m_view_count;
+
+	if (count == 0)
+		return;
+
+	gather_splits();
+	update_frustum_corners();
+	update_bounds();
+	scatter_splits();
+	update_crop_matrices();
+
+	for (int i = 0; i < count; i++)
+	{
+		m_views[i].csm->update_texture_matrices(m_views[i].camera);
+		m_views[i].csm->update_far_bounds(m_views[i].camera);
+		m_views[i].csm->schedule_cascades();
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CSMBatch::gather_splits()
+{
+	int lane = 0;
+
+	for (int v = 0; v < m_view_count; v++)
+	{
+		CSM* csm = m_views[v].csm;
+		dw::Camera* camera = m_views[v].camera;
+
+		m_view_lane[v] = lane;
+
+		glm::vec3 center = camera->m_position;
+		glm::vec3 view_dir = camera->m_forward;
+
+		// Same sequence of operations as CSM::update_frustum_corners so the basis of every split is identical.
+		glm::vec3 up(0.0f, 1.0f, 0.0f);
+		glm::vec3 right = glm::cross(view_dir, up);
+
+		for (int i = 0; i < csm->m_split_count; i++, lane++)
+		{
+			FrustumSplit& t_frustum = csm->m_splits[i];
+
+			right = glm::normalize(right);
+			up = glm::normalize(glm::cross(right, view_dir));
+
+			m_soa.near_plane[lane] = t_frustum.near_plane;
+			m_soa.far_plane[lane] = t_frustum.far_plane;
+			m_soa.near_height[lane] = tan(t_frustum.fov / 2.0f) * t_frustum.near_plane;
+			m_soa.far_height[lane] = tan(t_frustum.fov / 2.0f) * t_frustum.far_plane;
+			m_soa.ratio[lane] = t_frustum.ratio;
+
+			for (int c = 0; c < 3; c++)
+			{
+				m_soa.position[c][lane] = center[c];
+				m_soa.forward[c][lane] = view_dir[c];
+				m_soa.up[c][lane] = up[c];
+				m_soa.right[c][lane] = right[c];
+			}
+
+			// Light view rows for the z-range of the split.
+			for (int r = 0; r < 4; r++)
+			{
+				for (int c = 0; c < 4; c++)
+					m_soa.light_row[r][c][lane] = csm->m_light_view[c][r];
+			}
+
+			m_soa.half_size[lane] = csm->cascade_size(i) / 2.0f;
+			m_soa.inv_half_size[lane] = 2.0f / csm->cascade_size(i);
+		}
+	}
+
+	m_lane_count = lane;
+	m_padded_lane_count = ((lane + CSM_SIMD_WIDTH - 1) / CSM_SIMD_WIDTH) * CSM_SIMD_WIDTH;
+
+	// Padding lanes are computed but never read back. Zero them so they stay deterministic.
+	for (int i = m_lane_count; i < m_padded_lane_count; i++)
+	{
+		m_soa.near_plane[i] = m_soa.far_plane[i] = m_soa.near_height[i] = m_soa.far_height[i] = m_soa.ratio[i] = 0.0f;
+		m_soa.half_size[i] = m_soa.inv_half_size[i] = 0.0f;
+
+		for (int c = 0; c < 3; c++)
+			m_soa.position[c][i] = m_soa.forward[c][i] = m_soa.up[c][i] = m_soa.right[c][i] = 0.0f;
+
+		for (int r = 0; r < 4; r++)
+		{
+			for (int c = 0; c < 4; c++)
+				m_soa.light_row[r][c][i] = 0.0f;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CSMBatch::update_frustum_corners()
+{
+	for (int i = 0; i < m_padded_lane_count; i += CSM_SIMD_WIDTH)
+	{
+		simd_float near_plane = simd_load(&m_soa.near_plane[i]);
+		simd_float far_plane = simd_load(&m_soa.far_plane[i]);
+		simd_float near_height = simd_load(&m_soa.near_height[i]);
+		simd_float far_height = simd_load(&m_soa.far_height[i]);
+		simd_float ratio = simd_load(&m_soa.ratio[i]);
+
+		// these heights and widths are half the heights and widths of
+		// the near and far plane rectangles
+		simd_float near_width = simd_mul(near_height, ratio);
+		simd_float far_width = simd_mul(far_height, ratio);
+
+		for (int c = 0; c < 3; c++)
+		{
+			simd_float position = simd_load(&m_soa.position[c][i]);
+			simd_float forward = simd_load(&m_soa.forward[c][i]);
+			simd_float up = simd_load(&m_soa.up[c][i]);
+			simd_float right = simd_load(&m_soa.right[c][i]);
+
+			simd_float nc = simd_add(position, simd_mul(forward, near_plane));
+			simd_float fc = simd_add(position, simd_mul(forward, far_plane));
+
+			simd_float near_up = simd_mul(up, near_height);
+			simd_float near_right = simd_mul(right, near_width);
+			simd_float far_up = simd_mul(up, far_height);
+			simd_float far_right = simd_mul(right, far_width);
+
+			simd_store(&m_soa.corners[0][c][i], simd_sub(simd_sub(nc, near_up), near_right)); // near-bottom-left
+			simd_store(&m_soa.corners[1][c][i], simd_sub(simd_add(nc, near_up), near_right)); // near-top-left
+			simd_store(&m_soa.corners[2][c][i], simd_add(simd_add(nc, near_up), near_right)); // near-top-right
+			simd_store(&m_soa.corners[3][c][i], simd_add(simd_sub(nc, near_up), near_right)); // near-bottom-right
+
+			simd_store(&m_soa.corners[4][c][i], simd_sub(simd_sub(fc, far_up), far_right)); // far-bottom-left
+			simd_store(&m_soa.corners[5][c][i], simd_sub(simd_add(fc, far_up), far_right)); // far-top-left
+			simd_store(&m_soa.corners[6][c][i], simd_add(simd_add(fc, far_up), far_right)); // far-top-right
+			simd_store(&m_soa.corners[7][c][i], simd_add(simd_sub(fc, far_up), far_right)); // far-bottom-right
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CSMBatch::update_bounds()
+{
+	for (int i = 0; i < m_padded_lane_count; i += CSM_SIMD_WIDTH)
+	{
+		// Light-space z-range of the split.
+		simd_float min_z = simd_transform_row(m_soa.light_row[2], i, simd_load(&m_soa.corners[0][0][i]), simd_load(&m_soa.corners[0][1][i]), simd_load(&m_soa.corners[0][2][i]));
+		simd_float max_z = min_z;
+
+		for (int j = 1; j < 8; j++)
+		{
+			simd_float z = simd_transform_row(m_soa.light_row[2], i, simd_load(&m_soa.corners[j][0][i]), simd_load(&m_soa.corners[j][1][i]), simd_load(&m_soa.corners[j][2][i]));
+			max_z = simd_max(z, max_z);
+			min_z = simd_min(z, min_z);
+		}
+
+		simd_store(&m_soa.min_z[i], min_z);
+		simd_store(&m_soa.max_z[i], max_z);
+
+		// Split center.
+		simd_float center[3];
+
+		for (int c = 0; c < 3; c++)
+		{
+			center[c] = simd_set1(0.0f);
+
+			for (int j = 0; j < 8; j++)
+				center[c] = simd_add(center[c], simd_load(&m_soa.corners[j][c][i]));
+
+			center[c] = simd_div(center[c], simd_set1(8.0f));
+			simd_store(&m_soa.center[c][i], center[c]);
+		}
+
+		// Bounding sphere radius, rounded up to 1/16th of a unit.
+		simd_float radius = simd_set1(0.0f);
+
+		for (int j = 0; j < 8; j++)
+		{
+			simd_float dx = simd_sub(simd_load(&m_soa.corners[j][0][i]), center[0]);
+			simd_float dy = simd_sub(simd_load(&m_soa.corners[j][1][i]), center[1]);
+			simd_float dz = simd_sub(simd_load(&m_soa.corners[j][2][i]), center[2]);
+
+			simd_float length = simd_sqrt(simd_add(simd_add(simd_mul(dx, dx), simd_mul(dy, dy)), simd_mul(dz, dz)));
+			radius = simd_max(length, radius);
+		}
+
+		radius = simd_div(simd_ceil(simd_mul(radius, simd_set1(16.0f))), simd_set1(16.0f));
+		simd_store(&m_soa.radius[i], radius);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CSMBatch::scatter_splits()
+{
+	for (int v = 0; v < m_view_count; v++)
+	{
+		CSM* csm = m_views[v].csm;
+		int lane = m_view_lane[v];
+
+		for (int i = 0; i < csm->m_split_count; i++, lane++)
+		{
+			FrustumSplit& t_frustum = csm->m_splits[i];
+
+			for (int j = 0; j < 8; j++)
+				t_frustum.corners[j] = glm::vec3(m_soa.corners[j][0][lane], m_soa.corners[j][1][lane], m_soa.corners[j][2][lane]);
+
+			t_frustum.center = glm::vec3(m_soa.center[0][lane], m_soa.center[1][lane], m_soa.center[2][lane]);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CSMBatch::update_crop_matrices()
+{
+	// Build the unsnapped ortho projections (stable) or the light projections that the split extents are measured in (non-stable).
+	for (int v = 0; v < m_view_count; v++)
+	{
+		CSM* csm = m_views[v].csm;
+		int lane = m_view_lane[v];
+
+		for (int i = 0; i < csm->m_split_count; i++, lane++)
+		{
+			glm::mat4& m = m_lane_matrices[lane];
+
+			if (csm->m_stable_pssm)
+			{
+				csm->stable_crop_matrix(i, m_soa.radius[lane], m_views[v].camera, m);
+
+				for (int c = 0; c < 4; c++)
+				{
+					m_soa.origin[0][c][lane] = csm->m_crop_matrices[i][c][0];
+					m_soa.origin[1][c][lane] = csm->m_crop_matrices[i][c][1];
+				}
+			}
+			else
+			{
+				m = csm->non_stable_ortho(m_soa.min_z[lane], m_soa.max_z[lane]);
+				glm::mat4 t_shad_mvp = m * csm->m_light_view;
+
+				for (int r = 0; r < 4; r++)
+				{
+					for (int c = 0; c < 4; c++)
+						m_soa.light_row[r][c][lane] = t_shad_mvp[c][r];
+				}
+			}
+		}
+	}
+
+	for (int i = m_lane_count; i < m_padded_lane_count; i++)
+	{
+		for (int c = 0; c < 4; c++)
+			m_soa.origin[0][c][i] = m_soa.origin[1][c][i] = 0.0f;
+	}
+
+	for (int i = 0; i < m_padded_lane_count; i += CSM_SIMD_WIDTH)
+	{
+		simd_float zero = simd_set1(0.0f);
+
+		// Texel snapping: round the shadow origin to the nearest texel.
+		for (int c = 0; c < 2; c++)
+		{
+			simd_float a = simd_add(simd_mul(simd_load(&m_soa.origin[c][0][i]), zero), simd_mul(simd_load(&m_soa.origin[c][1][i]), zero));
+			simd_float b = simd_add(simd_mul(simd_load(&m_soa.origin[c][2][i]), zero), simd_load(&m_soa.origin[c][3][i]));
+			simd_float shadow_origin = simd_mul(simd_add(a, b), simd_load(&m_soa.half_size[i]));
+
+			simd_float round_offset = simd_sub(simd_round(shadow_origin), shadow_origin);
+			simd_store(&m_soa.round_offset[c][i], simd_mul(round_offset, simd_load(&m_soa.inv_half_size[i])));
+		}
+
+		// Non-stable: extents of the split in the light's homogeneous coordinates.
+		simd_float min_x = simd_set1(INFINITY);
+		simd_float min_y = simd_set1(INFINITY);
+		simd_float max_x = simd_set1(-INFINITY);
+		simd_float max_y = simd_set1(-INFINITY);
+
+		for (int j = 0; j < 8; j++)
+		{
+			simd_float x = simd_load(&m_soa.corners[j][0][i]);
+			simd_float y = simd_load(&m_soa.corners[j][1][i]);
+			simd_float z = simd_load(&m_soa.corners[j][2][i]);
+
+			simd_float w = simd_transform_row(m_soa.light_row[3], i, x, y, z);
+			simd_float tx = simd_div(simd_transform_row(m_soa.light_row[0], i, x, y, z), w);
+			simd_float ty = simd_div(simd_transform_row(m_soa.light_row[1], i, x, y, z), w);
+
+			max_x = simd_max(tx, max_x);
+			min_x = simd_min(tx, min_x);
+			max_y = simd_max(ty, max_y);
+			min_y = simd_min(ty, min_y);
+		}
+
+		simd_store(&m_soa.min_xy[0][i], min_x);
+		simd_store(&m_soa.min_xy[1][i], min_y);
+		simd_store(&m_soa.max_xy[0][i], max_x);
+		simd_store(&m_soa.max_xy[1][i], max_y);
+	}
+
+	for (int v = 0; v < m_view_count; v++)
+	{
+		CSM* csm = m_views[v].csm;
+		int lane = m_view_lane[v];
+
+		for (int i = 0; i < csm->m_split_count; i++, lane++)
+		{
+			if (csm->m_stable_pssm)
+				csm->snap_crop_matrix(i, glm::vec2(m_soa.round_offset[0][lane], m_soa.round_offset[1][lane]), m_lane_matrices[lane]);
+			else
+			{
+				csm->non_stable_crop_matrix(i,
+											glm::vec2(m_soa.min_xy[0][lane], m_soa.min_xy[1][lane]),
+											glm::vec2(m_soa.max_xy[0][lane], m_soa.max_xy[1][lane]),
+											m_lane_matrices[lane],
+											csm->m_light_view);
+			}
+		}
+	}
+}
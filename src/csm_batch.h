@@ -0,0 +1,73 @@
+#pragma once
+
+#include "csm.h"
+#include <macros.h>
+
+#define MAX_BATCH_VIEWS 16
+#define MAX_BATCH_LANES (MAX_BATCH_VIEWS * MAX_FRUSTUM_SPLITS)
+
+// A single shadowed view to be solved by the batch: the CSM instance receiving the results, the camera whose frustum is split and the light direction.
+struct CSMBatchView
+{
+	CSM* csm;
+	dw::Camera* camera;
+	glm::vec3 direction;
+};
+
+// Structure-of-arrays storage for every frustum split in a batch. One lane per (view, split) pair, padded to the SIMD width.
+struct CSMSplitSoA
+{
+	// Inputs gathered from the camera and the split scheme.
+	DW_ALIGNED(32) float near_plane[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float far_plane[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float near_height[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float far_height[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float ratio[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float position[3][MAX_BATCH_LANES];
+	DW_ALIGNED(32) float forward[3][MAX_BATCH_LANES];
+	DW_ALIGNED(32) float up[3][MAX_BATCH_LANES];
+	DW_ALIGNED(32) float right[3][MAX_BATCH_LANES];
+
+	// Rows (x, y, z, w) of the light view, and later of the light projection, used when transforming the corners.
+	DW_ALIGNED(32) float light_row[4][4][MAX_BATCH_LANES];
+
+	// Outputs.
+	DW_ALIGNED(32) float corners[8][3][MAX_BATCH_LANES];
+	DW_ALIGNED(32) float center[3][MAX_BATCH_LANES];
+	DW_ALIGNED(32) float radius[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float min_z[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float max_z[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float min_xy[2][MAX_BATCH_LANES];
+	DW_ALIGNED(32) float max_xy[2][MAX_BATCH_LANES];
+
+	// Texel snapping: shadow origin (crop * (0, 0, 0, 1)) in, rounding offset out.
+	DW_ALIGNED(32) float origin[2][4][MAX_BATCH_LANES];
+	DW_ALIGNED(32) float half_size[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float inv_half_size[MAX_BATCH_LANES];
+	DW_ALIGNED(32) float round_offset[2][MAX_BATCH_LANES];
+};
+
+// Solves the cascades of any number of cameras/lights in one call, MAX_BATCH_VIEWS at a time. The SIMD kernels evaluate the exact
+// same floating point operations as CSM::update, one lane per split, so the results are bit-identical to the scalar path which
+// remains selectable through m_simd.
+struct CSMBatch
+{
+	CSMSplitSoA m_soa;
+	CSMBatchView m_views[MAX_BATCH_VIEWS];
+	glm::mat4 m_lane_matrices[MAX_BATCH_LANES];
+	int m_view_lane[MAX_BATCH_VIEWS];
+	int m_view_count = 0;
+	int m_lane_count = 0;
+	int m_padded_lane_count = 0;
+	bool m_simd = true;
+
+	void update(CSMBatchView* views, int count);
+	void gather_splits();
+	void update_frustum_corners();
+	void update_bounds();
+	void update_crop_matrices();
+	void scatter_splits();
+
+	static const char* simd_name();
+	static int simd_width();
+};
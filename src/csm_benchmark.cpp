@@ -0,0 +1,398 @@
+// Headless CPU microbenchmark for the CSM math. Runs CSM::update stage by stage over randomized camera paths without a window or
+// GL context and reports ns/op for every stage. Before timing anything, checks that the batched SIMD kernels match the scalar solver
+// and that the CPU depth reduction matches the reduction chain of SDSM, and exits with an error if they do not.
+//
+// Usage: CSMBenchmark [iterations] [seed]
+
+#include "csm.h"
+#include "csm_batch.h"
+#include "sdsm.h"
+#include <gtc/matrix_transform.hpp>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <math.h>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCHMARK_PATH_LENGTH 1024
+#define BENCHMARK_WIDTH 1920
+#define BENCHMARK_HEIGHT 1080
+#define BENCHMARK_FAR_PLANE 1000.0f
+#define VALIDATION_BATCHES 128
+#define VALIDATION_BATCH_VIEWS (2 * MAX_BATCH_VIEWS + 3) // Views per batch call, more than one chunk of the batch.
+
+typedef std::chrono::steady_clock Clock;
+
+enum BenchmarkStage
+{
+	STAGE_LIGHT_VIEW = 0,
+	STAGE_SPLITS,
+	STAGE_FRUSTUM_CORNERS,
+	STAGE_CROP_MATRICES,
+	STAGE_TEXTURE_MATRICES,
+	STAGE_FAR_BOUNDS,
+	STAGE_UPDATE,
+	STAGE_BATCH_UPDATE,
+	STAGE_COUNT
+};
+
+static const char* g_stage_names[] =
+{
+	"update_light_view",
+	"update_splits",
+	"update_frustum_corners",
+	"update_crop_matrices",
+	"update_texture_matrices",
+	"update_far_bounds",
+	"update (total)",
+	"batch update (per view)"
+};
+
+// A single pose of the mocked camera.
+struct CameraPose
+{
+	glm::vec3 position;
+	glm::vec3 forward;
+	glm::vec3 light_direction;
+};
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+// Random walk through a Sponza-sized volume with a slowly turning view and light direction.
+void generate_camera_path(std::mt19937& rng, std::vector<CameraPose>& path)
+{
+	std::uniform_real_distribution<float> step(-1.0f, 1.0f);
+
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+	glm::vec3 position(0.0f, 5.0f, 20.0f);
+	glm::vec3 light(-1.0f, -1.0f, 0.0f);
+
+	path.resize(BENCHMARK_PATH_LENGTH);
+
+	for (int i = 0; i < BENCHMARK_PATH_LENGTH; i++)
+	{
+		yaw += step(rng) * 0.1f;
+		pitch = glm::clamp(pitch + step(rng) * 0.05f, -1.2f, 1.2f);
+
+		glm::vec3 forward = glm::normalize(glm::vec3(cosf(pitch) * sinf(yaw), sinf(pitch), -cosf(pitch) * cosf(yaw)));
+		position = position + forward * (step(rng) + 1.0f) + glm::vec3(step(rng), step(rng) * 0.1f, step(rng)) * 0.5f;
+
+		light.x = glm::clamp(light.x + step(rng) * 0.01f, -1.0f, 1.0f);
+		light.z = glm::clamp(light.z + step(rng) * 0.01f, -1.0f, 1.0f);
+
+		path[i].position = position;
+		path[i].forward = forward;
+		path[i].light_direction = light;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+// Sets the camera state that CSM reads directly, bypassing dw::Camera::update which expects input deltas.
+void set_camera_pose(dw::Camera* camera, const CameraPose& pose)
+{
+	camera->m_position = pose.position;
+	camera->m_forward = pose.forward;
+	camera->m_right = glm::normalize(glm::cross(pose.forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+	camera->m_up = glm::normalize(glm::cross(camera->m_right, pose.forward));
+	camera->m_view = glm::lookAt(pose.position, pose.position + pose.forward, camera->m_up);
+	camera->m_projection = glm::perspective(glm::radians(camera->m_fov), float(BENCHMARK_WIDTH) / float(BENCHMARK_HEIGHT), camera->m_near, camera->m_far);
+	camera->m_view_projection = camera->m_projection * camera->m_view;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+// Solves random cameras and lights with CSM::update and with the batched kernels. The crop matrices and far bounds have to be
+// bit-identical.
+bool validate_batch(std::mt19937& rng, int split_count, bool stable)
+{
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	static dw::Camera* cameras[VALIDATION_BATCH_VIEWS];
+	static CSM scalar[VALIDATION_BATCH_VIEWS];
+	static CSM batched[VALIDATION_BATCH_VIEWS];
+	static CSMBatch batch;
+	CSMBatchView views[VALIDATION_BATCH_VIEWS];
+
+	for (int v = 0; v < VALIDATION_BATCH_VIEWS; v++)
+	{
+		if (!cameras[v])
+			cameras[v] = new dw::Camera(60.0f, 0.1f, BENCHMARK_FAR_PLANE, float(BENCHMARK_WIDTH) / float(BENCHMARK_HEIGHT), glm::vec3(0.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0, -1.0f));
+
+		scalar[v].m_stable_pssm = stable;
+		scalar[v].configure(0.3f, 250.0f, split_count, 2048, cameras[v], BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+		batched[v].m_stable_pssm = stable;
+		batched[v].configure(0.3f, 250.0f, split_count, 2048, cameras[v], BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+	}
+
+	batch.m_simd = true;
+
+	for (int i = 0; i < VALIDATION_BATCHES; i++)
+	{
+		for (int v = 0; v < VALIDATION_BATCH_VIEWS; v++)
+		{
+			CameraPose pose;
+			pose.position = glm::vec3(unit(rng) * 500.0f, unit(rng) * 50.0f + 60.0f, unit(rng) * 500.0f);
+			pose.forward = glm::normalize(glm::vec3(unit(rng), unit(rng) * 0.5f, unit(rng)));
+			pose.light_direction = glm::normalize(glm::vec3(unit(rng), -1.0f, unit(rng)));
+
+			set_camera_pose(cameras[v], pose);
+			scalar[v].update(cameras[v], pose.light_direction);
+			views[v] = { &batched[v], cameras[v], pose.light_direction };
+		}
+
+		batch.update(views, VALIDATION_BATCH_VIEWS);
+
+		for (int v = 0; v < VALIDATION_BATCH_VIEWS; v++)
+		{
+			for (int s = 0; s < split_count; s++)
+			{
+				bool match = memcmp(&scalar[v].m_far_bounds[s], &batched[v].m_far_bounds[s], sizeof(float)) == 0 &&
+							 memcmp(&scalar[v].m_crop_matrices[s], &batched[v].m_crop_matrices[s], sizeof(glm::mat4)) == 0;
+
+				if (!match)
+				{
+					printf("Batch mismatch: %s kernels, %d splits, stable %s, view %d, split %d\n", CSMBatch::simd_name(), split_count, stable ? "yes" : "no", i * VALIDATION_BATCH_VIEWS + v, s);
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+// Reduces a synthetic depth buffer with reduce_depth, and with 4x4 (min, max) blocks down to a single texel like the GPU chain of
+// SDSMReduction followed by reduce_depth_min_max. Both have to give the same range, and the histogram has to count every pixel.
+bool validate_depth_reduction(std::mt19937& rng, float background)
+{
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	int width = BENCHMARK_WIDTH;
+	int height = BENCHMARK_HEIGHT;
+	std::vector<float> depth((size_t)width * height);
+	uint32_t visible = 0;
+
+	for (float& d : depth)
+	{
+		d = unit(rng) < background ? 1.0f : 0.9f + 0.0999f * unit(rng);
+		visible += d < 1.0f ? 1 : 0;
+	}
+
+	// First level skips the background, leaving the neutral pair (1, 0) in blocks without geometry.
+	std::vector<float> level((size_t)width * height * 2);
+
+	for (size_t i = 0; i < depth.size(); i++)
+	{
+		level[i * 2] = depth[i] < 1.0f ? depth[i] : 1.0f;
+		level[i * 2 + 1] = depth[i] < 1.0f ? depth[i] : 0.0f;
+	}
+
+	while (width > 1 || height > 1)
+	{
+		int w = (width + SDSM_REDUCTION_FACTOR - 1) / SDSM_REDUCTION_FACTOR;
+		int h = (height + SDSM_REDUCTION_FACTOR - 1) / SDSM_REDUCTION_FACTOR;
+		std::vector<float> next((size_t)w * h * 2);
+
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++)
+			{
+				float min_depth = 1.0f;
+				float max_depth = 0.0f;
+
+				for (int j = y * SDSM_REDUCTION_FACTOR; j < std::min((y + 1) * SDSM_REDUCTION_FACTOR, height); j++)
+				{
+					for (int i = x * SDSM_REDUCTION_FACTOR; i < std::min((x + 1) * SDSM_REDUCTION_FACTOR, width); i++)
+					{
+						min_depth = std::min(min_depth, level[((size_t)j * width + i) * 2]);
+						max_depth = std::max(max_depth, level[((size_t)j * width + i) * 2 + 1]);
+					}
+				}
+
+				next[((size_t)y * w + x) * 2] = min_depth;
+				next[((size_t)y * w + x) * 2 + 1] = max_depth;
+			}
+		}
+
+		level.swap(next);
+		width = w;
+		height = h;
+	}
+
+	DepthRange reference = reduce_depth(depth.data(), (uint32_t)depth.size(), 0.1f, BENCHMARK_FAR_PLANE);
+	DepthRange reduced = reduce_depth_min_max(level.data(), 1, 0.1f, BENCHMARK_FAR_PLANE);
+
+	if (reference.valid != reduced.valid || (reference.valid && (reference.min_depth != reduced.min_depth || reference.max_depth != reduced.max_depth)))
+	{
+		printf("Depth reduction mismatch: %.4f - %.4f against %.4f - %.4f\n", reference.min_depth, reference.max_depth, reduced.min_depth, reduced.max_depth);
+		return false;
+	}
+
+	uint32_t bins[DEPTH_HISTOGRAM_BINS];
+	uint32_t counted = 0;
+
+	build_depth_histogram(depth.data(), (uint32_t)depth.size(), 1, 0.1f, BENCHMARK_FAR_PLANE, reference, bins);
+
+	for (int i = 0; i < DEPTH_HISTOGRAM_BINS; i++)
+		counted += bins[i];
+
+	if (counted != visible)
+	{
+		printf("Depth histogram mismatch: %u pixels counted out of %u\n", counted, visible);
+		return false;
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+template <typename T>
+inline double time_ns(T func)
+{
+	Clock::time_point start = Clock::now();
+	func();
+	return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+// Average cost of reading the clock, subtracted from every stage measurement.
+double timer_overhead_ns()
+{
+	double total = 0.0;
+
+	for (int i = 0; i < 100000; i++)
+		total += time_ns([]() {});
+
+	return total / 100000.0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void run_benchmark(int split_count, bool stable, int iterations, const std::vector<CameraPose>& path, double overhead, double* results)
+{
+	dw::Camera camera(60.0f, 0.1f, BENCHMARK_FAR_PLANE, float(BENCHMARK_WIDTH) / float(BENCHMARK_HEIGHT), glm::vec3(0.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0, -1.0f));
+
+	CSM csm;
+	csm.m_stable_pssm = stable;
+	csm.configure(0.3f, 250.0f, split_count, 2048, &camera, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+
+	for (int i = 0; i < STAGE_COUNT; i++)
+		results[i] = 0.0;
+
+	// Stage by stage.
+	for (int i = 0; i < iterations; i++)
+	{
+		const CameraPose& pose = path[i % path.size()];
+		set_camera_pose(&camera, pose);
+
+		results[STAGE_LIGHT_VIEW] += time_ns([&]() { csm.update_light_view(&camera, pose.light_direction); });
+		results[STAGE_SPLITS] += time_ns([&]() { csm.update_splits(&camera); });
+		results[STAGE_FRUSTUM_CORNERS] += time_ns([&]() { csm.update_frustum_corners(&camera); });
+		results[STAGE_CROP_MATRICES] += time_ns([&]() { csm.update_crop_matrices(csm.m_light_view, &camera); });
+		results[STAGE_TEXTURE_MATRICES] += time_ns([&]() { csm.update_texture_matrices(&camera); });
+		results[STAGE_FAR_BOUNDS] += time_ns([&]() { csm.update_far_bounds(&camera); });
+	}
+
+	// Whole update.
+	for (int i = 0; i < iterations; i++)
+	{
+		const CameraPose& pose = path[i % path.size()];
+		set_camera_pose(&camera, pose);
+
+		results[STAGE_UPDATE] += time_ns([&]() { csm.update(&camera, pose.light_direction); });
+	}
+
+	// Batched solver, a full batch of views sharing the camera path at different offsets.
+	static dw::Camera* batch_cameras[MAX_BATCH_VIEWS];
+	static CSM batch_csms[MAX_BATCH_VIEWS];
+	static CSMBatch batch;
+	CSMBatchView views[MAX_BATCH_VIEWS];
+
+	for (int v = 0; v < MAX_BATCH_VIEWS; v++)
+	{
+		if (!batch_cameras[v])
+			batch_cameras[v] = new dw::Camera(60.0f, 0.1f, BENCHMARK_FAR_PLANE, float(BENCHMARK_WIDTH) / float(BENCHMARK_HEIGHT), glm::vec3(0.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0, -1.0f));
+
+		batch_csms[v].m_stable_pssm = stable;
+		batch_csms[v].configure(0.3f, 250.0f, split_count, 2048, batch_cameras[v], BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+	}
+
+	int batch_iterations = iterations / MAX_BATCH_VIEWS;
+
+	for (int i = 0; i < batch_iterations; i++)
+	{
+		for (int v = 0; v < MAX_BATCH_VIEWS; v++)
+		{
+			const CameraPose& pose = path[(i + v * 61) % path.size()];
+			set_camera_pose(batch_cameras[v], pose);
+			views[v] = { &batch_csms[v], batch_cameras[v], pose.light_direction };
+		}
+
+		results[STAGE_BATCH_UPDATE] += time_ns([&]() { batch.update(views, MAX_BATCH_VIEWS); });
+	}
+
+	for (int i = 0; i < STAGE_BATCH_UPDATE; i++)
+		results[i] = results[i] / iterations - overhead;
+
+	results[STAGE_BATCH_UPDATE] = (results[STAGE_BATCH_UPDATE] / batch_iterations - overhead) / MAX_BATCH_VIEWS;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, const char* argv[])
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+	unsigned int seed = argc > 2 ? (unsigned int)atoi(argv[2]) : 1337u;
+
+	if (iterations < MAX_BATCH_VIEWS)
+		iterations = MAX_BATCH_VIEWS;
+
+	std::mt19937 rng(seed);
+	std::vector<CameraPose> path;
+	generate_camera_path(rng, path);
+
+	for (int stable = 1; stable >= 0; stable--)
+	{
+		for (int split_count = 1; split_count <= MAX_FRUSTUM_SPLITS; split_count++)
+		{
+			if (!validate_batch(rng, split_count, stable == 1))
+				return 1;
+		}
+	}
+
+	printf("Batch validation: %s kernels match the scalar solver over %d views per configuration\n", CSMBatch::simd_name(), VALIDATION_BATCHES * VALIDATION_BATCH_VIEWS);
+
+	// Partly covered, empty and fully covered screens.
+	if (!validate_depth_reduction(rng, 0.3f) || !validate_depth_reduction(rng, 1.0f) || !validate_depth_reduction(rng, 0.0f))
+		return 1;
+
+	printf("Depth reduction validation: CPU reduction matches the reduction chain\n");
+
+	double overhead = timer_overhead_ns();
+
+	printf("CSM benchmark: %d iterations, seed %u, batch kernels: %s, timer overhead: %.1f ns\n\n", iterations, seed, CSMBatch::simd_name(), overhead);
+	printf("%-8s %-8s %-26s %10s\n", "splits", "stable", "stage", "ns/op");
+
+	for (int stable = 1; stable >= 0; stable--)
+	{
+		for (int split_count = 1; split_count <= MAX_FRUSTUM_SPLITS; split_count++)
+		{
+			double results[STAGE_COUNT];
+			run_benchmark(split_count, stable == 1, iterations, path, overhead, results);
+
+			for (int i = 0; i < STAGE_COUNT; i++)
+				printf("%-8d %-8s %-26s %10.1f\n", split_count, stable ? "yes" : "no", g_stage_names[i], results[i]);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include "depth_reduction.h"
+#include <string.h>
+
+float linearize_depth(float depth, float near_plane, float far_plane)
+{
+	float z_ndc = depth * 2.0f - 1.0f;
+	return (2.0f * near_plane * far_plane) / (far_plane + near_plane - z_ndc * (far_plane - near_plane));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+DepthRange reduce_depth(const float* depth, uint32_t count, float near_plane, float far_plane)
+{
+	float min_depth = 1.0f;
+	float max_depth = 0.0f;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (depth[i] < 1.0f)
+		{
+			if (depth[i] < min_depth) { min_depth = depth[i]; }
+			if (depth[i] > max_depth) { max_depth = depth[i]; }
+		}
+	}
+
+	DepthRange range;
+
+	range.valid = min_depth <= max_depth;
+	range.min_depth = range.valid ? linearize_depth(min_depth, near_plane, far_plane) : near_plane;
+	range.max_depth = range.valid ? linearize_depth(max_depth, near_plane, far_plane) : far_plane;
+
+	return range;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+DepthRange reduce_depth_min_max(const float* min_max, uint32_t count, float near_plane, float far_plane)
+{
+	float min_depth = 1.0f;
+	float max_depth = 0.0f;
+
+	// Texels without any geometry hold the neutral pair (1, 0) and drop out naturally.
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (min_max[i * 2] < min_depth) { min_depth = min_max[i * 2]; }
+		if (min_max[i * 2 + 1] > max_depth) { max_depth = min_max[i * 2 + 1]; }
+	}
+
+	DepthRange range;
+
+	range.valid = min_depth <= max_depth;
+	range.min_depth = range.valid ? linearize_depth(min_depth, near_plane, far_plane) : near_plane;
+	range.max_depth = range.valid ? linearize_depth(max_depth, near_plane, far_plane) : far_plane;
+
+	return range;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void build_depth_histogram(const float* depth, uint32_t count, uint32_t stride, float near_plane, float far_plane, const DepthRange& range, uint32_t* bins)
+{
+	memset(bins, 0, sizeof(uint32_t) * DEPTH_HISTOGRAM_BINS);
+
+	if (!range.valid)
+		return;
+
+	float extent = range.max_depth - range.min_depth;
+	float scale = extent > 0.0f ? DEPTH_HISTOGRAM_BINS / extent : 0.0f;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		float d = depth[i * stride];
+
+		if (d >= 1.0f || d <= 0.0f)
+			continue;
+
+		int bin = int((linearize_depth(d, near_plane, far_plane) - range.min_depth) * scale);
+
+		if (bin < 0)
+			bin = 0;
+		else if (bin >= DEPTH_HISTOGRAM_BINS)
+			bin = DEPTH_HISTOGRAM_BINS - 1;
+
+		bins[bin]++;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#define DEPTH_HISTOGRAM_BINS 64
+
+// Visible depth range of the scene as linear view-space distances.
+struct DepthRange
+{
+	float min_depth;
+	float max_depth;
+	bool  valid;
+};
+
+// CPU side of the Sample Distribution Shadow Maps depth reduction. Operates on plain arrays so that it can be exercised without a GPU;
+// the GPU path (SDSMReduction) finishes its reduction with the same functions.
+
+// Converts a [0, 1] window-space depth of a perspective projection into a linear view-space distance.
+float linearize_depth(float depth, float near_plane, float far_plane);
+
+// Reduces window-space depths to a linear range. Samples at the far plane (1.0) are background and ignored.
+DepthRange reduce_depth(const float* depth, uint32_t count, float near_plane, float far_plane);
+
+// Reduces interleaved (min, max) window-space depth pairs, as produced by the GPU reduction, to a linear range.
+DepthRange reduce_depth_min_max(const float* min_max, uint32_t count, float near_plane, float far_plane);
+
+// Builds a histogram of linear depths over [range.min_depth, range.max_depth]. Background samples (1.0) and empty reduction texels
+// (0.0) are ignored. Reference of the GPU histogram pass of SDSMReduction, which bins every pixel the same way.
+void build_depth_histogram(const float* depth, uint32_t count, uint32_t stride, float near_plane, float far_plane, const DepthRange& range, uint32_t* bins);
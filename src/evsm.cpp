@@ -0,0 +1,222 @@
+#include "evsm.h"
+#include <macros.h>
+#include <algorithm>
+
+#ifndef GL_TEXTURE_MAX_ANISOTROPY
+#define GL_TEXTURE_MAX_ANISOTROPY 0x84FE
+#endif
+
+#ifndef GL_MAX_TEXTURE_MAX_ANISOTROPY
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY 0x84FF
+#endif
+
+// Full-screen triangle generated from gl_VertexID.
+const char* g_evsm_vs_src = R"(
+
+void main()
+{
+    vec2 uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+)";
+
+// One direction of the separable Gaussian. The horizontal pass reads the rect of the cascade in the depth atlas and converts every tap
+// to moments, the vertical pass reads the intermediate moments. Cascades smaller than the moment layers are upsampled.
+const char* g_evsm_blur_fs_src = R"(
+
+out vec4 PS_OUT_Moments;
+
+uniform sampler2D s_Depth; //#slot 0
+uniform sampler2D s_Moments; //#slot 1
+uniform vec3 u_Rect; // xy: atlas texel offset, z: size
+uniform int u_Size;
+uniform int u_Radius;
+uniform int u_FromDepth;
+uniform int u_Filter;
+uniform vec2 u_Direction;
+uniform vec2 u_Exponents;
+
+vec4 moments(float depth)
+{
+    if (u_Filter == 1)
+        return vec4(depth, depth * depth, 0.0, 0.0);
+
+    float d = depth * 2.0 - 1.0;
+    float pos = exp(u_Exponents.x * d);
+    float neg = -exp(-u_Exponents.y * d);
+
+    return vec4(pos, pos * pos, neg, neg * neg);
+}
+
+vec4 fetch(ivec2 coord, ivec2 size)
+{
+    coord = clamp(coord, ivec2(0), size - 1);
+
+    if (u_FromDepth == 1)
+        return moments(texelFetch(s_Depth, ivec2(u_Rect.xy) + coord * int(u_Rect.z) / size, 0).r);
+    else
+        return texelFetch(s_Moments, coord, 0);
+}
+
+void main()
+{
+    ivec2 size = ivec2(u_Size);
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    ivec2 dir = ivec2(u_Direction);
+
+    float sigma = max(float(u_Radius) * 0.5, 0.5);
+    vec4 sum = fetch(coord, size);
+    float weight_sum = 1.0;
+
+    for (int i = 1; i <= u_Radius; i++)
+    {
+        float w = exp(-float(i * i) / (2.0 * sigma * sigma));
+        sum += (fetch(coord + dir * i, size) + fetch(coord - dir * i, size)) * w;
+        weight_sum += 2.0 * w;
+    }
+
+    PS_OUT_Moments = sum / weight_sum;
+}
+
+)";
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+EVSM::EVSM()
+{
+
+}
+
+EVSM::~EVSM()
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool EVSM::initialize(ProgramCache& cache, RenderTargetPool& pool, int shadow_map_size, int cascade_count, int filter)
+{
+	shutdown();
+
+	m_pool = &pool;
+	m_size = shadow_map_size;
+	m_cascade_count = cascade_count;
+	m_filter = filter;
+
+	if (filter == SHADOW_FILTER_PCF)
+		return true;
+
+	if (!m_program)
+	{
+		m_program = cache.create("evsm_blur", { { GL_VERTEX_SHADER, g_evsm_vs_src }, { GL_FRAGMENT_SHADER, g_evsm_blur_fs_src } });
+
+		if (!m_program)
+		{
+			DW_LOG_FATAL("Failed to create EVSM Shader Program");
+			return false;
+		}
+	}
+
+	int mip_levels = 1;
+
+	while ((shadow_map_size >> mip_levels) > 0)
+		mip_levels++;
+
+	GLenum internal_format = filter == SHADOW_FILTER_VSM ? GL_RG32F : GL_RGBA16F;
+	GLenum format = filter == SHADOW_FILTER_VSM ? GL_RG : GL_RGBA;
+
+	m_moments = pool.acquire({ shadow_map_size, shadow_map_size, cascade_count, mip_levels, internal_format, format, GL_FLOAT }, "moments");
+	m_moments->texture()->set_min_filter(GL_LINEAR_MIPMAP_LINEAR);
+	m_moments->texture()->set_mag_filter(GL_LINEAR);
+	m_moments->texture()->set_wrapping(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+
+	float max_anisotropy = 1.0f;
+	glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &max_anisotropy);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_moments->texture()->id());
+	glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY, std::min(max_anisotropy, 16.0f));
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// Single layer intermediate target of the horizontal pass.
+	m_temp = pool.acquire({ shadow_map_size, shadow_map_size, 1, 1, internal_format, format, GL_FLOAT }, "moments blur");
+	m_temp->texture()->set_min_filter(GL_NEAREST);
+	m_temp->texture()->set_mag_filter(GL_NEAREST);
+
+	glGenVertexArrays(1, &m_vao);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void EVSM::shutdown()
+{
+	if (m_vao)
+	{
+		glDeleteVertexArrays(1, &m_vao);
+		m_vao = 0;
+	}
+
+	if (m_pool)
+	{
+		m_pool->release(m_temp);
+		m_pool->release(m_moments);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void EVSM::resolve(dw::Texture2D* shadow_maps, const ShadowAtlasRect* rects, uint32_t cascade_mask)
+{
+	if (m_filter == SHADOW_FILTER_PCF || cascade_mask == 0)
+		return;
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glViewport(0, 0, m_size, m_size);
+
+	m_program->use();
+	m_program->set_uniform("s_Depth", 0);
+	m_program->set_uniform("s_Moments", 1);
+	m_program->set_uniform("u_Size", m_size);
+	m_program->set_uniform("u_Radius", std::min(m_blur_radius, EVSM_MAX_BLUR_RADIUS));
+	m_program->set_uniform("u_Filter", m_filter);
+	m_program->set_uniform("u_Exponents", glm::vec2(m_positive_exponent, m_negative_exponent));
+
+	glBindVertexArray(m_vao);
+
+	for (int i = 0; i < m_cascade_count; i++)
+	{
+		if ((cascade_mask & (1 << i)) == 0)
+			continue;
+
+		// Horizontal: depth cascade -> moments -> intermediate.
+		glBindFramebuffer(GL_FRAMEBUFFER, m_temp->framebuffer());
+		shadow_maps->bind(0);
+
+		m_program->set_uniform("u_Rect", glm::vec3(float(rects[i].x), float(rects[i].y), float(rects[i].size)));
+		m_program->set_uniform("u_FromDepth", 1);
+		m_program->set_uniform("u_Direction", glm::vec2(1.0f, 0.0f));
+
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		// Vertical: intermediate -> moment cascade.
+		glBindFramebuffer(GL_FRAMEBUFFER, m_moments->framebuffer(i));
+		m_temp->texture()->bind(1);
+
+		m_program->set_uniform("u_FromDepth", 0);
+		m_program->set_uniform("u_Direction", glm::vec2(0.0f, 1.0f));
+
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		m_temp->texture()->unbind(1);
+	}
+
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	m_moments->texture()->generate_mipmaps();
+
+	glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "shadow_atlas.h"
+#include "program_cache.h"
+#include "render_target_pool.h"
+#include <ogl.h>
+#include <memory>
+
+#define EVSM_MAX_BLUR_RADIUS 8
+
+// Shadow map filtering mode. Matches the value of CSMUniforms::options.w read by the receiver shader.
+enum ShadowFilter
+{
+	SHADOW_FILTER_PCF = 0,
+	SHADOW_FILTER_VSM,
+	SHADOW_FILTER_EVSM
+};
+
+// Converts the cascades of the depth atlas into a filterable moment array for variance (RG32F, depth and depth squared) or
+// exponential variance (RGBA16F, positive and negative warped moments) shadow maps. Each cascade is blurred with a separable Gaussian,
+// the first pass converting depth to moments while reading, and the result is mipmapped so receivers need a single trilinear,
+// anisotropic fetch.
+struct EVSM
+{
+	int m_size = 0;
+	int m_cascade_count = 0;
+	int m_filter = SHADOW_FILTER_PCF;
+	int m_blur_radius = 2;
+	float m_positive_exponent = 5.54f; // Largest exponent whose squared moment still fits a 16-bit float.
+	float m_negative_exponent = 5.54f;
+	float m_light_bleeding_reduction = 0.2f;
+	RenderTargetPool* m_pool = nullptr;
+	RenderTarget* m_moments = nullptr; // One layer per cascade, rendered through the framebuffer of each layer.
+	RenderTarget* m_temp = nullptr;
+	std::unique_ptr<CachedProgram> m_program;
+	GLuint m_vao = 0;
+
+	EVSM();
+	~EVSM();
+	bool initialize(ProgramCache& cache, RenderTargetPool& pool, int shadow_map_size, int cascade_count, int filter);
+	void shutdown();
+	void resolve(dw::Texture2D* shadow_maps, const ShadowAtlasRect* rects, uint32_t cascade_mask);
+
+	inline dw::Texture2D* moments() { return m_moments ? m_moments->texture() : nullptr; }
+	inline glm::vec4 filter_params() { return glm::vec4(m_light_bleeding_reduction, m_positive_exponent, m_negative_exponent, 0.00001f); }
+};
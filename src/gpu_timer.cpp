@@ -0,0 +1,69 @@
+#include "gpu_timer.h"
+#include <string.h>
+
+GPUTimer::GPUTimer()
+{
+	memset(m_queries, 0, sizeof(m_queries));
+}
+
+GPUTimer::~GPUTimer()
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void GPUTimer::initialize()
+{
+	shutdown();
+
+	glGenQueries(GPU_TIMER_LATENCY * 2, &m_queries[0][0]);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void GPUTimer::shutdown()
+{
+	if (m_queries[0][0])
+	{
+		glDeleteQueries(GPU_TIMER_LATENCY * 2, &m_queries[0][0]);
+		memset(m_queries, 0, sizeof(m_queries));
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void GPUTimer::begin(int slot)
+{
+	glQueryCounter(m_queries[slot][0], GL_TIMESTAMP);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void GPUTimer::end(int slot)
+{
+	glQueryCounter(m_queries[slot][1], GL_TIMESTAMP);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool GPUTimer::available(int slot)
+{
+	// The end timestamp is issued last, the begin one is done by then.
+	GLint available = 0;
+	glGetQueryObjectiv(m_queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+
+	return available != 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+double GPUTimer::elapsed_ms(int slot)
+{
+	GLuint64 begin = 0;
+	GLuint64 end = 0;
+	glGetQueryObjectui64v(m_queries[slot][0], GL_QUERY_RESULT, &begin);
+	glGetQueryObjectui64v(m_queries[slot][1], GL_QUERY_RESULT, &end);
+
+	return double(end - begin) / 1000000.0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <ogl.h>
+
+#define GPU_TIMER_LATENCY 4 // Frames in flight before the timestamps of a frame are read back.
+
+// Pairs of GL_TIMESTAMP queries spread over a ring of GPU_TIMER_LATENCY slots, one per frame in flight. Results are read once the GPU
+// has passed them, so measuring never stalls the pipeline. Timestamps nest, unlike GL_TIME_ELAPSED queries, so timers may overlap.
+struct GPUTimer
+{
+	GLuint m_queries[GPU_TIMER_LATENCY][2];
+
+	GPUTimer();
+	~GPUTimer();
+	void initialize();
+	void shutdown();
+	void begin(int slot);
+	void end(int slot);
+	bool available(int slot);
+	double elapsed_ms(int slot); // Only valid once available() returned true for the slot.
+};
@@ -0,0 +1,341 @@
+#include "indirect_draw.h"
+#include <material.h>
+#include <macros.h>
+#include <algorithm>
+#include <stddef.h>
+#include <string.h>
+
+IndirectMesh::IndirectMesh()
+{
+	m_model = glm::mat4(1.0f);
+}
+
+IndirectMesh::~IndirectMesh()
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool IndirectMesh::initialize(dw::Mesh* mesh)
+{
+	shutdown();
+
+	m_mesh = mesh;
+
+	uint32_t count = mesh->sub_mesh_count();
+
+	m_commands.resize(count);
+	m_draw_data.resize(count);
+	m_materials.clear();
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		dw::SubMesh& submesh = mesh->sub_meshes()[i];
+
+		DrawElementsIndirectCommand& cmd = m_commands[i];
+		cmd.count = submesh.index_count;
+		cmd.instance_count = 1;
+		cmd.first_index = submesh.base_index;
+		cmd.base_vertex = submesh.base_vertex;
+		cmd.base_instance = i;
+
+		// Materials are numbered in order of first use.
+		uint32_t material = 0;
+
+		if (submesh.mat)
+		{
+			auto it = std::find(m_materials.begin(), m_materials.end(), submesh.mat);
+			material = uint32_t(it - m_materials.begin());
+
+			if (it == m_materials.end())
+				m_materials.push_back(submesh.mat);
+		}
+
+		m_draw_data[i].model = m_model;
+		m_draw_data[i].material = material;
+		m_draw_data[i].cascade_mask = ~0u;
+	}
+
+	return create_buffers();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool IndirectMesh::initialize(GLuint vao, const DrawElementsIndirectCommand* commands, uint32_t count)
+{
+	shutdown();
+
+	m_vao = vao;
+	m_commands.assign(commands, commands + count);
+	m_draw_data.resize(count);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		m_commands[i].base_instance = i;
+
+		m_draw_data[i].model = m_model;
+		m_draw_data[i].material = 0;
+		m_draw_data[i].cascade_mask = ~0u;
+	}
+
+	return create_buffers();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool IndirectMesh::create_buffers()
+{
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	m_indirect_supported = major > 4 || (major == 4 && minor >= 3);
+	m_base_instance_supported = major > 4 || (major == 4 && minor >= 2);
+
+	uint32_t count = (uint32_t)m_commands.size();
+
+	if (m_indirect_supported)
+	{
+		glGenBuffers(1, &m_command_buffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_command_buffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, m_commands.size() * sizeof(DrawElementsIndirectCommand), m_commands.data(), GL_STATIC_DRAW);
+
+		// Commands of the draws that survive caster culling, rewritten every pass.
+		glGenBuffers(1, &m_culled_command_buffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_culled_command_buffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, m_commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		m_culled_commands.reserve(count);
+	}
+
+	glGenBuffers(1, &m_draw_data_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_draw_data_buffer);
+	glBufferData(GL_ARRAY_BUFFER, m_draw_data.size() * sizeof(DrawData), m_draw_data.data(), GL_DYNAMIC_DRAW);
+
+	// Attach the per-draw data to the vertex array of the mesh, advancing once per instance.
+	bind();
+
+	for (int i = 0; i < 4; i++)
+	{
+		glEnableVertexAttribArray(DRAW_DATA_ATTRIBUTE_LOCATION + i);
+		glVertexAttribPointer(DRAW_DATA_ATTRIBUTE_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(DrawData), (void*)(sizeof(glm::vec4) * i));
+		glVertexAttribDivisor(DRAW_DATA_ATTRIBUTE_LOCATION + i, 1);
+	}
+
+	glEnableVertexAttribArray(DRAW_DATA_ATTRIBUTE_LOCATION + 4);
+	glVertexAttribIPointer(DRAW_DATA_ATTRIBUTE_LOCATION + 4, 1, GL_UNSIGNED_INT, sizeof(DrawData), (void*)offsetof(DrawData, material));
+	glVertexAttribDivisor(DRAW_DATA_ATTRIBUTE_LOCATION + 4, 1);
+
+	glEnableVertexAttribArray(DRAW_DATA_ATTRIBUTE_LOCATION + 5);
+	glVertexAttribIPointer(DRAW_DATA_ATTRIBUTE_LOCATION + 5, 1, GL_UNSIGNED_INT, sizeof(DrawData), (void*)offsetof(DrawData, cascade_mask));
+	glVertexAttribDivisor(DRAW_DATA_ATTRIBUTE_LOCATION + 5, 1);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	m_draw_data_dirty = false;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void IndirectMesh::shutdown()
+{
+	if (m_command_buffer)
+	{
+		glDeleteBuffers(1, &m_command_buffer);
+		m_command_buffer = 0;
+	}
+
+	if (m_draw_data_buffer)
+	{
+		glDeleteBuffers(1, &m_draw_data_buffer);
+		m_draw_data_buffer = 0;
+	}
+
+	if (m_culled_command_buffer)
+	{
+		glDeleteBuffers(1, &m_culled_command_buffer);
+		m_culled_command_buffer = 0;
+	}
+
+	m_commands.clear();
+	m_culled_commands.clear();
+	m_draw_data.clear();
+	m_materials.clear();
+	m_mesh = nullptr;
+	m_vao = 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void IndirectMesh::set_model(const glm::mat4& model)
+{
+	if (memcmp(&model, &m_model, sizeof(glm::mat4)) == 0 && !m_draw_data_dirty)
+		return;
+
+	m_model = model;
+
+	for (auto& data : m_draw_data)
+		data.model = model;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_draw_data_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, m_draw_data.size() * sizeof(DrawData), m_draw_data.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	m_draw_data_dirty = false;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void IndirectMesh::set_cascade_masks(const uint32_t* masks)
+{
+	bool changed = false;
+
+	for (uint32_t i = 0; i < m_draw_data.size(); i++)
+	{
+		uint32_t mask = masks ? masks[i] : ~0u;
+
+		if (m_draw_data[i].cascade_mask != mask)
+		{
+			m_draw_data[i].cascade_mask = mask;
+			changed = true;
+		}
+	}
+
+	if (!changed)
+		return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_draw_data_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, m_draw_data.size() * sizeof(DrawData), m_draw_data.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void IndirectMesh::bind()
+{
+	if (m_mesh)
+		m_mesh->mesh_vertex_array()->bind();
+	else
+		glBindVertexArray(m_vao);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint32_t IndirectMesh::draw_indirect()
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_command_buffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, (GLsizei)m_commands.size(), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	return 1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint32_t IndirectMesh::draw_direct(bool use_textures)
+{
+	enable_draw_data(false);
+
+	for (uint32_t i = 0; i < m_commands.size(); i++)
+	{
+		// Bind texture.
+		if (use_textures)
+			m_mesh->sub_meshes()[i].mat->texture(0)->bind(0);
+
+		draw_elements(i);
+	}
+
+	enable_draw_data(true);
+
+	return (uint32_t)m_commands.size();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint32_t IndirectMesh::draw_indirect(const uint32_t* draws, uint32_t count)
+{
+	if (count == 0)
+		return 0;
+
+	m_culled_commands.resize(count);
+
+	for (uint32_t i = 0; i < count; i++)
+		m_culled_commands[i] = m_commands[draws[i]];
+
+	// Orphan the previous contents so that the upload does not wait on the last pass.
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_culled_command_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, m_commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, count * sizeof(DrawElementsIndirectCommand), m_culled_commands.data());
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, (GLsizei)count, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	return 1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint32_t IndirectMesh::draw_direct(const uint32_t* draws, uint32_t count, bool use_textures)
+{
+	enable_draw_data(false);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (use_textures)
+			m_mesh->sub_meshes()[draws[i]].mat->texture(0)->bind(0);
+
+		draw_elements(draws[i]);
+	}
+
+	enable_draw_data(true);
+
+	return count;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void IndirectMesh::draw_elements(uint32_t draw)
+{
+	const DrawElementsIndirectCommand& cmd = m_commands[draw];
+	void* indices = (void*)(sizeof(unsigned int) * cmd.first_index);
+
+	// The base instance selects the per-draw data just like in the indirect path.
+	if (m_base_instance_supported)
+	{
+		glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT, indices, 1, cmd.base_vertex, cmd.base_instance);
+		return;
+	}
+
+	// Without ARB_base_instance every draw would read the first entry, set the data of the draw as the current attribute values.
+	const DrawData& data = m_draw_data[draw];
+
+	for (int i = 0; i < 4; i++)
+		glVertexAttrib4fv(DRAW_DATA_ATTRIBUTE_LOCATION + i, &data.model[i][0]);
+
+	glVertexAttribI1ui(DRAW_DATA_ATTRIBUTE_LOCATION + 4, data.material);
+	glVertexAttribI1ui(DRAW_DATA_ATTRIBUTE_LOCATION + 5, data.cascade_mask);
+
+	glDrawElementsBaseVertex(GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT, indices, cmd.base_vertex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void IndirectMesh::enable_draw_data(bool enabled)
+{
+	// Toggles the per-draw attribute arrays of the bound vertex array. Disabled arrays read the current attribute values instead.
+	if (m_base_instance_supported)
+		return;
+
+	for (int i = 0; i < 6; i++)
+	{
+		if (enabled)
+			glEnableVertexAttribArray(DRAW_DATA_ATTRIBUTE_LOCATION + i);
+		else
+			glDisableVertexAttribArray(DRAW_DATA_ATTRIBUTE_LOCATION + i);
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <mesh.h>
+#include <ogl.h>
+#include <vector>
+
+// First vertex attribute location used by the per-draw data. The model matrix takes four locations, the material index and the
+// cascade mask one each.
+#define DRAW_DATA_ATTRIBUTE_LOCATION 5
+
+// Layout defined by GL for glMultiDrawElementsIndirect.
+struct DrawElementsIndirectCommand
+{
+	uint32_t count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t  base_vertex;
+	uint32_t base_instance;
+};
+
+// Per-draw data. Bound as instanced vertex attributes with a divisor of 1, so that the base instance of each command acts as the draw
+// ID and selects the entry of its submesh.
+struct DrawData
+{
+	glm::mat4 model;
+	uint32_t  material;
+	uint32_t  cascade_mask; // Cascades the draw is visible in, used by the layered shadow pass to skip geometry shader invocations.
+	uint32_t  padding[2];
+};
+
+// Draw commands and per-draw data of every submesh of a mesh, built once at load. A whole pass is then submitted with a single
+// glMultiDrawElementsIndirect regardless of the submesh count. The per-submesh path is kept for contexts older than GL 4.3 and for
+// passes that need to bind a texture per submesh. It selects the per-draw data with the base instance on GL 4.2, and below sets it as
+// the current value of the attributes before every draw. May also draw from a bare vertex array, e.g. the shadow proxies, in which
+// case textures are not available.
+struct IndirectMesh
+{
+	dw::Mesh* m_mesh = nullptr;
+	GLuint m_vao = 0; // Vertex array drawn when there is no mesh, not owned.
+	GLuint m_command_buffer = 0;
+	GLuint m_draw_data_buffer = 0;
+	GLuint m_culled_command_buffer = 0;
+	std::vector<DrawElementsIndirectCommand> m_commands;
+	std::vector<DrawElementsIndirectCommand> m_culled_commands;
+	std::vector<DrawData> m_draw_data;
+	std::vector<dw::Material*> m_materials;
+	glm::mat4 m_model;
+	bool m_draw_data_dirty = true;
+	bool m_indirect_supported = false;
+	bool m_base_instance_supported = false;
+
+	IndirectMesh();
+	~IndirectMesh();
+	bool initialize(dw::Mesh* mesh);
+	bool initialize(GLuint vao, const DrawElementsIndirectCommand* commands, uint32_t count);
+	bool create_buffers();
+	void shutdown();
+	void set_model(const glm::mat4& model);
+	void set_cascade_masks(const uint32_t* masks); // nullptr marks every draw visible in all cascades.
+	void bind();
+	uint32_t draw_indirect();
+	uint32_t draw_indirect(const uint32_t* draws, uint32_t count);
+	uint32_t draw_direct(bool use_textures);
+	uint32_t draw_direct(const uint32_t* draws, uint32_t count, bool use_textures);
+	void draw_elements(uint32_t draw);
+	void enable_draw_data(bool enabled);
+
+	inline uint32_t draw_count() { return (uint32_t)m_commands.size(); }
+};
@@ -0,0 +1,255 @@
+#include "job_system.h"
+#include <algorithm>
+
+// Queue owned by the calling thread. The thread that initializes the pool is 0, workers are 1 to N.
+static thread_local int g_thread_index = 0;
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobQueue::push(Job&& job)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_jobs.push_back(std::move(job));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool JobQueue::pop(Job& job)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_jobs.empty())
+		return false;
+
+	job = std::move(m_jobs.back());
+	m_jobs.pop_back();
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool JobQueue::steal(Job& job)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_jobs.empty())
+		return false;
+
+	job = std::move(m_jobs.front());
+	m_jobs.pop_front();
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+JobSystem::JobSystem() : m_queued(0)
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+JobSystem::~JobSystem()
+{
+	shutdown();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobSystem::initialize(int threads)
+{
+	shutdown();
+
+	// Leave one core to the driver thread.
+	if (threads <= 0)
+		threads = std::max(2, (int)std::thread::hardware_concurrency() - 1);
+
+	m_quit = false;
+
+	for (int i = 0; i < threads; i++)
+		m_queues.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+
+	g_thread_index = 0;
+
+	for (int i = 1; i < threads; i++)
+		m_threads.push_back(std::thread(&JobSystem::worker, this, i));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		m_quit = true;
+	}
+
+	m_sleep_cv.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+
+	m_threads.clear();
+	m_queues.clear();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobSystem::run(JobFunction function, JobCounter* counter)
+{
+	if (counter)
+		counter->fetch_add(1, std::memory_order_relaxed);
+
+	// Without workers the job runs inline.
+	if (m_queues.empty())
+	{
+		function();
+
+		if (counter)
+			counter->fetch_sub(1, std::memory_order_release);
+
+		return;
+	}
+
+	m_queues[thread_index()]->push({ std::move(function), counter });
+	m_queued.fetch_add(1, std::memory_order_release);
+
+	// Taking the lock orders the increment with a worker about to go to sleep, so the wake up cannot be missed.
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+	}
+
+	m_sleep_cv.notify_one();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobSystem::wait(JobCounter* counter)
+{
+	int thread = thread_index();
+
+	while (counter->load(std::memory_order_acquire) != 0)
+	{
+		if (!execute(thread))
+			std::this_thread::yield();
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool JobSystem::execute(int thread)
+{
+	if (m_queues.empty())
+		return false;
+
+	Job job;
+
+	// Own queue first, then steal starting from the next thread so that thieves spread over the queues.
+	bool found = m_queues[thread]->pop(job);
+
+	for (int i = 1; i < thread_count() && !found; i++)
+		found = m_queues[(thread + i) % thread_count()]->steal(job);
+
+	if (!found)
+		return false;
+
+	m_queued.fetch_sub(1, std::memory_order_relaxed);
+
+	job.function();
+
+	if (job.counter)
+		job.counter->fetch_sub(1, std::memory_order_release);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobSystem::worker(int thread)
+{
+	g_thread_index = thread;
+
+	while (true)
+	{
+		if (execute(thread))
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleep_mutex);
+		m_sleep_cv.wait(lock, [this]() { return m_quit || m_queued.load(std::memory_order_acquire) > 0; });
+
+		if (m_quit)
+			return;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int JobSystem::thread_index()
+{
+	return g_thread_index;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+JobGraph::JobGraph() : m_counter(0)
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint32_t JobGraph::add(const char* name, JobFunction function)
+{
+	m_nodes.push_back({ name, std::move(function), {}, 0 });
+	m_remaining.reset(new std::atomic<int>[m_nodes.size()]);
+
+	return (uint32_t)m_nodes.size() - 1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobGraph::depend(uint32_t node, uint32_t dependency)
+{
+	m_nodes[dependency].dependents.push_back(node);
+	m_nodes[node].dependency_count++;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobGraph::execute(JobSystem& jobs)
+{
+	for (uint32_t i = 0; i < m_nodes.size(); i++)
+		m_remaining[i].store(m_nodes[i].dependency_count, std::memory_order_relaxed);
+
+	for (uint32_t i = 0; i < m_nodes.size(); i++)
+	{
+		if (m_nodes[i].dependency_count == 0)
+			schedule(jobs, i);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobGraph::schedule(JobSystem& jobs, uint32_t node)
+{
+	jobs.run([this, &jobs, node]()
+	{
+		m_nodes[node].function();
+
+		// Dependents are counted into the graph before this job completes, so the graph never appears idle in between.
+		for (uint32_t dependent : m_nodes[node].dependents)
+		{
+			if (m_remaining[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+				schedule(jobs, dependent);
+		}
+	}, &m_counter);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void JobGraph::wait(JobSystem& jobs)
+{
+	jobs.wait(&m_counter);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+typedef std::function<void()> JobFunction;
+
+// Number of jobs of a batch still in flight. A batch is complete once it drops back to zero.
+typedef std::atomic<int> JobCounter;
+
+struct Job
+{
+	JobFunction function;
+	JobCounter* counter;
+};
+
+// Jobs pushed by one thread. The owner pops from the back to keep its working set warm, other threads steal from the front.
+struct JobQueue
+{
+	std::mutex m_mutex;
+	std::deque<Job> m_jobs;
+
+	void push(Job&& job);
+	bool pop(Job& job);
+	bool steal(Job& job);
+};
+
+// Work-stealing thread pool. Every thread, including the one that created the pool (queue 0), owns a queue; idle workers steal from
+// the others before going to sleep. Threads waiting on a counter keep executing jobs instead of blocking.
+struct JobSystem
+{
+	std::vector<std::thread> m_threads;
+	std::vector<std::unique_ptr<JobQueue>> m_queues;
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_sleep_cv;
+	std::atomic<int> m_queued;
+	bool m_quit = false;
+
+	JobSystem();
+	~JobSystem();
+	void initialize(int threads = 0);
+	void shutdown();
+	void run(JobFunction function, JobCounter* counter);
+	void wait(JobCounter* counter);
+	bool execute(int thread);
+	void worker(int thread);
+	int thread_index();
+
+	inline int thread_count() { return (int)m_queues.size(); }
+};
+
+// Nodes of a job graph. A node is scheduled once all the nodes it depends on have completed.
+struct JobGraphNode
+{
+	const char* name;
+	JobFunction function;
+	std::vector<uint32_t> dependents;
+	int dependency_count;
+};
+
+// Static graph of the jobs of a frame, built once and executed every frame. Nodes without dependencies are scheduled immediately,
+// completing a node schedules its dependents from the worker that ran it, without going through the submitting thread.
+struct JobGraph
+{
+	std::vector<JobGraphNode> m_nodes;
+	std::unique_ptr<std::atomic<int>[]> m_remaining;
+	JobCounter m_counter;
+
+	JobGraph();
+	uint32_t add(const char* name, JobFunction function);
+	void depend(uint32_t node, uint32_t dependency);
+	void execute(JobSystem& jobs);
+	void schedule(JobSystem& jobs, uint32_t node);
+	void wait(JobSystem& jobs);
+
+	inline bool busy() { return m_counter.load(std::memory_order_acquire) != 0; }
+};
+
+// Two frame packets: the submitting thread reads the last completed one while the jobs of the next frame write the other. The slot
+// being written is handed over through an atomic index, so neither side takes a lock.
+template <typename T>
+struct FramePipeline
+{
+	T m_packets[2];
+	std::atomic<int> m_ready; // Slot of the latest completed packet not yet acquired, -1 if none.
+	int m_read = -1;         // Slot being read by the submitting thread.
+
+	FramePipeline() : m_ready(-1) {}
+
+	// Slot the next packet has to be written to. Never the one being read.
+	inline int write_slot() { return m_read == 0 ? 1 : 0; }
+	inline T& write_packet() { return m_packets[write_slot()]; }
+
+	// Called by the producer once every job writing the packet completed.
+	inline void publish(int slot) { m_ready.store(slot, std::memory_order_release); }
+
+	// Latest completed packet, or the previous one if nothing new was published. nullptr until the first packet is published.
+	inline T* acquire()
+	{
+		int ready = m_ready.exchange(-1, std::memory_order_acq_rel);
+
+		if (ready >= 0)
+			m_read = ready;
+
+		return m_read >= 0 ? &m_packets[m_read] : nullptr;
+	}
+
+	// Drops the packets built so far, e.g. after the resources they refer to were recreated.
+	inline void invalidate()
+	{
+		m_ready.store(-1, std::memory_order_release);
+		m_read = -1;
+	}
+};
@@ -3,7 +3,25 @@
 #include <camera.h>
 #include <material.h>
 #include <memory>
+#include <string.h>
+#include <chrono>
 #include "csm.h"
+#include "csm_batch.h"
+#include "software_rasterizer.h"
+#include "sdsm.h"
+#include "uniform_ring.h"
+#include "indirect_draw.h"
+#include "caster_bvh.h"
+#include "job_system.h"
+#include "evsm.h"
+#include "profiler.h"
+#include "camera_track.h"
+#include "mesh_cache.h"
+#include "program_cache.h"
+#include "shadow_proxy.h"
+#include "shadow_lights.h"
+#include "render_target_pool.h"
+#include "texel_density.h"
 
 // Embedded vertex shader source.
 const char* g_sample_vs_src = R"(
@@ -21,28 +39,32 @@ layout (std140) uniform GlobalUniforms //#binding 0
     mat4 crop;
 };
 
-layout (std140) uniform ObjectUniforms //#binding 1
-{
-    mat4 model;
-};
+// Per-draw data, selected by the base instance of each draw.
+layout (location = 5) in mat4 VS_IN_Model;
 
 out vec3 PS_IN_WorldFragPos;
 out vec4 PS_IN_NDCFragPos;
 out vec3 PS_IN_Normal;
 out vec2 PS_IN_TexCoord;
 
+// Must match the depth pre-pass bit for bit for the GL_EQUAL depth test.
+invariant gl_Position;
+
 void main()
 {
-    vec4 position = model * vec4(VS_IN_Position, 1.0);
+    vec4 position = VS_IN_Model * vec4(VS_IN_Position, 1.0);
 	PS_IN_WorldFragPos = position.xyz;
-	PS_IN_Normal = mat3(model) * VS_IN_Normal;
+	PS_IN_Normal = mat3(VS_IN_Model) * VS_IN_Normal;
 	PS_IN_TexCoord = VS_IN_TexCoord;
-    PS_IN_NDCFragPos = projection * view * position;
+
+    // Same expression as g_csm_vs_src, crop holding the view projection of the camera.
+    PS_IN_NDCFragPos = crop * VS_IN_Model * vec4(VS_IN_Position, 1.0);
     gl_Position = PS_IN_NDCFragPos;
 }
 
 )";
 
+// Position-only vertex shader of the shadow passes. Also draws the camera depth pre-pass, with crop set to the view projection.
 const char* g_csm_vs_src = R"(
 
 layout (location = 0) in vec3 VS_IN_Position;
@@ -58,109 +80,327 @@ layout (std140) uniform GlobalUniforms //#binding 0
     mat4 crop;
 };
 
-layout (std140) uniform ObjectUniforms //#binding 1
+// Per-draw data, selected by the base instance of each draw.
+layout (location = 5) in mat4 VS_IN_Model;
+
+invariant gl_Position;
+
+void main()
 {
-    mat4 model;
-};
+    gl_Position = crop * VS_IN_Model * vec4(VS_IN_Position, 1.0);
+}
+
+)";
+
+// Layered CSM vertex shader. Outputs world-space positions, the geometry shader applies the crop matrix of each cascade.
+const char* g_csm_layered_vs_src = R"(
+
+layout (location = 0) in vec3 VS_IN_Position;
+layout (location = 1) in vec2 VS_IN_TexCoord;
+layout (location = 2) in vec3 VS_IN_Normal;
+layout (location = 3) in vec3 VS_IN_Tangent;
+layout (location = 4) in vec3 VS_IN_Bitangent;
+
+// Per-draw data, selected by the base instance of each draw.
+layout (location = 5) in mat4 VS_IN_Model;
+layout (location = 10) in uint VS_IN_CascadeMask;
+
+flat out uint VS_OUT_CascadeMask;
 
 void main()
 {
-    gl_Position = crop * model * vec4(VS_IN_Position, 1.0);
+    VS_OUT_CascadeMask = VS_IN_CascadeMask;
+    gl_Position = VS_IN_Model * vec4(VS_IN_Position, 1.0);
 }
 
 )";
 
-// Embedded fragment shader source.
-const char* g_sample_fs_src = R"(
+// Layered CSM geometry shader. One invocation per cascade, each routing the triangle to the viewport of its rect in the shadow atlas.
+// Cascades of every shadowed light are indexed globally, so a single draw renders all the lights.
+const char* g_csm_layered_gs_src = R"(
 
-out vec4 PS_OUT_Color;
+layout (triangles, invocations = 16) in;
+layout (triangle_strip, max_vertices = 3) out;
 
-in vec3 PS_IN_WorldFragPos;
-in vec4 PS_IN_NDCFragPos;
-in vec3 PS_IN_Normal;
-in vec2 PS_IN_TexCoord;
+layout (std140) uniform ShadowUniforms //#binding 3
+{
+    mat4 crop_matrices[16];
+    int num_cascades;
+    int cascade_mask;
+};
+
+// Cascades the draw survived caster culling in.
+flat in uint VS_OUT_CascadeMask[];
+
+void main()
+{
+    if (gl_InvocationID >= num_cascades || ((uint(cascade_mask) & VS_OUT_CascadeMask[0]) & (1u << uint(gl_InvocationID))) == 0u)
+        return;
+
+    for (int i = 0; i < 3; i++)
+    {
+        gl_ViewportIndex = gl_InvocationID;
+        gl_Position = crop_matrices[gl_InvocationID] * gl_in[i].gl_Position;
+        EmitVertex();
+    }
+
+    EndPrimitive();
+}
+
+)";
+
+// Cascade selection and shadow filtering, shared by the forward shader and the screen-space shadow mask pass.
+const char* g_shadow_fs_src = R"(
+
+struct ShadowLight
+{
+    vec4 direction; // xyz: direction, w: cascade count
+    vec4 color; // rgb: color, w: first cascade
+    vec4 far_bounds[2];
+};
 
 layout (std140) uniform CSMUniforms //#binding 2
 {
     vec4 direction;
     vec4 options;
-    int num_cascades;
-    float far_bounds[8];
-    mat4 texture_matrices[8];
+    vec4 filter_params;
+    vec4 kernel_params;
+    vec4 mask_params;
+    int num_lights;
+    ShadowLight lights[3];
+    vec4 atlas_rects[16];
+    mat4 texture_matrices[16];
 };
 
-uniform sampler2D s_Diffuse; //#slot 0
-uniform sampler2DArray s_ShadowMap; //#slot 1
+uniform sampler2D s_ShadowMap; //#slot 1
+uniform sampler2DArray s_MomentMap; //#slot 2
+uniform sampler2DShadow s_ShadowMapCompare; //#slot 3
+
+float interleaved_gradient_noise(vec2 p)
+{
+    return fract(52.9829189 * fract(dot(p, vec2(0.06711056, 0.00583715))));
+}
+
+const vec2 poisson_disk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725), vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464), vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+    vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420), vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+    vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590), vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
+
+// Keeps a filter tap inside the rect of its cascade so that it never reads a neighbour in the atlas. Bilinear comparison and gathers
+// read the 2x2 footprint around the coordinate, and a gather weighs its four texels the same, so the clamp stays a full texel away
+// from the edges: at the center of the last texel the footprint already reaches into the neighbouring rect.
+vec2 atlas_clamp(vec2 coord, int index)
+{
+    vec2 texel = 1.0 / vec2(textureSize(s_ShadowMap, 0));
+    vec4 rect = atlas_rects[index];
+
+    return clamp(coord, rect.xy + texel, rect.xy + rect.zw - texel);
+}
+
+// Percentage of the kernel that is occluded. Kernel 0 is the manual 3x3 loop, the others use hardware depth comparison.
+float pcf_shadow(vec3 light_space_pos, int index, float ref)
+{
+    int kernel = int(kernel_params.x);
+
+    // 1 tap: bilinear PCF of the 2x2 footprint.
+    if (kernel == 1)
+        return 1.0 - texture(s_ShadowMapCompare, vec3(atlas_clamp(light_space_pos.xy, index), ref));
+
+    // 4 taps: one gather of the 2x2 footprint, unweighted.
+    if (kernel == 2)
+        return 1.0 - dot(textureGather(s_ShadowMapCompare, atlas_clamp(light_space_pos.xy, index), ref), vec4(0.25));
+
+    // 16 taps: Poisson disk rotated per pixel by interleaved gradient noise to trade banding for noise.
+    vec2 texel_size = 1.0 / vec2(textureSize(s_ShadowMapCompare, 0));
+    float angle = 6.2831853 * interleaved_gradient_noise(gl_FragCoord.xy);
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    float lit = 0.0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        vec2 offset = rotation * poisson_disk[i] * kernel_params.y * texel_size;
+        lit += texture(s_ShadowMapCompare, vec3(atlas_clamp(light_space_pos.xy + offset, index), ref));
+    }
+
+    return 1.0 - lit / 16.0;
+}
 
 float depth_compare(float a, float b, float bias)
 {
     return a - bias > b ? 1.0 : 0.0;
 }
 
-float shadow_occlussion(float frag_depth, vec3 n, vec3 l)
+float linstep(float a, float b, float v)
 {
-	int index = 0;
-    float blend = 0.0;
-    
-	// Find shadow cascade.
-	for (int i = 0; i < num_cascades - 1; i++)
-	{
-		if (frag_depth > far_bounds[i])
-			index = i + 1;
-	}
+    return clamp((v - a) / (b - a), 0.0, 1.0);
+}
+
+float chebyshev(vec2 moments, float depth, float min_variance)
+{
+    if (depth <= moments.x)
+        return 1.0;
+
+    float variance = max(moments.y - moments.x * moments.x, min_variance);
+    float d = depth - moments.x;
+    float p_max = variance / (variance + d * d);
+
+    // Cut off the tail of the upper bound to reduce light bleeding.
+    return linstep(filter_params.x, 1.0, p_max);
+}
+
+float moment_shadow(vec3 light_space_pos, int index, vec3 world_pos)
+{
+    // The moment layers are not packed, go back from the atlas rect to the [0, 1] coordinates of the cascade.
+    vec4 rect = atlas_rects[index];
+    vec2 coord = (light_space_pos.xy - rect.xy) / rect.zw;
+
+    // Neighbouring pixels may use different cascades, so derive the gradients from the world position instead of the coordinates.
+    vec2 ddx = (texture_matrices[index] * vec4(dFdx(world_pos), 0.0)).xy / rect.zw;
+    vec2 ddy = (texture_matrices[index] * vec4(dFdy(world_pos), 0.0)).xy / rect.zw;
+    vec4 moments = textureGrad(s_MomentMap, vec3(coord, float(index)), ddx, ddy);
+    float visibility;
+
+    if (options.w == 1.0)
+        visibility = chebyshev(moments.xy, light_space_pos.z, filter_params.w);
+    else
+    {
+        float d = light_space_pos.z * 2.0 - 1.0;
+        float pos = exp(filter_params.y * d);
+        float neg = -exp(-filter_params.z * d);
+
+        // Scale the minimum variance by the derivative of the warp.
+        float pos_variance = filter_params.w * filter_params.y * filter_params.y * pos * pos;
+        float neg_variance = filter_params.w * filter_params.z * filter_params.z * neg * neg;
+
+        visibility = min(chebyshev(moments.xy, pos, pos_variance), chebyshev(moments.zw, neg, neg_variance));
+    }
+
+    return 1.0 - visibility;
+}
+
+// Cascade of the light covering the fragment, counted from the first cascade of the light.
+int cascade_index(int light, float frag_depth)
+{
+    // Count the far bounds in front of the fragment. Unused bounds are set beyond the far plane so they never count.
+    vec4 depth = vec4(frag_depth);
+    float count = dot(step(lights[light].far_bounds[0], depth), vec4(1.0)) + dot(step(lights[light].far_bounds[1], depth), vec4(1.0));
+
+    return min(int(count), int(lights[light].direction.w) - 1);
+}
+
+float far_bound(int light, int index)
+{
+    return lights[light].far_bounds[index >> 2][index & 3];
+}
 
-	blend = clamp( (frag_depth - far_bounds[index] * 0.995) * 200.0, 0.0, 1.0);
+float shadow_occlussion(int light, float frag_depth, vec3 world_pos, vec3 n, vec3 l)
+{
+	int index = cascade_index(light, frag_depth);
+	float blend = clamp( (frag_depth - far_bound(light, index) * 0.995) * 200.0, 0.0, 1.0);
     
     // Apply blend options.
     blend *= options.z;
 
+    // Dithered transition: within the blend band a growing fraction of the pixels uses the next cascade, so every fragment still
+    // does a single shadow lookup. The noise is transposed to decorrelate it from the Poisson disk rotation.
+    index = min(index + int(interleaved_gradient_noise(gl_FragCoord.yx) < blend), int(lights[light].direction.w) - 1);
+
+    // Index into the atlas tables shared by every light.
+    index += int(lights[light].color.w);
+
 	// Transform frag position into Light-space.
-	vec4 light_space_pos = texture_matrices[index] * vec4(PS_IN_WorldFragPos, 1.0f);
+	vec4 light_space_pos = texture_matrices[index] * vec4(world_pos, 1.0f);
 
 	float current_depth = light_space_pos.z;
     
 	float bias = max(0.0005 * (1.0 - dot(n, l)), 0.0005);  
 
 	float shadow = 0.0;
-	vec2 texelSize = 1.0 / textureSize(s_ShadowMap, 0).xy;
-	for(int x = -1; x <= 1; ++x)
-	{
-	    for(int y = -1; y <= 1; ++y)
+
+    // Variance and exponential variance shadow maps: a single filtered fetch. Moments are only resolved for the primary light.
+    if (options.w > 0.0 && light == 0)
+        shadow = moment_shadow(light_space_pos.xyz, index, world_pos);
+    else if (kernel_params.x > 0.0)
+        shadow = pcf_shadow(light_space_pos.xyz, index, current_depth - bias);
+    else
+    {
+	    vec2 texelSize = 1.0 / vec2(textureSize(s_ShadowMap, 0));
+	    for(int x = -1; x <= 1; ++x)
 	    {
-	        float pcfDepth = texture(s_ShadowMap, vec3(light_space_pos.xy + vec2(x, y) * texelSize, float(index))).r; 
-	        shadow += current_depth - bias > pcfDepth ? 1.0 : 0.0;        
-	    }    
-	}
-	shadow /= 9.0;
+	        for(int y = -1; y <= 1; ++y)
+	        {
+	            float pcfDepth = texture(s_ShadowMap, atlas_clamp(light_space_pos.xy + vec2(x, y) * texelSize, index)).r; 
+	            shadow += current_depth - bias > pcfDepth ? 1.0 : 0.0;        
+	        }    
+	    }
+	    shadow /= 9.0;
+    }
 	
     if (options.x == 1.0)
-    {
-        //if (blend > 0.0 && index != num_cascades - 1)
-        //{
-        //    light_space_pos = texture_matrices[index + 1] * vec4(PS_IN_WorldFragPos, 1.0f);
-        //    shadow_map_depth = texture(s_ShadowMap, vec3(light_space_pos.xy, float(index + 1))).r;
-        //    current_depth = light_space_pos.z;
-        //    float next_shadow = depth_compare(current_depth, shadow_map_depth, bias);
-        //    
-        //    return (1.0 - blend) * shadow + blend * next_shadow;
-        //}
-        //else
-			return shadow;
-    }
+        return shadow;
     else
         return 0.0;
 }
 
-vec3 debug_color(float frag_depth)
+// Distance along the view direction of a window-space depth.
+float linear_depth(float depth)
 {
-	int index = 0;
+    float near_plane = mask_params.x;
+    float far_plane = mask_params.y;
 
-	// Find shadow cascade.
-	for (int i = 0; i < num_cascades - 1; i++)
-	{
-		if (frag_depth > far_bounds[i])
-			index = i + 1;
-	}
+    return near_plane * far_plane / (far_plane - depth * (far_plane - near_plane));
+}
+
+)";
+
+// Embedded fragment shader source. Compiled after g_shadow_fs_src.
+const char* g_sample_fs_src = R"(
+
+out vec4 PS_OUT_Color;
+
+in vec3 PS_IN_WorldFragPos;
+in vec4 PS_IN_NDCFragPos;
+in vec3 PS_IN_Normal;
+in vec2 PS_IN_TexCoord;
+
+uniform sampler2D s_Diffuse; //#slot 0
+uniform sampler2D s_ShadowMask; //#slot 4
+uniform sampler2D s_ShadowMaskDepth; //#slot 5
+
+// Depth-aware bilateral upsample of the screen-space shadow mask: the bilinear weights of the four nearest mask texels are scaled
+// down by their depth difference to the fragment, so shadows do not leak across silhouettes.
+float shadow_mask()
+{
+    float depth = linear_depth(gl_FragCoord.z);
+    vec2 coord = gl_FragCoord.xy / mask_params.z - 0.5;
+    ivec2 base = ivec2(floor(coord));
+    ivec2 size = textureSize(s_ShadowMask, 0);
+    vec2 f = coord - vec2(base);
+
+    float sum = 0.0;
+    float weight_sum = 0.0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), size - 1);
+
+        float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        float difference = abs(texelFetch(s_ShadowMaskDepth, texel, 0).r - depth) / depth;
+        float weight = bilinear / (difference + 0.001);
+
+        sum += texelFetch(s_ShadowMask, texel, 0).r * weight;
+        weight_sum += weight;
+    }
+
+    return sum / max(weight_sum, 0.0001);
+}
+
+vec3 debug_color(float frag_depth)
+{
+	int index = cascade_index(0, frag_depth);
 
 	if (index == 0)
 		return vec3(1.0, 0.0, 0.0);
@@ -175,18 +415,24 @@ vec3 debug_color(float frag_depth)
 void main()
 {
 	vec3 n = normalize(PS_IN_Normal);
-	vec3 l = -direction.xyz;
-
-	float lambert = max(0.0f, dot(n, l));
 
 	vec3 diffuse = vec3(0.7);// texture(s_Diffuse, PS_IN_TexCoord * 50).xyz;
 	vec3 ambient = diffuse * 0.3;
 
 	float frag_depth = (PS_IN_NDCFragPos.z / PS_IN_NDCFragPos.w) * 0.5 + 0.5;
-	float shadow = shadow_occlussion(frag_depth, n, l);
 	
     vec3 cascade = options.y == 1.0 ? debug_color(frag_depth) : vec3(0.0);
-	vec3 color = (1.0 - shadow) * diffuse * lambert + ambient + cascade * 0.5;
+	vec3 color = ambient + cascade * 0.5;
+
+    // The screen-space mask only holds the shadow of the primary light.
+    for (int i = 0; i < num_lights; i++)
+    {
+        vec3 l = -lights[i].direction.xyz;
+        float lambert = max(0.0f, dot(n, l));
+        float shadow = (i == 0 && mask_params.w == 1.0) ? shadow_mask() : shadow_occlussion(i, frag_depth, PS_IN_WorldFragPos, n, l);
+
+        color += (1.0 - shadow) * diffuse * lambert * lights[i].color.rgb;
+    }
 
     PS_OUT_Color = vec4(color, 1.0);
 }
@@ -201,7 +447,50 @@ void main()
 
 )";
 
-// Uniform buffer data structure.
+// Full-screen triangle generated from gl_VertexID.
+const char* g_shadow_mask_vs_src = R"(
+
+void main()
+{
+    vec2 uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+)";
+
+// Screen-space shadow mask. Reconstructs the world position of the nearest surface from the scene depth and evaluates the shadow of
+// the pixel once. The linear depth of the sample is stored next to it for the bilateral upsample. Compiled after g_shadow_fs_src.
+const char* g_shadow_mask_fs_src = R"(
+
+layout (location = 0) out float PS_OUT_Shadow;
+layout (location = 1) out float PS_OUT_Depth;
+
+uniform sampler2D s_Depth; //#slot 0
+uniform mat4 u_InvViewProj;
+
+void main()
+{
+    // Sample the full resolution depth at the center of the footprint of the mask texel.
+    int scale = int(mask_params.z);
+    ivec2 size = textureSize(s_Depth, 0);
+    ivec2 texel = min(ivec2(gl_FragCoord.xy) * scale + scale / 2, size - 1);
+    float depth = texelFetch(s_Depth, texel, 0).r;
+
+    vec4 ndc = vec4((vec2(texel) + 0.5) / vec2(size) * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world_pos = u_InvViewProj * ndc;
+    world_pos /= world_pos.w;
+
+    // Geometric normal, only used to scale the depth bias.
+    vec3 n = normalize(cross(dFdx(world_pos.xyz), dFdy(world_pos.xyz)));
+    vec3 l = -lights[0].direction.xyz;
+
+    PS_OUT_Shadow = depth < 1.0 ? shadow_occlussion(0, depth, world_pos.xyz, n, l) : 0.0;
+    PS_OUT_Depth = linear_depth(depth);
+}
+
+)";
+
+// Per-object transforms, expanded into the per-draw data of every submesh.
 struct ObjectUniforms
 {
 	DW_ALIGNED(16) glm::mat4 model;
@@ -214,24 +503,102 @@ struct GlobalUniforms
     DW_ALIGNED(16) glm::mat4 crop;
 };
 
-// Structure containing frustum split far-bound.
-// 16-byte aligned to adhere to the GLSL std140 memory layout's array packing scheme.
-// https://www.khronos.org/opengl/wiki/Interface_Block_(GLSL)#Memory_layout
-struct FarBound
+// Entry of the per-light table of CSMUniforms.
+struct ShadowLightUniforms
 {
-    DW_ALIGNED(16) float far_bound;
+    DW_ALIGNED(16) glm::vec4 direction; // xyz: direction, w: cascade count
+    DW_ALIGNED(16) glm::vec4 color; // rgb: color, w: first cascade in atlas_rects and texture_matrices
+    DW_ALIGNED(16) glm::vec4 far_bounds[2]; // Packed four per vec4 so the shader can select the cascade with vector compares.
 };
 
 struct CSMUniforms
 {
-    DW_ALIGNED(16) glm::vec4 direction;
-    DW_ALIGNED(16) glm::vec4 options; // x: shadows enabled, y: show cascades, z: blend enabled
+    DW_ALIGNED(16) glm::vec4 direction; // Primary light, also the direction of lights[0].
+    DW_ALIGNED(16) glm::vec4 options; // x: shadows enabled, y: show cascades, z: blend enabled, w: shadow filter
+    DW_ALIGNED(16) glm::vec4 filter_params; // x: light bleeding reduction, y: positive exponent, z: negative exponent, w: minimum variance
+    DW_ALIGNED(16) glm::vec4 kernel_params; // x: PCF kernel, y: Poisson disk radius in texels
+    DW_ALIGNED(16) glm::vec4 mask_params; // x: camera near, y: camera far, z: shadow mask downscale, w: shadow mask enabled
+    DW_ALIGNED(16) int       num_lights;
+    DW_ALIGNED(16) ShadowLightUniforms lights[MAX_SHADOW_LIGHTS];
+    DW_ALIGNED(16) glm::vec4 atlas_rects[MAX_SHADOW_CASCADES]; // xy: offset, zw: scale of every cascade of every light in the shadow atlas.
+    DW_ALIGNED(16) glm::mat4 texture_matrices[MAX_SHADOW_CASCADES];
+};
+
+// Crop matrices of every cascade of every light, uploaded once for the layered shadow pass.
+struct ShadowUniforms
+{
+    DW_ALIGNED(16) glm::mat4 crop_matrices[MAX_SHADOW_CASCADES];
     DW_ALIGNED(16) int       num_cascades;
-    DW_ALIGNED(16) FarBound  far_bounds[8];
-    DW_ALIGNED(16) glm::mat4 texture_matrices[8];
+    int                      cascade_mask;
+};
+
+// PCF kernels, matching CSMUniforms::kernel_params.x.
+enum PCFKernel
+{
+    PCF_KERNEL_3X3 = 0,
+    PCF_KERNEL_BILINEAR,
+    PCF_KERNEL_GATHER,
+    PCF_KERNEL_POISSON
+};
+
+// Resolution of the screen-space shadow mask.
+enum ShadowMaskMode
+{
+    SHADOW_MASK_OFF = 0,
+    SHADOW_MASK_FULL,
+    SHADOW_MASK_HALF,
+    SHADOW_MASK_QUARTER
+};
+
+// Everything the GL thread needs to submit a frame. Written by the jobs of the frame graph, then read by the GL thread the next frame
+// while the jobs write the other packet.
+struct FramePacket
+{
+    GlobalUniforms global;
+    CSMUniforms csm;
+    ObjectUniforms plane_transforms;
+    ObjectUniforms suzanne_transforms;
+    glm::mat4 view_projection; // Camera the frame is drawn from.
+    glm::mat4 main_view;       // Main camera, drawn as a frustum in debug mode.
+    glm::mat4 main_projection;
+    int cascade_count = 0;     // Cascades of every light, in the order of the shared atlas.
+    int split_count = 0;       // Cascades of the primary light, the first ones of the atlas.
+    uint32_t dirty_mask = 0;   // Cascades to redraw.
+    bool depth_clamp = false;
+    bool caster_culling = false;
+    uint32_t generation = 0;   // CSM::m_generation the cascades belong to.
+    uint32_t track_pose = 0;   // Index of the replayed track frame the camera is at plus one, zero when not replaying.
+    glm::mat4 crop_matrices[MAX_SHADOW_CASCADES];
+    FrustumSplit splits[MAX_FRUSTUM_SPLITS]; // Primary light.
+    CasterVisibility casters;
+};
+
+// What drives the main camera.
+enum TrackMode
+{
+    TRACK_MODE_LIVE = 0,
+    TRACK_MODE_RECORD,
+    TRACK_MODE_REPLAY
+};
+
+enum BenchmarkState
+{
+    BENCHMARK_IDLE = 0,
+    BENCHMARK_RUNNING,
+    BENCHMARK_RESOLVING, // Replay done, waiting for the GPU timings of the last frames.
+    BENCHMARK_DONE
+};
+
+// Timings of one profiler scope over a whole benchmark.
+struct BenchmarkScope
+{
+    std::string name;
+    ProfilerStats cpu;
+    ProfilerStats gpu;
 };
 
 #define CAMERA_FAR_PLANE 1000.0f
+#define FRAGMENT_QUERY_LATENCY 4 // Frames before a shaded fragment count is read back.
 
 class Sample : public dw::Application
 {
@@ -255,9 +622,51 @@ protected:
 		// Create camera.
 		create_camera();
 
-		// Initial CSM.
+		// Create off-screen scene render target.
+		if (!create_scene_target())
+			return false;
+
+		// Create screen-space shadow mask target.
+		create_shadow_mask_target();
+
+		// Initial CSM. The secondary lights start disabled and pack their cascades after those of the primary once enabled.
+		m_csm.m_pool = &m_render_targets;
+		m_shadow_lights.initialize(&m_csm);
+		m_shadow_lights.m_lights[1].direction = glm::normalize(glm::vec3(0.5f, -1.0f, 0.5f));
+		m_shadow_lights.m_lights[1].color = glm::vec3(0.35f, 0.4f, 0.5f);
+		m_shadow_lights.m_lights[2].direction = glm::normalize(glm::vec3(0.0f, -1.0f, -0.75f));
+		m_shadow_lights.m_lights[2].color = glm::vec3(0.5f, 0.35f, 0.25f);
+
+		// Shadow settings tuned for the platform replace the defaults, see texel_density_gui.
+		for (int i = 1; i + 1 < argc; i++)
+		{
+			if (strcmp(argv[i], "--shadow-config") == 0)
+				load_shadow_config(argv[i + 1]);
+		}
+
 		initialize_csm();
 
+		// Create the timing scopes.
+		create_profiler();
+
+		// Start the workers preparing the frame packets.
+		m_jobs.initialize();
+		create_frame_graph();
+
+		// Usage: CascadedShadowMaps [--shadow-config path] [--benchmark track [runs]]
+		for (int i = 1; i < argc; i++)
+		{
+			if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+			{
+				strncpy(m_track_path, argv[++i], sizeof(m_track_path) - 1);
+
+				if (i + 1 < argc && argv[i + 1][0] != '-')
+					m_benchmark_runs = std::max(1, atoi(argv[++i]));
+
+				start_benchmark();
+			}
+		}
+
 		return true;
 	}
 
@@ -265,40 +674,122 @@ protected:
 
 	void update(double delta) override
 	{
+        // Wall time since the previous update, i.e. the duration of the previous frame.
+        auto update_start = std::chrono::high_resolution_clock::now();
+        double frame_ms = m_frame_count > 0 ? std::chrono::duration<double, std::milli>(update_start - m_last_update_start).count() : 0.0;
+        m_last_update_start = update_start;
+        m_frame_count++;
+        
+        if (m_benchmark_frame)
+            m_benchmark_frame_ms.push_back(float(frame_ms));
+        
+        m_profiler.begin_frame();
+        m_profiler.begin(m_profile_frame);
+        
+        // Wait for the uniform ring slot of this frame to be released by the GPU.
+        m_uniform_ring.begin_frame();
+        
         // Debug GUI
         debug_gui();
         
-		// Update camera.
-        update_camera();
+		// Update camera, from the input or from the track being replayed.
+        m_benchmark_frame = m_benchmark_state == BENCHMARK_RUNNING;
         
-        // Update CSM.
-        m_csm.update(m_main_camera.get(), m_csm_uniforms.direction);
-    
-		// Update transforms.
-        update_transforms(m_debug_mode ? m_debug_camera.get() : m_main_camera.get());
-
-        // Render debug view.
-        render_debug_view();
+        if (m_track_mode == TRACK_MODE_REPLAY)
+            replay_track();
+        else
+            update_camera();
         
-        // Render shadow map.
-        render_shadow_map();
+        if (m_track_mode == TRACK_MODE_RECORD)
+            m_track.record(CameraTrack::capture(m_main_camera.get(), glm::vec3(m_csm_uniforms.direction)), frame_ms / 1000.0);
         
-        // Render scene.
-        render_scene();
+        // Feed the latest completed depth reduction into the split scheme and the texel density capture.
+        if ((m_csm.m_sdsm || m_density_capture) && m_sdsm.poll())
+        {
+            if (m_csm.m_sdsm)
+                m_csm.set_depth_range(m_sdsm.depth_range(), m_sdsm.histogram());
+            
+            if (m_density_capture)
+                capture_texel_density();
+        }
         
-        // Render debug draw.
-        m_debug_draw.render(nullptr, m_width, m_height, m_debug_mode ? m_debug_camera->m_view_projection : m_main_camera->m_view_projection);
+        if (m_density_capture && m_track_mode != TRACK_MODE_REPLAY)
+        {
+            m_density_capture = false;
+            DW_LOG_INFO("Captured the depth of " + std::to_string(m_density_tuner.sample_count()) + " track frames");
+        }
+        
+        // Packet prepared by the jobs during the previous frame. Built now instead if there is none, if the pipeline is disabled or if
+        // the atlas it refers to has been recreated since.
+        FramePacket* packet = m_frame_pipeline.acquire();
+        
+        if (!m_pipelined_frames || !packet || packet->generation != m_csm.m_generation)
+        {
+            ProfileScope scope(m_profiler, m_profile_packet_wait);
+            
+            build_frame_packet();
+            m_frame_graph.wait(m_jobs);
+            packet = m_frame_pipeline.acquire();
+        }
+        
+        // Prepare the next frame on the workers while this one is submitted.
+        if (m_pipelined_frames)
+            build_frame_packet();
+        
+        submit_frame(packet);
+        
+        // The jobs must be done before returning, the GUI and the window callbacks of the next frame modify the state they read. The
+        // main thread helps with the remaining jobs instead of blocking.
+        {
+            ProfileScope scope(m_profiler, m_profile_packet_wait);
+            m_frame_graph.wait(m_jobs);
+        }
+        
+        // Fence this frame's uniform ring slot.
+        m_uniform_ring.end_frame();
+        
+        // Delete the render targets left idle by past reconfigurations.
+        m_render_targets.end_frame();
+        
+        m_profiler.end(m_profile_frame);
+        m_profiler.end_frame();
+        
+        if (m_benchmark_state == BENCHMARK_RESOLVING && m_profiler.collect_done())
+            finish_benchmark();
 	}
 
 	// -----------------------------------------------------------------------------------------------------------------------------------
 
 	void shutdown() override
 	{
+        // Stop the workers before the state they use goes away.
+        m_jobs.shutdown();
+        
 		// Cleanup CSM.
 		m_csm.shutdown();
+        m_shadow_lights.shutdown();
+        m_sdsm.shutdown();
+        m_uniform_ring.shutdown();
+        m_evsm.shutdown();
+        
+        m_scene_fbo.reset();
+        m_shadow_mask_fbo.reset();
+        m_render_targets.release(m_scene_color);
+        m_render_targets.release(m_scene_depth);
+        m_render_targets.release(m_shadow_mask);
+        m_render_targets.release(m_shadow_mask_depth);
+        m_render_targets.shutdown();
+        m_profiler.shutdown();
+        
+        if (m_shadow_mask_vao)
+            glDeleteVertexArrays(1, &m_shadow_mask_vao);
+        
+        glDeleteQueries(FRAGMENT_QUERY_LATENCY, m_fragment_queries);
         
 		// Unload assets.
 		dw::Mesh::unload(m_plane);
+        m_suzanne_draws.shutdown();
+        m_shadow_proxy.shutdown();
         dw::Mesh::unload(m_suzanne);
 	}
 
@@ -310,6 +801,10 @@ protected:
 		m_main_camera->update_projection(60.0f, 0.1f, CAMERA_FAR_PLANE, float(m_width) / float(m_height));
         m_debug_camera->update_projection(60.0f, 0.1f, CAMERA_FAR_PLANE * 2.0f, float(m_width) / float(m_height));
 
+		// Re-create scene render target at the new size.
+		create_scene_target();
+		create_shadow_mask_target();
+
 		// Re-initialize CSM to fit new frustum shape.
 		initialize_csm();
 	}
@@ -377,66 +872,158 @@ private:
         m_csm_uniforms.options.z = 1;
 
 		m_csm.initialize(m_pssm_lambda, m_near_offset, m_cascade_count, m_shadow_map_size, m_main_camera.get(), m_width, m_height, m_csm_uniforms.direction);
+		m_shadow_lights.resize(m_main_camera.get(), m_width, m_height);
 	}
 
 	// -----------------------------------------------------------------------------------------------------------------------------------
 
-	bool create_shaders()
+	bool create_scene_target()
 	{
-		// Create general shaders
-        m_vs = std::make_unique<dw::Shader>(GL_VERTEX_SHADER, g_sample_vs_src);
-		m_fs = std::make_unique<dw::Shader>(GL_FRAGMENT_SHADER, g_sample_fs_src);
-
-		if (!m_vs || !m_fs)
-		{
-			DW_LOG_FATAL("Failed to create Shaders");
-			return false;
-		}
-
-		// Create general shader program
-        dw::Shader* shaders[] = { m_vs.get(), m_fs.get() };
-        m_program = std::make_unique<dw::Program>(2, shaders);
-
-		if (!m_program)
-		{
-			DW_LOG_FATAL("Failed to create Shader Program");
-			return false;
-		}
+        m_scene_fbo.reset();
+        m_render_targets.release(m_scene_color);
+        m_render_targets.release(m_scene_depth);
         
-        m_program->uniform_block_binding("GlobalUniforms", 0);
-        m_program->uniform_block_binding("ObjectUniforms", 1);
-        m_program->uniform_block_binding("CSMUniforms", 2);
+        // The scene is rendered off-screen so that its depth buffer can be read by later passes.
+        int width = m_width;
+        int height = m_height;
         
-        // Create CSM shaders
-        m_csm_vs = std::make_unique<dw::Shader>(GL_VERTEX_SHADER, g_csm_vs_src);
-        m_csm_fs = std::make_unique<dw::Shader>(GL_FRAGMENT_SHADER, g_csm_fs_src);
+        m_scene_color = m_render_targets.acquire({ width, height, 1, 1, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE }, "scene color");
+        m_scene_depth = m_render_targets.acquire({ width, height, 1, 1, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8 }, "scene depth");
+        m_scene_depth->texture()->set_min_filter(GL_NEAREST);
+        m_scene_depth->texture()->set_mag_filter(GL_NEAREST);
         
-        if (!m_csm_vs || !m_csm_fs)
-        {
-            DW_LOG_FATAL("Failed to create CSM Shaders");
-            return false;
-        }
+        m_scene_fbo = std::make_unique<dw::Framebuffer>();
+        m_scene_fbo->attach_render_target(0, m_scene_color->texture(), 0, 0);
+        m_scene_fbo->attach_depth_stencil_target(m_scene_depth->texture(), 0, 0);
         
-        // Create CSM shader program
-        dw::Shader* csm_shaders[] = { m_csm_vs.get(), m_csm_fs.get() };
-        m_csm_program = std::make_unique<dw::Program>(2, csm_shaders);
+        // Depth is only copied to the default framebuffer if it has the same depth and stencil format, blitting to any other fails.
+        GLint depth_object = GL_NONE;
+        GLint stencil_object = GL_NONE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &depth_object);
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &stencil_object);
         
-        if (!m_csm_program)
+        m_blit_depth = false;
+        
+        if (depth_object != GL_NONE && stencil_object != GL_NONE)
         {
-            DW_LOG_FATAL("Failed to create CSM Shader Program");
-            return false;
+            GLint depth_bits = 0;
+            GLint stencil_bits = 0;
+            GLint depth_type = GL_NONE;
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depth_bits);
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencil_bits);
+            glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &depth_type);
+            
+            m_blit_depth = depth_bits == 24 && stencil_bits == 8 && depth_type == GL_UNSIGNED_NORMALIZED;
         }
         
-        m_csm_program->uniform_block_binding("GlobalUniforms", 0);
-        m_csm_program->uniform_block_binding("ObjectUniforms", 1);
+        if (!m_blit_depth)
+            DW_LOG_WARNING("The window depth buffer is not D24S8, debug lines are drawn without the scene depth");
+        
+        // Depth reduction chain for SDSM.
+		return m_sdsm.initialize(m_program_cache, m_render_targets, m_width, m_height);
+	}
 
-		return true;
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
+	int shadow_mask_scale()
+	{
+        return m_shadow_mask_mode == SHADOW_MASK_OFF ? 1 : 1 << (m_shadow_mask_mode - 1);
 	}
 
 	// -----------------------------------------------------------------------------------------------------------------------------------
 
-//    bool create_states()
-//    {
+	void create_shadow_mask_target()
+	{
+        m_shadow_mask_fbo.reset();
+        m_render_targets.release(m_shadow_mask);
+        m_render_targets.release(m_shadow_mask_depth);
+        
+        if (m_shadow_mask_mode == SHADOW_MASK_OFF)
+            return;
+        
+        int scale = shadow_mask_scale();
+        int width = (m_width + scale - 1) / scale;
+        int height = (m_height + scale - 1) / scale;
+        
+        // Shadow term plus the linear depth it was evaluated at, read by the bilateral upsample.
+        m_shadow_mask = m_render_targets.acquire({ width, height, 1, 1, GL_R8, GL_RED, GL_UNSIGNED_BYTE }, "shadow mask");
+        m_shadow_mask->texture()->set_min_filter(GL_NEAREST);
+        m_shadow_mask->texture()->set_mag_filter(GL_NEAREST);
+        
+        m_shadow_mask_depth = m_render_targets.acquire({ width, height, 1, 1, GL_R32F, GL_RED, GL_FLOAT }, "shadow mask depth");
+        m_shadow_mask_depth->texture()->set_min_filter(GL_NEAREST);
+        m_shadow_mask_depth->texture()->set_mag_filter(GL_NEAREST);
+        
+        m_shadow_mask_fbo = std::make_unique<dw::Framebuffer>();
+        m_shadow_mask_fbo->attach_render_target(0, m_shadow_mask->texture(), 0, 0);
+        m_shadow_mask_fbo->attach_render_target(1, m_shadow_mask_depth->texture(), 0, 0);
+	}
+
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
+	bool create_shaders()
+	{
+        m_program_cache.initialize();
+        
+		// Create general shader program
+        m_program = m_program_cache.create("forward", { { GL_VERTEX_SHADER, g_sample_vs_src }, { GL_FRAGMENT_SHADER, std::string(g_shadow_fs_src) + g_sample_fs_src } });
+
+		if (!m_program)
+		{
+			DW_LOG_FATAL("Failed to create Shader Program");
+			return false;
+		}
+        
+        m_program->uniform_block_binding("GlobalUniforms", 0);
+        m_program->uniform_block_binding("CSMUniforms", 2);
+        
+        // Create CSM shader program
+        m_csm_program = m_program_cache.create("csm", { { GL_VERTEX_SHADER, g_csm_vs_src }, { GL_FRAGMENT_SHADER, g_csm_fs_src } });
+        
+        if (!m_csm_program)
+        {
+            DW_LOG_FATAL("Failed to create CSM Shader Program");
+            return false;
+        }
+        
+        m_csm_program->uniform_block_binding("GlobalUniforms", 0);
+        
+        // Create layered CSM shader program
+        m_csm_layered_program = m_program_cache.create("csm_layered", { { GL_VERTEX_SHADER, g_csm_layered_vs_src }, { GL_GEOMETRY_SHADER, g_csm_layered_gs_src }, { GL_FRAGMENT_SHADER, g_csm_fs_src } });
+        
+        if (!m_csm_layered_program)
+        {
+            DW_LOG_FATAL("Failed to create layered CSM Shader Program");
+            return false;
+        }
+        
+        m_csm_layered_program->uniform_block_binding("ShadowUniforms", 3);
+        
+        // Create shadow mask shader program
+        m_shadow_mask_program = m_program_cache.create("shadow_mask", { { GL_VERTEX_SHADER, g_shadow_mask_vs_src }, { GL_FRAGMENT_SHADER, std::string(g_shadow_fs_src) + g_shadow_mask_fs_src } });
+        
+        if (!m_shadow_mask_program)
+        {
+            DW_LOG_FATAL("Failed to create Shadow Mask Shader Program");
+            return false;
+        }
+        
+        m_shadow_mask_program->uniform_block_binding("CSMUniforms", 2);
+        
+        glGenVertexArrays(1, &m_shadow_mask_vao);
+        glGenQueries(FRAGMENT_QUERY_LATENCY, m_fragment_queries);
+        
+        DW_LOG_INFO("Programs: " + std::to_string(m_program_cache.m_hits) + " loaded from cache in " + std::to_string(m_program_cache.m_load_ms) + " ms, " +
+                    std::to_string(m_program_cache.m_misses) + " compiled in " + std::to_string(m_program_cache.m_compile_ms) + " ms");
+
+		return true;
+	}
+
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
+//    bool create_states()
+//    {
 //        // Create rasterizer state
 //        RasterizerStateCreateDesc rs_desc;
 //        DW_ZERO_MEMORY(rs_desc);
@@ -490,192 +1077,1293 @@ private:
 
 	// -----------------------------------------------------------------------------------------------------------------------------------
 
+	void create_profiler()
+	{
+		m_profiler.initialize();
+
+		// Top level scopes first, the overlay lists them in creation order.
+		m_profile_frame = m_profiler.scope("Frame");
+		m_profile_packet_wait = m_profiler.scope("Frame Packet Wait", false);
+		m_profile_submit = m_profiler.scope("Submission", false);
+		m_profile_debug_view = m_profiler.scope("Debug View", false);
+		m_profile_shadow_maps = m_profiler.scope("Shadow Maps");
+
+		for (int i = 0; i < MAX_SHADOW_CASCADES; i++)
+			m_profile_cascades[i] = m_profiler.scope("Shadow Cascade " + std::to_string(i + 1));
+
+		m_profile_shadow_filter = m_profiler.scope("Shadow Filter");
+		m_profile_depth_prepass = m_profiler.scope("Depth Pre-pass");
+		m_profile_shadow_mask = m_profiler.scope("Shadow Mask");
+		m_profile_scene = m_profiler.scope("Scene");
+		m_profile_debug_draw = m_profiler.scope("Debug Draw");
+	}
+
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
 	bool create_uniform_buffer()
 	{
-		// Create uniform buffer for object matrix data
-        m_object_ubo = std::make_unique<dw::UniformBuffer>(GL_DYNAMIC_DRAW, sizeof(ObjectUniforms));
+		// Create the ring all object, global, CSM and layered shadow map uniforms are suballocated from.
+		if (!m_uniform_ring.initialize())
+		{
+			DW_LOG_FATAL("Failed to create Uniform Ring");
+			return false;
+		}
+
+		return true;
+	}
+
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
+	bool load_mesh()
+	{
+		//m_plane = dw::Mesh::load("plane.obj", &m_device);
+        m_suzanne = MeshCache::load("sponza.obj");
+        
+        if (!m_suzanne)
+            return false;
+        
+        // Build the indirect draw commands of every submesh.
+        if (!m_suzanne_draws.initialize(m_suzanne))
+            return false;
+        
+        // Keep the submesh ranges around for the software rasterizer.
+        m_rasterizer_draws.resize(m_suzanne->sub_mesh_count());
+        
+        for (uint32_t i = 0; i < m_suzanne->sub_mesh_count(); i++)
+        {
+            dw::SubMesh& submesh = m_suzanne->sub_meshes()[i];
+            m_rasterizer_draws[i] = { submesh.index_count, submesh.base_index, (int32_t)submesh.base_vertex };
+        }
+        
+        // Build the caster hierarchy over the submesh bounds.
+        m_caster_bvh.build(m_suzanne);
+        
+        // Simplified casters for the cascades that cannot resolve the full detail. Shadows are still rendered without them on failure.
+        if (!m_shadow_proxy.initialize(m_suzanne, "sponza.obj"))
+        {
+            DW_LOG_WARNING("Failed to create shadow proxies");
+            m_shadow_proxies = false;
+        }
+        
+		return true;
+	}
+
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
+	void create_camera()
+	{
+        m_main_camera = std::make_unique<dw::Camera>(60.0f, 0.1f, CAMERA_FAR_PLANE, float(m_width) / float(m_height), glm::vec3(0.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0, -1.0f));
+        m_debug_camera = std::make_unique<dw::Camera>(60.0f, 0.1f, CAMERA_FAR_PLANE * 2.0f, float(m_width) / float(m_height), glm::vec3(0.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0, -1.0f));
+	}
+
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
+    // When draws is given only those submeshes are submitted.
+    void render_mesh(IndirectMesh& mesh, const ObjectUniforms& transforms, bool use_textures = true, const std::vector<uint32_t>* draws = nullptr)
+	{
+        // Copy new transforms into the per-draw data.
+        mesh.set_model(transforms.model);
+
+		// Bind uniform buffers.
+        m_uniform_ring.bind_range(0, m_global_uniforms_offset, sizeof(GlobalUniforms));
+
+		// Bind vertex array.
+        mesh.bind();
+
+        // Submit every submesh at once unless a texture has to be bound per submesh.
+        if (draws)
+        {
+            if (m_indirect_draws && mesh.m_indirect_supported && !use_textures)
+                m_draw_calls += mesh.draw_indirect(draws->data(), (uint32_t)draws->size());
+            else
+                m_draw_calls += mesh.draw_direct(draws->data(), (uint32_t)draws->size(), use_textures);
+        }
+        else if (m_indirect_draws && mesh.m_indirect_supported && !use_textures)
+            m_draw_calls += mesh.draw_indirect();
+        else
+            m_draw_calls += mesh.draw_direct(use_textures);
+	}
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_scene()
+    {
+        // Update global uniforms.
+        update_camera_uniforms();
+        
+        // Update CSM uniforms.
+        update_csm_uniforms(m_packet->csm);
+        
+        // Bind and set viewport.
+        m_scene_fbo->bind();
+        glViewport(0, 0, m_width, m_height);
+  
+        // Clear scene framebuffer. After the pre-pass the depth buffer already holds the visible surfaces.
+        bool shadow_mask = m_shadow_mask_mode != SHADOW_MASK_OFF;
+        bool depth_prepass = depth_prepass_enabled();
+        
+        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+        glClear(depth_prepass ? GL_COLOR_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        
+        // Bind states.
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        
+        // Only the fragments of the visible surface pass, so every pixel is shaded once.
+        if (depth_prepass)
+        {
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        
+        // Bind shader program.
+        m_program->use();
+        
+        // Bind shadow map.
+        m_csm.shadow_map()->bind(1);
+        
+        m_program->set_uniform("s_ShadowMap", 1);
+        
+        // Bind the shadow map a second time with the depth compare sampler.
+        m_csm.shadow_map()->bind(3);
+        glBindSampler(3, m_csm.compare_sampler());
+        
+        m_program->set_uniform("s_ShadowMapCompare", 3);
+        
+        // Bind moment map.
+        if (m_evsm.moments())
+            m_evsm.moments()->bind(2);
+        
+        m_program->set_uniform("s_MomentMap", 2);
+        
+        // Bind shadow mask.
+        if (shadow_mask)
+        {
+            m_shadow_mask->texture()->bind(4);
+            m_shadow_mask_depth->texture()->bind(5);
+        }
+        
+        m_program->set_uniform("s_ShadowMask", 4);
+        m_program->set_uniform("s_ShadowMaskDepth", 5);
+
+        // Bind uniform buffers.
+        m_uniform_ring.bind_range(2, m_csm_uniforms_offset, sizeof(CSMUniforms));
+        
+        // Draw meshes.
+        //render_mesh(m_plane, m_plane_transforms);
+        begin_fragment_query(depth_prepass);
+        render_mesh(m_suzanne_draws, m_packet->suzanne_transforms, false);
+        end_fragment_query();
+        
+        glBindSampler(3, 0);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        
+        // Copy color, and depth for the debug lines when the formats allow it, to the default framebuffer. Separate blits so that a
+        // depth mismatch can never drop the color.
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_scene_fbo->id());
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        
+        if (m_blit_depth)
+            glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_depth_prepass()
+    {
+        update_camera_uniforms();
+        
+        m_scene_fbo->bind();
+        glViewport(0, 0, m_width, m_height);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        
+        // Same culling as the forward pass, so that both rasterize the same triangles.
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        
+        // Position-only shadow program, with the camera in place of a cascade.
+        m_csm_program->use();
+        render_mesh(m_suzanne_draws, m_packet->suzanne_transforms, false);
+        
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void update_camera_uniforms()
+    {
+        // The camera passes transform positions with the crop matrix as well, see g_sample_vs_src.
+        m_packet->global.crop = m_packet->global.projection * m_packet->global.view;
+        update_global_uniforms(m_packet->global);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void reduce_scene_depth()
+    {
+        // Reduce the scene depth buffer for the next frames' split placement, tagged with the track pose the depth was rendered from.
+        if ((m_csm.m_sdsm || m_density_capture) && !m_debug_mode)
+            m_sdsm.reduce(m_scene_depth->texture(), m_main_camera->m_near, m_main_camera->m_far, m_packet->track_pose);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    bool depth_prepass_enabled()
+    {
+        // The shadow mask reconstructs the visible surface of every pixel from the pre-pass depth.
+        return m_depth_prepass || m_shadow_mask_mode != SHADOW_MASK_OFF;
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void begin_fragment_query(bool depth_prepass)
+    {
+        int index = m_fragment_query_index;
+        
+        // Issued FRAGMENT_QUERY_LATENCY frames ago, usually done by now. Reading it before it is would stall the pipeline, so a late
+        // result is dropped and the previous count kept.
+        if (m_fragment_query_pending[index])
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(m_fragment_queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+            
+            if (available)
+            {
+                GLuint64 samples = 0;
+                glGetQueryObjectui64v(m_fragment_queries[index], GL_QUERY_RESULT, &samples);
+                m_shaded_fragments[m_fragment_query_prepass[index] ? 1 : 0] = samples;
+            }
+        }
+        
+        m_fragment_query_prepass[index] = depth_prepass;
+        m_fragment_query_pending[index] = true;
+        glBeginQuery(GL_SAMPLES_PASSED, m_fragment_queries[index]);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void end_fragment_query()
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+        m_fragment_query_index = (m_fragment_query_index + 1) % FRAGMENT_QUERY_LATENCY;
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_shadow_mask()
+    {
+        // Update global uniforms.
+        update_camera_uniforms();
+        
+        // Update CSM uniforms.
+        update_csm_uniforms(m_packet->csm);
+        
+        // Evaluate the shadow of every mask texel.
+        m_shadow_mask_fbo->bind();
+        glViewport(0, 0, m_shadow_mask->m_desc.width, m_shadow_mask->m_desc.height);
+        
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        
+        m_shadow_mask_program->use();
+        m_shadow_mask_program->set_uniform("u_InvViewProj", glm::inverse(m_packet->global.projection * m_packet->global.view));
+        
+        m_scene_depth->texture()->bind(0);
+        m_shadow_mask_program->set_uniform("s_Depth", 0);
+        
+        m_csm.shadow_map()->bind(1);
+        m_shadow_mask_program->set_uniform("s_ShadowMap", 1);
+        
+        m_csm.shadow_map()->bind(3);
+        glBindSampler(3, m_csm.compare_sampler());
+        m_shadow_mask_program->set_uniform("s_ShadowMapCompare", 3);
+        
+        if (m_evsm.moments())
+            m_evsm.moments()->bind(2);
+        
+        m_shadow_mask_program->set_uniform("s_MomentMap", 2);
+        
+        m_uniform_ring.bind_range(2, m_csm_uniforms_offset, sizeof(CSMUniforms));
+        
+        glBindVertexArray(m_shadow_mask_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        
+        glBindSampler(3, 0);
+        m_scene_depth->texture()->unbind(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_shadow_map()
+    {
+        uint32_t draw_calls = m_draw_calls;
+        
+        // Only cascades whose crop matrix changed this frame need to be redrawn.
+        m_shadow_cascades_rendered = 0;
+        
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            if (cascade_dirty(i))
+                m_shadow_cascades_rendered++;
+        }
+        
+        if (m_shadow_cascades_rendered == 0)
+        {
+            m_shadow_draw_calls = 0;
+            return;
+        }
+        
+        select_shadow_lods();
+        
+        // Casters in front of the fitted near plane are flattened onto it instead of being clipped.
+        if (m_packet->depth_clamp)
+            glEnable(GL_DEPTH_CLAMP);
+        
+        if (m_cpu_shadows)
+            render_shadow_map_cpu();
+        else if (m_layered_shadows)
+            render_shadow_map_layered();
+        else
+            render_shadow_map_per_cascade();
+        
+        glDisable(GL_DEPTH_CLAMP);
+        
+        m_shadow_draw_calls = m_draw_calls - draw_calls;
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_shadow_map_per_cascade()
+    {
+        // Bind states.
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        
+        // Bind shader program.
+        m_csm_program->use();
+        
+        // Bind framebuffer. Every cascade is rendered into its rect of the atlas.
+        glBindFramebuffer(GL_FRAMEBUFFER, m_csm.framebuffer());
+        glEnable(GL_SCISSOR_TEST);
+        
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            if (!cascade_dirty(i))
+                continue;
+            
+            ProfileScope scope(m_profiler, m_profile_cascades[i]);
+            
+            // Update global uniforms.
+			m_packet->global.crop = m_packet->crop_matrices[i];
+            
+            update_global_uniforms(m_packet->global);
+            
+            // Set viewport to the rect of the cascade.
+            const ShadowAtlasRect& rect = m_shadow_lights.atlas_rect(i);
+            glViewport(rect.x, rect.y, rect.size, rect.size);
+            glScissor(rect.x, rect.y, rect.size, rect.size);
+            
+            // Clear the rect only, the other cascades may be kept from previous frames.
+            glClear(GL_DEPTH_BUFFER_BIT);
+            
+            // Draw meshes. Disable textures because we don't need them here.
+			//m_device.bind_rasterizer_state(m_rs);
+           // render_mesh(m_plane, m_plane_transforms, false);
+
+            render_mesh(shadow_draws(m_shadow_lods[i]), m_packet->suzanne_transforms, false, m_packet->caster_culling ? &m_packet->casters.m_visible[i] : nullptr);
+        }
+        
+        glDisable(GL_SCISSOR_TEST);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_shadow_map_layered()
+    {
+        // Update crop matrices of all cascades.
+        m_shadow_uniforms.num_cascades = m_packet->cascade_count;
+        m_shadow_uniforms.cascade_mask = 0;
+        
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            m_shadow_uniforms.crop_matrices[i] = m_packet->crop_matrices[i];
+            
+            if (cascade_dirty(i))
+                m_shadow_uniforms.cascade_mask |= 1 << i;
+        }
+        
+        update_shadow_uniforms(m_shadow_uniforms);
+        
+        // Bind states.
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        
+        // Bind shader program.
+        m_csm_layered_program->use();
+        
+        // Bind uniform buffers.
+        m_uniform_ring.bind_range(3, m_shadow_uniforms_offset, sizeof(ShadowUniforms));
+        
+        // Bind framebuffer. All cascades share the atlas, one viewport per cascade.
+        glBindFramebuffer(GL_FRAMEBUFFER, m_csm.framebuffer());
+        
+        // Clear the rects that are about to be redrawn.
+        glEnable(GL_SCISSOR_TEST);
+        
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            if (!cascade_dirty(i))
+                continue;
+            
+            const ShadowAtlasRect& rect = m_shadow_lights.atlas_rect(i);
+            glScissor(rect.x, rect.y, rect.size, rect.size);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        
+        glDisable(GL_SCISSOR_TEST);
+        
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            const ShadowAtlasRect& rect = m_shadow_lights.atlas_rect(i);
+            glViewportIndexedf(i, float(rect.x), float(rect.y), float(rect.size), float(rect.size));
+        }
+        
+        // Draw meshes once per level of detail, the geometry shader replicates them into every cascade using that level they are visible
+        // in.
+        for (int level = 0; level <= SHADOW_PROXY_LEVELS; level++)
+        {
+            uint32_t level_mask = 0;
+            
+            for (int i = 0; i < m_packet->cascade_count; i++)
+            {
+                if (m_shadow_lods[i] == level)
+                    level_mask |= 1 << i;
+            }
+            
+            if ((level_mask & m_shadow_uniforms.cascade_mask) == 0)
+                continue;
+            
+            IndirectMesh& draws = shadow_draws(level);
+            m_layered_cascade_masks.resize(draws.draw_count());
+            
+            for (uint32_t d = 0; d < draws.draw_count(); d++)
+                m_layered_cascade_masks[d] = (m_packet->caster_culling ? m_packet->casters.m_cascade_masks[d] : ~0u) & level_mask;
+            
+            draws.set_cascade_masks(m_layered_cascade_masks.data());
+            render_mesh(draws, m_packet->suzanne_transforms, false, m_packet->caster_culling ? &m_packet->casters.m_visible_union : nullptr);
+        }
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    IndirectMesh& shadow_draws(int level)
+    {
+        return level > 0 ? m_shadow_proxy.level(level).draws : m_suzanne_draws;
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void select_shadow_lods()
+    {
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            // Size of a texel in world units, from the scale of the crop matrix along the light's x and y axes.
+            const glm::mat4& crop = m_packet->crop_matrices[i];
+            float scale = std::max(glm::length(glm::vec3(crop[0][0], crop[1][0], crop[2][0])), glm::length(glm::vec3(crop[0][1], crop[1][1], crop[2][1])));
+            float model_scale = glm::length(glm::vec3(m_packet->suzanne_transforms.model[0]));
+            
+            m_shadow_texel_sizes[i] = 2.0f / (scale * m_shadow_lights.cascade_size(i));
+            m_shadow_lods[i] = m_shadow_proxies ? m_shadow_proxy.select(m_shadow_texel_sizes[i] / model_scale, m_shadow_proxy_tolerance) : 0;
+            
+            const std::vector<uint32_t>* draws = m_packet->caster_culling ? &m_packet->casters.m_visible[i] : nullptr;
+            m_shadow_triangles[i] = m_shadow_proxy.triangle_count(m_shadow_lods[i], draws);
+            m_shadow_full_triangles[i] = m_shadow_proxy.triangle_count(0, draws);
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void resolve_shadow_filter()
+    {
+        if (m_shadow_filter == SHADOW_FILTER_PCF)
+            return;
+        
+        uint32_t cascade_mask = 0;
+        
+        // Re-create the moment array when the cascades or the filter changed, every cascade then has to be resolved.
+        if (m_evsm.m_size != m_csm.m_shadow_map_size || m_evsm.m_cascade_count != m_csm.m_split_count || m_evsm.m_filter != m_shadow_filter)
+        {
+            m_evsm.initialize(m_program_cache, m_render_targets, m_csm.shadow_map_size(), m_csm.frustum_split_count(), m_shadow_filter);
+            cascade_mask = (1 << m_csm.frustum_split_count()) - 1;
+        }
+        else
+        {
+            for (int i = 0; i < m_csm.m_split_count; i++)
+            {
+                if (cascade_dirty(i))
+                    cascade_mask |= 1 << i;
+            }
+        }
+        
+        ProfileScope scope(m_profiler, m_profile_shadow_filter);
+        m_evsm.resolve(m_csm.shadow_map(), &m_csm.m_atlas.m_rects[0], cascade_mask);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void rasterize_shadow_map()
+    {
+        // Rasterize every cascade at the resolution it was given in the atlas.
+        bool resized = m_software_rasterizer.m_cascade_count != m_packet->cascade_count;
+        
+        for (int i = 0; i < m_packet->cascade_count && !resized; i++)
+            resized = m_software_rasterizer.size(i) != m_shadow_lights.cascade_size(i);
+        
+        if (resized)
+            m_software_rasterizer.initialize(&m_shadow_lights.m_atlas.m_sizes[0], m_packet->cascade_count);
+        else
+            m_software_rasterizer.clear();
+        
+        m_software_rasterizer.m_depth_clamp = m_packet->depth_clamp;
+        
+        m_software_rasterizer.render(&m_packet->crop_matrices[0],
+                                     m_packet->cascade_count,
+                                     m_packet->suzanne_transforms.model,
+                                     &m_suzanne->vertices()[0].position,
+                                     sizeof(dw::Vertex),
+                                     m_suzanne->vertex_count(),
+                                     m_suzanne->indices(),
+                                     m_rasterizer_draws.data(),
+                                     (int)m_rasterizer_draws.size());
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_shadow_map_cpu()
+    {
+        rasterize_shadow_map();
+        
+        // Upload every refreshed cascade into its rect of the atlas. GL converts the float depths to the format of the atlas.
+        glBindTexture(GL_TEXTURE_2D, m_csm.shadow_map()->id());
+        
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            if (!cascade_dirty(i))
+                continue;
+            
+            const ShadowAtlasRect& rect = m_shadow_lights.atlas_rect(i);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.size, rect.size, GL_DEPTH_COMPONENT, GL_FLOAT, m_software_rasterizer.depth(i));
+        }
+        
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void validate_shadow_map()
+    {
+        // Compares against the cascades of the last submitted frame.
+        if (!m_packet)
+            return;
+        
+        rasterize_shadow_map();
+        
+        // Read back the whole GPU shadow atlas.
+        int width = m_csm.m_atlas.m_width;
+        std::vector<float> gpu_depth((size_t)width * m_csm.m_atlas.m_height);
+        std::vector<float> cascade_depth;
+        
+        glBindTexture(GL_TEXTURE_2D, m_csm.shadow_map()->id());
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, gpu_depth.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
+            // Extract the rect of the cascade.
+            const ShadowAtlasRect& rect = m_shadow_lights.atlas_rect(i);
+            cascade_depth.resize((size_t)rect.size * rect.size);
+            
+            for (int y = 0; y < rect.size; y++)
+                memcpy(&cascade_depth[(size_t)y * rect.size], &gpu_depth[(size_t)(rect.y + y) * width + rect.x], rect.size * sizeof(float));
+            
+            m_validation_error[i] = m_software_rasterizer.compare(i, cascade_depth.data(), 1.0f / 4096.0f);
+            DW_LOG_INFO("Cascade " + std::to_string(i + 1) + ": " + std::to_string(m_validation_error[i] * 100.0f) + "% of texels differ from the CPU reference");
+        }
+    }
+
+	// -----------------------------------------------------------------------------------------------------------------------------------
+
+    void update_csm_uniforms(const CSMUniforms& csm)
+    {
+        m_csm_uniforms_offset = m_uniform_ring.upload(&csm, sizeof(CSMUniforms));
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void update_global_uniforms(const GlobalUniforms& global)
+    {
+        m_global_uniforms_offset = m_uniform_ring.upload(&global, sizeof(GlobalUniforms));
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void update_shadow_uniforms(const ShadowUniforms& shadow)
+    {
+        m_shadow_uniforms_offset = m_uniform_ring.upload(&shadow, sizeof(ShadowUniforms));
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void update_transforms(dw::Camera* camera, FramePacket& packet)
+    {
+        // Update camera matrices.
+        packet.global.view = camera->m_view;
+        packet.global.projection = camera->m_projection;
+        packet.global.crop = glm::mat4(1.0f);
+        packet.view_projection = camera->m_view_projection;
+        packet.main_view = m_main_camera->m_view;
+        packet.main_projection = m_main_camera->m_projection;
+        packet.track_pose = m_track_mode == TRACK_MODE_REPLAY ? m_track_pose : 0;
+        
+        // Update plane transforms.
+        packet.plane_transforms.model = glm::mat4(1.0f);
+
+        // Update suzanne transforms.
+        packet.suzanne_transforms.model = glm::mat4(1.0f);
+        packet.suzanne_transforms.model = glm::translate(packet.suzanne_transforms.model, glm::vec3(0.0f, 3.0f, 0.0f));
+       // packet.suzanne_transforms.model = glm::rotate(packet.suzanne_transforms.model, (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f));
+        packet.suzanne_transforms.model = glm::scale(packet.suzanne_transforms.model, glm::vec3(0.1f));
+        
+        // World space bounds of the scene, used to fit the depth range of the cascades. Every mesh both casts and receives shadows.
+        glm::vec3 scene_min(INFINITY);
+        glm::vec3 scene_max(-INFINITY);
+        
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 min = m_suzanne->min_extents();
+            glm::vec3 max = m_suzanne->max_extents();
+            glm::vec3 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+            glm::vec3 world = glm::vec3(packet.suzanne_transforms.model * glm::vec4(corner, 1.0f));
+            
+            scene_min = glm::min(scene_min, world);
+            scene_max = glm::max(scene_max, world);
+        }
+        
+        m_csm.set_scene_bounds(scene_min, scene_max, scene_min, scene_max);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void pack_csm_uniforms(dw::Camera* camera, FramePacket& packet)
+    {
+        // Light direction and options come from the GUI.
+        packet.csm = m_csm_uniforms;
+        
+        packet.csm.options.w = float(m_shadow_filter);
+        packet.csm.filter_params = m_evsm.filter_params();
+        packet.csm.kernel_params = glm::vec4(float(m_pcf_kernel), m_poisson_radius, 0.0f, 0.0f);
+        packet.csm.mask_params = glm::vec4(camera->m_near, camera->m_far, float(shadow_mask_scale()), m_shadow_mask_mode != SHADOW_MASK_OFF ? 1.0f : 0.0f);
+        
+        // Snapshot of the cascades, the CSMs keep being updated for the next frames while this one is submitted.
+        packet.cascade_count = m_shadow_lights.m_cascade_count;
+        packet.split_count = m_csm.frustum_split_count();
+        packet.dirty_mask = 0;
+        packet.depth_clamp = m_csm.depth_clamp();
+        packet.generation = m_csm.m_generation;
+        packet.csm.num_lights = 0;
+        
+        for (int i = 0; i < m_csm.m_split_count; i++)
+            packet.splits[i] = m_csm.frustum_splits()[i];
+        
+        // Compact table of the enabled lights, each pointing at its range of the cascade tables.
+        for (int l = 0; l < MAX_SHADOW_LIGHTS; l++)
+        {
+            int first = m_shadow_lights.m_first_cascade[l];
+            
+            if (first < 0)
+                continue;
+            
+            CSM* csm = m_shadow_lights.light(l);
+            int count = csm->frustum_split_count();
+            glm::vec3 direction = l == 0 ? glm::vec3(m_csm_uniforms.direction) : m_shadow_lights.m_lights[l].direction;
+            ShadowLightUniforms& light = packet.csm.lights[packet.csm.num_lights++];
+            
+            light.direction = glm::vec4(direction, float(count));
+            light.color = glm::vec4(m_shadow_lights.m_lights[l].color, float(first));
+            
+            for (int i = 0; i < MAX_FRUSTUM_SPLITS; i++)
+                light.far_bounds[i / 4][i % 4] = i < count ? csm->far_bound(i) : 2.0f;
+            
+            for (int i = 0; i < count; i++)
+            {
+                packet.csm.atlas_rects[first + i] = csm->atlas_uv_rect(i);
+                packet.csm.texture_matrices[first + i] = csm->texture_matrix(i);
+                packet.crop_matrices[first + i] = csm->split_view_proj(i);
+                
+                if (csm->cascade_dirty(i))
+                    packet.dirty_mask |= 1u << (first + i);
+            }
+        }
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void create_frame_graph()
+    {
+        // Transforms feed the scene bounds into the CSM, culling and uniform packing both read the solved cascades.
+        uint32_t transforms = m_frame_graph.add("Transforms", [this]()
+        {
+            update_transforms(active_camera(), m_frame_pipeline.m_packets[m_build_slot]);
+        });
+        
+        uint32_t csm = m_frame_graph.add("CSM", [this]()
+        {
+            // Every shadowed light is solved in the same batch.
+            CSMBatchView views[MAX_SHADOW_LIGHTS];
+            
+            m_shadow_lights.sync_settings();
+            m_csm_batch.update(views, m_shadow_lights.views(m_main_camera.get(), glm::vec3(m_csm_uniforms.direction), views));
+        });
+        
+        uint32_t culling = m_frame_graph.add("Caster Culling", [this]()
+        {
+            FramePacket& packet = m_frame_pipeline.m_packets[m_build_slot];
+            packet.caster_culling = m_caster_culling;
+            
+            // Find the casters of every cascade of every light in a single traversal.
+            if (m_caster_culling)
+            {
+                glm::mat4 crop_matrices[MAX_SHADOW_CASCADES];
+                int count = m_shadow_lights.crop_matrices(crop_matrices);
+                
+                m_caster_bvh.cull(crop_matrices, count, packet.suzanne_transforms.model, packet.casters);
+            }
+        });
+        
+        uint32_t uniforms = m_frame_graph.add("Uniform Packing", [this]()
+        {
+            pack_csm_uniforms(active_camera(), m_frame_pipeline.m_packets[m_build_slot]);
+        });
+        
+        uint32_t publish = m_frame_graph.add("Publish", [this]()
+        {
+            m_frame_pipeline.publish(m_build_slot);
+            m_frame_build_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_build_start).count();
+        });
+        
+        m_frame_graph.depend(csm, transforms);
+        m_frame_graph.depend(culling, csm);
+        m_frame_graph.depend(uniforms, csm);
+        m_frame_graph.depend(publish, culling);
+        m_frame_graph.depend(publish, uniforms);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void build_frame_packet()
+    {
+        m_build_slot = m_frame_pipeline.write_slot();
+        m_build_start = std::chrono::high_resolution_clock::now();
+        m_frame_graph.execute(m_jobs);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void submit_frame(FramePacket* packet)
+    {
+        ProfileScope submit_scope(m_profiler, m_profile_submit);
+        
+        m_packet = packet;
+        
+        // Render debug view.
+        {
+            ProfileScope scope(m_profiler, m_profile_debug_view);
+            render_debug_view();
+        }
+        
+        // Render shadow map.
+        {
+            ProfileScope scope(m_profiler, m_profile_shadow_maps);
+            render_shadow_map();
+        }
+        
+        // Convert the refreshed cascades into filterable moments.
+        resolve_shadow_filter();
+        
+        // Lay down the depth of the visible surfaces, read by the shadow mask, the forward pass and the SDSM reduction.
+        bool depth_prepass = depth_prepass_enabled();
+        
+        if (depth_prepass)
+        {
+            {
+                ProfileScope scope(m_profiler, m_profile_depth_prepass);
+                render_depth_prepass();
+            }
+            
+            reduce_scene_depth();
+        }
+        
+        // Resolve the shadows of every visible pixel once into the screen-space mask.
+        if (m_shadow_mask_mode != SHADOW_MASK_OFF)
+        {
+            ProfileScope scope(m_profiler, m_profile_shadow_mask);
+            render_shadow_mask();
+        }
+        
+        // Render scene.
+        {
+            ProfileScope scope(m_profiler, m_profile_scene);
+            render_scene();
+        }
+        
+        if (!depth_prepass)
+            reduce_scene_depth();
+        
+        // Render debug draw.
+        ProfileScope scope(m_profiler, m_profile_debug_draw);
+        m_debug_draw.render(nullptr, m_width, m_height, packet->view_projection);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    inline dw::Camera* active_camera() { return m_debug_mode ? m_debug_camera.get() : m_main_camera.get(); }
+    inline bool cascade_dirty(int i) { return (m_packet->dirty_mask & (1u << i)) != 0; }
+
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    CameraTrackSettings current_track_settings()
+    {
+        CameraTrackSettings settings;
+        
+        settings.lambda = m_csm.m_lambda;
+        settings.near_offset = m_csm.m_near_offset;
+        settings.split_count = m_csm.m_split_count;
+        settings.shadow_map_size = m_csm.m_shadow_map_size;
+        settings.shadow_filter = m_shadow_filter;
+        settings.pcf_kernel = m_pcf_kernel;
+        settings.stable_pssm = m_csm.m_stable_pssm;
+        settings.sdsm = m_csm.m_sdsm;
+        settings.fit_scene_depth = m_csm.m_fit_scene_depth;
+        settings.padding = 0;
+        
+        return settings;
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void apply_track_settings()
+    {
+        const CameraTrackSettings& settings = m_track.m_settings;
+        
+        m_csm.m_lambda = settings.lambda;
+        m_csm.m_stable_pssm = settings.stable_pssm != 0;
+        m_csm.m_sdsm = settings.sdsm != 0;
+        m_csm.m_fit_scene_depth = settings.fit_scene_depth != 0;
+        m_shadow_filter = settings.shadow_filter;
+        m_pcf_kernel = settings.pcf_kernel;
+        m_near_offset = settings.near_offset;
+        
+        if (settings.split_count != m_csm.m_split_count || settings.shadow_map_size != m_csm.m_shadow_map_size || settings.near_offset != m_csm.m_near_offset)
+            m_csm.initialize(m_csm.m_lambda, m_near_offset, settings.split_count, settings.shadow_map_size, m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
+        else
+            m_csm.invalidate();
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    bool start_replay()
+    {
+        if (m_track.frame_count() == 0)
+        {
+            DW_LOG_ERROR("No camera track to replay");
+            return false;
+        }
+        
+        if (m_track_apply_settings)
+            apply_track_settings();
+        
+        m_track_frame = 0;
+        m_track_mode = TRACK_MODE_REPLAY;
+        
+        return true;
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void replay_track()
+    {
+        // One track sample per frame, whatever the frame rate.
+        const CameraTrackFrame& frame = m_track.frame(m_track_frame);
+        m_track_pose = m_track_frame + 1;
+        
+        CameraTrack::apply(m_main_camera.get(), frame);
+        m_csm_uniforms.direction = glm::vec4(frame.light_direction, 0.0f);
+        
+        if (++m_track_frame < m_track.frame_count())
+            return;
+        
+        m_track_frame = 0;
+        
+        if (m_benchmark_state != BENCHMARK_RUNNING)
+        {
+            m_track_mode = TRACK_MODE_LIVE;
+            return;
+        }
+        
+        // Keep looping until every run is done, then wait for the timings of the last frame to be resolved.
+        if (++m_benchmark_run < m_benchmark_runs)
+            return;
+        
+        m_track_mode = TRACK_MODE_LIVE;
+        m_benchmark_state = BENCHMARK_RESOLVING;
+        m_profiler.end_collect(m_profiler.m_frame_index);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void start_benchmark()
+    {
+        if (m_track.frame_count() == 0 && !m_track.load(m_track_path))
+            return;
+        
+        if (!start_replay())
+            return;
+        
+        m_benchmark_state = BENCHMARK_RUNNING;
+        m_benchmark_run = 0;
+        m_benchmark_frame_ms.clear();
+        m_benchmark_scopes.clear();
+        m_profiler.begin_collect(m_profiler.m_frame_index);
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void finish_benchmark()
+    {
+        m_benchmark_state = BENCHMARK_DONE;
+        m_profiler.m_collecting = false;
+        
+        // The first frame time sample spans the frame the benchmark was started from.
+        if (!m_benchmark_frame_ms.empty())
+            m_benchmark_frame_ms.erase(m_benchmark_frame_ms.begin());
+        
+        m_benchmark_frame_stats = Profiler::compute_stats(m_benchmark_frame_ms.data(), (int)m_benchmark_frame_ms.size());
         
-        // Create uniform buffer for global data
-        m_global_ubo = std::make_unique<dw::UniformBuffer>(GL_DYNAMIC_DRAW, sizeof(GlobalUniforms));
+        DW_LOG_INFO("Benchmark: " + std::to_string(m_benchmark_runs) + " runs of " + std::to_string(m_track.frame_count()) + " frames");
+        DW_LOG_INFO("Frame time (ms): avg " + std::to_string(m_benchmark_frame_stats.average) + ", p50 " + std::to_string(m_benchmark_frame_stats.p50) +
+                    ", p95 " + std::to_string(m_benchmark_frame_stats.p95) + ", p99 " + std::to_string(m_benchmark_frame_stats.p99) + ", max " + std::to_string(m_benchmark_frame_stats.max));
         
-        // Create uniform buffer for CSM data
-        m_csm_ubo = std::make_unique<dw::UniformBuffer>(GL_DYNAMIC_DRAW, sizeof(CSMUniforms));
+        for (int i = 0; i < (int)m_profiler.m_collected_cpu.size(); i++)
+        {
+            BenchmarkScope scope;
+            scope.name = m_profiler.m_scopes[i].name;
+            scope.cpu = Profiler::compute_stats(m_profiler.m_collected_cpu[i].data(), (int)m_profiler.m_collected_cpu[i].size());
+            scope.gpu = Profiler::compute_stats(m_profiler.m_collected_gpu[i].data(), (int)m_profiler.m_collected_gpu[i].size());
+            
+            if (scope.cpu.count == 0)
+                continue;
+            
+            DW_LOG_INFO(scope.name + " CPU (ms): avg " + std::to_string(scope.cpu.average) + ", p95 " + std::to_string(scope.cpu.p95) +
+                        (scope.gpu.count ? ", GPU (ms): avg " + std::to_string(scope.gpu.average) + ", p50 " + std::to_string(scope.gpu.p50) +
+                                           ", p95 " + std::to_string(scope.gpu.p95) + ", p99 " + std::to_string(scope.gpu.p99) : std::string()));
+            
+            m_benchmark_scopes.push_back(scope);
+        }
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
 
-		return true;
-	}
+    void shadow_lights_gui()
+    {
+        static const char* items[] = { "256", "512", "1024", "2048" };
+        static const int shadow_map_sizes[] = { 256, 512, 1024, 2048 };
 
-	// -----------------------------------------------------------------------------------------------------------------------------------
+        for (int l = 1; l < MAX_SHADOW_LIGHTS; l++)
+        {
+            ShadowLight& light = m_shadow_lights.m_lights[l];
+            std::string name = "Shadowed Light " + std::to_string(l + 1);
+            bool enabled = light.enabled;
 
-	bool load_mesh()
-	{
-		//m_plane = dw::Mesh::load("plane.obj", &m_device);
-        m_suzanne = dw::Mesh::load("sponza.obj", false);
-		return m_suzanne != nullptr;
-	}
+            ImGui::PushID(l);
 
-	// -----------------------------------------------------------------------------------------------------------------------------------
+            if (ImGui::Checkbox(name.c_str(), &enabled))
+                m_shadow_lights.enable(l, enabled, m_main_camera.get(), m_width, m_height);
 
-	void create_camera()
-	{
-        m_main_camera = std::make_unique<dw::Camera>(60.0f, 0.1f, CAMERA_FAR_PLANE, float(m_width) / float(m_height), glm::vec3(0.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0, -1.0f));
-        m_debug_camera = std::make_unique<dw::Camera>(60.0f, 0.1f, CAMERA_FAR_PLANE * 2.0f, float(m_width) / float(m_height), glm::vec3(0.0f, 5.0f, 20.0f), glm::vec3(0.0f, 0.0, -1.0f));
-	}
+            if (light.enabled)
+            {
+                // Same parameterization as the primary light: the direction always points down.
+                glm::vec2 xz = glm::vec2(light.direction.x, light.direction.z) / -light.direction.y;
 
-	// -----------------------------------------------------------------------------------------------------------------------------------
+                if (ImGui::SliderFloat2("Direction XZ", &xz.x, -1.0f, 1.0f))
+                    light.direction = glm::normalize(glm::vec3(xz.x, -1.0f, xz.y));
 
-    void render_mesh(dw::Mesh* mesh, const ObjectUniforms& transforms, bool use_textures = true)
-	{
-        // Copy new data into UBO.
-        update_object_uniforms(transforms);
+                ImGui::ColorEdit3("Color", &light.color.x);
 
-		// Bind uniform buffers.
-        m_global_ubo->bind_base(0);
-        m_object_ubo->bind_base(1);
+                int item_current = 0;
 
-		// Bind vertex array.
-        mesh->mesh_vertex_array()->bind();
+                for (int i = 0; i < IM_ARRAYSIZE(shadow_map_sizes); i++)
+                {
+                    if (shadow_map_sizes[i] == light.shadow_map_size)
+                        item_current = i;
+                }
 
-		for (uint32_t i = 0; i < mesh->sub_mesh_count(); i++)
-		{
-			dw::SubMesh& submesh = mesh->sub_meshes()[i];
+                // Both change the layout of the shared atlas.
+                bool reconfigure = ImGui::SliderInt("Splits", &light.split_count, 1, 4);
 
-			// Bind texture.
-            if (use_textures)
-                submesh.mat->texture(0)->bind(0);
+                if (ImGui::Combo("Size", &item_current, items, IM_ARRAYSIZE(items)))
+                {
+                    light.shadow_map_size = shadow_map_sizes[item_current];
+                    reconfigure = true;
+                }
+
+                if (reconfigure)
+                    m_shadow_lights.enable(l, true, m_main_camera.get(), m_width, m_height);
+            }
+
+            ImGui::PopID();
+        }
+    }
 
-			// Issue draw call.
-			glDrawElementsBaseVertex(GL_TRIANGLES, submesh.index_count, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * submesh.base_index), submesh.base_vertex);
-		}
-	}
-    
     // -----------------------------------------------------------------------------------------------------------------------------------
-    
-    void render_scene()
+
+    bool load_shadow_config(const char* path)
     {
-        // Update global uniforms.
-        update_global_uniforms(m_global_uniforms);
-        
-        // Update CSM uniforms.
-        update_csm_uniforms(m_csm_uniforms);
-        
-        // Bind and set viewport.
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, m_width, m_height);
-  
-        // Clear default framebuffer.
-        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        // Bind states.
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
+        ShadowConfig config;
         
-        // Bind shader program.
-        m_program->use();
+        if (!config.load(path))
+            return false;
         
-        // Bind shadow map.
-        m_csm.shadow_map()->bind(1);
+        // Defaults of initialize_csm, kept across resizes.
+        m_pssm_lambda = config.lambda;
+        m_cascade_count = config.split_count;
+        m_shadow_map_size = config.shadow_map_size;
+        m_shadow_config = config;
         
-        m_program->set_uniform("s_ShadowMap", 1);
-
-        // Bind uniform buffers.
-        m_csm_ubo->bind_base(2);
+        DW_LOG_INFO("Loaded shadow config " + std::string(path));
         
-        // Draw meshes.
-        //render_mesh(m_plane, m_plane_transforms);
-        render_mesh(m_suzanne, m_suzanne_transforms, false);
+        return true;
     }
     
     // -----------------------------------------------------------------------------------------------------------------------------------
     
-    void render_shadow_map()
+    void sync_density_tuner()
     {
-        // Bind states.
-        glEnable(GL_DEPTH_TEST);
-        glDisable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
+        TexelDensityTuner& tuner = m_density_tuner;
         
-        // Bind shader program.
-        m_csm_program->use();
+        tuner.m_fov = m_main_camera->m_fov;
+        tuner.m_near = m_main_camera->m_near;
+        tuner.m_far = m_main_camera->m_far;
+        tuner.m_width = m_width;
+        tuner.m_height = m_height;
         
-        for (int i = 0; i < m_csm.frustum_split_count(); i++)
-        {
-            // Update global uniforms.
-			m_global_uniforms.crop = m_csm.split_view_proj(i);
-            
-            update_global_uniforms(m_global_uniforms);
-            
-            // Bind and set viewport.
-            m_csm.framebuffers()[i]->bind();
-            glViewport(0, 0, m_csm.shadow_map_size(), m_csm.shadow_map_size());
-            
-            // Clear default framebuffer.
-            glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            
-            // Draw meshes. Disable textures because we don't need them here.
-			//m_device.bind_rasterizer_state(m_rs);
-           // render_mesh(m_plane, m_plane_transforms, false);
-
-            render_mesh(m_suzanne, m_suzanne_transforms, false);
-        }
+        // Candidates are solved exactly like the primary light.
+        tuner.m_csm.m_near_offset = m_csm.m_near_offset;
+        tuner.m_csm.m_stable_pssm = m_csm.m_stable_pssm;
+        tuner.m_csm.m_sdsm = m_csm.m_sdsm;
+        tuner.m_csm.m_depth_format = m_csm.m_depth_format;
+        tuner.m_csm.m_memory_budget = m_csm.m_memory_budget;
+        tuner.m_csm.m_fit_scene_depth = m_csm.m_fit_scene_depth;
+        
+        if (m_csm.m_scene_bounds_valid)
+            tuner.m_csm.set_scene_bounds(m_csm.m_caster_min, m_csm.m_caster_max, m_csm.m_receiver_min, m_csm.m_receiver_max);
     }
-
-	// -----------------------------------------------------------------------------------------------------------------------------------
-
-	void update_object_uniforms(const ObjectUniforms& transform)
-	{
-        void* ptr = m_object_ubo->map(GL_WRITE_ONLY);
-		memcpy(ptr, &transform, sizeof(ObjectUniforms));
-        m_object_ubo->unmap();
-	}
     
     // -----------------------------------------------------------------------------------------------------------------------------------
     
-    void update_csm_uniforms(const CSMUniforms& csm)
+    void capture_texel_density()
     {
-        void* ptr = m_csm_ubo->map(GL_WRITE_ONLY);
-        memcpy(ptr, &csm, sizeof(CSMUniforms));
-        m_csm_ubo->unmap();
+        uint32_t pose = m_sdsm.m_result_tag;
+        
+        // Reductions started before the capture, or with the histogram off, carry nothing to attribute to a track frame.
+        if (pose == 0 || pose > m_track.frame_count() || !m_sdsm.histogram())
+            return;
+        
+        m_density_tuner.add_sample(m_track.frame(pose - 1), m_sdsm.depth_range(), m_sdsm.histogram());
     }
     
     // -----------------------------------------------------------------------------------------------------------------------------------
     
-    void update_global_uniforms(const GlobalUniforms& global)
+    void texel_density_gui()
     {
-        void* ptr = m_global_ubo->map(GL_WRITE_ONLY);
-        memcpy(ptr, &global, sizeof(GlobalUniforms));
-        m_global_ubo->unmap();
+        TexelDensityTuner& tuner = m_density_tuner;
+        
+        ImGui::SliderFloat("Target Texels per Pixel", &tuner.m_target_density, 0.25f, 4.0f);
+        ImGui::SliderFloat("Percentile", &tuner.m_percentile, 0.0f, 0.5f);
+        ImGui::SliderFloat("Closest Receiver", &tuner.m_min_distance, 0.1f, 10.0f);
+        ImGui::SliderInt("Max Splits", &tuner.m_max_split_count, 1, 4);
+        
+        int cascade_cost = int(tuner.m_cascade_cost / (1024 * 1024));
+        
+        if (ImGui::SliderInt("Cascade Cost (MB)", &cascade_cost, 0, 16))
+            tuner.m_cascade_cost = size_t(cascade_cost) * 1024 * 1024;
+        
+        if (m_density_capture)
+        {
+            ImGui::Text("Capturing depth, %u frames...", tuner.sample_count());
+            return;
+        }
+        
+        // Poses alone, receivers at every distance.
+        if (ImGui::Button("Use Track Poses"))
+        {
+            tuner.clear();
+            tuner.add_track(m_track);
+            m_density_analyzed = false;
+            m_density_tuned = false;
+        }
+        
+        ImGui::SameLine();
+        
+        // Replays the track with the depth reduction on and keeps the depth histogram of every frame read back.
+        if (ImGui::Button("Capture Track Depth") && start_replay())
+        {
+            tuner.clear();
+            m_density_capture = true;
+            m_density_analyzed = false;
+            m_density_tuned = false;
+        }
+        
+        ImGui::Text("%u poses", tuner.sample_count());
+        
+        if (tuner.sample_count() == 0)
+            return;
+        
+        if (ImGui::Button("Analyze Current Settings"))
+        {
+            sync_density_tuner();
+            m_density_analyzed = tuner.evaluate(m_csm.m_lambda, m_csm.m_split_count, m_csm.m_shadow_map_size, m_density_result);
+        }
+        
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Tune"))
+        {
+            sync_density_tuner();
+            tuner.tune(m_shadow_config);
+            m_density_tuned = true;
+        }
+        
+        if (m_density_analyzed)
+        {
+            for (int i = 0; i < m_csm.m_split_count; i++)
+                ImGui::Text("Cascade %d: %.2f texels per pixel", i + 1, m_density_result.densities[i]);
+        }
+        
+        if (m_density_tuned)
+        {
+            const TexelDensityResult& result = m_shadow_config.result;
+            
+            ImGui::Text("%s: %d splits of %d, lambda %.2f, %.2f texels per pixel, %.2f MB", result.min_density >= tuner.m_target_density ? "Tuned" : "Closest",
+                        m_shadow_config.split_count, m_shadow_config.shadow_map_size, m_shadow_config.lambda, result.min_density, result.memory / (1024.0f * 1024.0f));
+            
+            if (ImGui::Button("Apply"))
+                m_csm.initialize(m_shadow_config.lambda, m_csm.m_near_offset, m_shadow_config.split_count, m_shadow_config.shadow_map_size, m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
+        }
+        
+        ImGui::InputText("Config Path", m_shadow_config_path, sizeof(m_shadow_config_path));
+        
+        if (m_density_tuned)
+        {
+            if (ImGui::Button("Save Config"))
+                m_shadow_config.save(m_shadow_config_path);
+            
+            ImGui::SameLine();
+        }
+        
+        if (ImGui::Button("Load Config") && load_shadow_config(m_shadow_config_path))
+            m_csm.initialize(m_pssm_lambda, m_csm.m_near_offset, m_cascade_count, m_shadow_map_size, m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
     }
     
     // -----------------------------------------------------------------------------------------------------------------------------------
     
-    void update_transforms(dw::Camera* camera)
+    void track_gui()
     {
-        // Update camera matrices.
-        m_global_uniforms.view = camera->m_view;
-        m_global_uniforms.projection = camera->m_projection;
+        ImGui::InputText("Track Path", m_track_path, sizeof(m_track_path));
+        
+        if (m_track_mode == TRACK_MODE_RECORD)
+        {
+            if (ImGui::Button("Stop Recording"))
+            {
+                m_track.end_record();
+                m_track_mode = TRACK_MODE_LIVE;
+                m_track.save(m_track_path);
+            }
+            
+            ImGui::SameLine();
+            ImGui::Text("%u frames", m_track.frame_count());
+            return;
+        }
         
-        // Update CSM farbounds.
-        m_csm_uniforms.num_cascades = m_csm.frustum_split_count();
+        if (m_track_mode == TRACK_MODE_REPLAY)
+        {
+            if (ImGui::Button("Stop Replay"))
+            {
+                m_track_mode = TRACK_MODE_LIVE;
+                m_benchmark_state = BENCHMARK_IDLE;
+                m_profiler.m_collecting = false;
+            }
+            
+            ImGui::SameLine();
+            
+            if (m_benchmark_state == BENCHMARK_RUNNING)
+                ImGui::Text("Run %d/%d, frame %u/%u", m_benchmark_run + 1, m_benchmark_runs, m_track_frame, m_track.frame_count());
+            else
+                ImGui::Text("Frame %u/%u", m_track_frame, m_track.frame_count());
+            
+            return;
+        }
         
-        for (int i = 0; i < m_csm.frustum_split_count(); i++)
+        if (ImGui::Button("Record"))
         {
-            m_csm_uniforms.far_bounds[i].far_bound = m_csm.far_bound(i);
-            m_csm_uniforms.texture_matrices[i] = m_csm.texture_matrix(i);
+            m_track.begin_record(current_track_settings());
+            m_track_mode = TRACK_MODE_RECORD;
         }
         
-        // Update plane transforms.
-        m_plane_transforms.model = glm::mat4(1.0f);
-
-        // Update suzanne transforms.
-        m_suzanne_transforms.model = glm::mat4(1.0f);
-        m_suzanne_transforms.model = glm::translate(m_suzanne_transforms.model, glm::vec3(0.0f, 3.0f, 0.0f));
-       // m_suzanne_transforms.model = glm::rotate(m_suzanne_transforms.model, (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f));
-        m_suzanne_transforms.model = glm::scale(m_suzanne_transforms.model, glm::vec3(0.1f));
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Load"))
+            m_track.load(m_track_path);
+        
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Replay"))
+            start_replay();
+        
+        ImGui::Text("Track: %u frames at %.0f Hz", m_track.frame_count(), 1.0 / m_track.m_timestep);
+        ImGui::Checkbox("Apply Track Settings", &m_track_apply_settings);
+        ImGui::SliderInt("Benchmark Runs", &m_benchmark_runs, 1, 10);
+        
+        if (m_benchmark_state == BENCHMARK_RESOLVING)
+            ImGui::Text("Resolving GPU timings...");
+        else if (ImGui::Button("Run Benchmark"))
+            start_benchmark();
+        
+        if (m_benchmark_state != BENCHMARK_DONE)
+            return;
+        
+        ImGui::Text("Frame: avg %.3f, p50 %.3f, p95 %.3f, p99 %.3f ms", (float)m_benchmark_frame_stats.average, (float)m_benchmark_frame_stats.p50,
+                    (float)m_benchmark_frame_stats.p95, (float)m_benchmark_frame_stats.p99);
+        
+        for (const auto& scope : m_benchmark_scopes)
+        {
+            if (scope.gpu.count > 0)
+                ImGui::Text("%s: GPU p50 %.3f, p95 %.3f, p99 %.3f ms", scope.name.c_str(), (float)scope.gpu.p50, (float)scope.gpu.p95, (float)scope.gpu.p99);
+            else
+                ImGui::Text("%s: CPU p50 %.3f, p95 %.3f, p99 %.3f ms", scope.name.c_str(), (float)scope.cpu.p50, (float)scope.cpu.p95, (float)scope.cpu.p99);
+        }
     }
-
+    
     // -----------------------------------------------------------------------------------------------------------------------------------
     
     void update_camera()
@@ -727,6 +2415,84 @@ private:
             m_csm_uniforms.options.z = blend;
 
 			ImGui::Checkbox("Stable", &m_csm.m_stable_pssm);
+            
+            if (ImGui::Checkbox("Fit Depth To Scene", &m_csm.m_fit_scene_depth))
+                m_csm.invalidate();
+            ImGui::Checkbox("SIMD Solver", &m_csm_batch.m_simd);
+            ImGui::Checkbox("Layered Shadow Pass", &m_layered_shadows);
+            ImGui::Checkbox("Multi-Draw Indirect", &m_indirect_draws);
+            
+            if (ImGui::Checkbox("Caster Culling", &m_caster_culling))
+                m_csm.invalidate();
+            
+            // Turning the pipeline off drops the packet the workers already built, whose update consumed the dirty cascades.
+            if (ImGui::Checkbox("Pipelined Frames", &m_pipelined_frames))
+                m_shadow_lights.invalidate();
+            
+            ImGui::Text("Main Thread: %.3f ms (Submission: %.3f ms)", (float)m_profiler.stats(m_profile_frame, false).average, (float)m_profiler.stats(m_profile_submit, false).average);
+            ImGui::Text("Frame Packet Jobs: %.3f ms on %d threads", (float)m_frame_build_ms, m_jobs.thread_count());
+            
+            static const char* filters[] = { "PCF 3x3", "VSM", "EVSM" };
+            ImGui::Combo("Shadow Filter", &m_shadow_filter, filters, IM_ARRAYSIZE(filters));
+            
+            if (m_shadow_filter == SHADOW_FILTER_PCF)
+            {
+                static const char* kernels[] = { "3x3 (9 fetches)", "Bilinear (1 fetch)", "Gather (1 fetch)", "Poisson 16 (16 fetches)" };
+                ImGui::Combo("PCF Kernel", &m_pcf_kernel, kernels, IM_ARRAYSIZE(kernels));
+                
+                if (m_pcf_kernel == PCF_KERNEL_POISSON)
+                    ImGui::SliderFloat("Poisson Radius", &m_poisson_radius, 0.5f, 4.0f);
+            }
+            else
+            {
+                // Blur settings only apply to cascades resolved from now on, force a full refresh.
+                if (ImGui::SliderInt("Blur Radius", &m_evsm.m_blur_radius, 0, EVSM_MAX_BLUR_RADIUS))
+                    m_csm.invalidate();
+                
+                ImGui::SliderFloat("Light Bleeding Reduction", &m_evsm.m_light_bleeding_reduction, 0.0f, 0.9f);
+                ImGui::Text("Shadow Filter Resolve: %.3f ms", (float)m_profiler.stats(m_profile_shadow_filter, true).average);
+            }
+            
+            static const char* shadow_mask_modes[] = { "Off (Forward)", "Full Resolution", "Half Resolution", "Quarter Resolution" };
+            
+            if (ImGui::Combo("Shadow Mask", &m_shadow_mask_mode, shadow_mask_modes, IM_ARRAYSIZE(shadow_mask_modes)))
+                create_shadow_mask_target();
+            
+            if (m_shadow_mask_mode != SHADOW_MASK_OFF)
+                ImGui::Text("Shadow Mask Pass: %.3f ms", (float)m_profiler.stats(m_profile_shadow_mask, true).average);
+            
+            ImGui::Checkbox("Depth Pre-pass", &m_depth_prepass);
+            
+            if (depth_prepass_enabled())
+                ImGui::Text("Depth Pre-pass: %.3f ms", (float)m_profiler.stats(m_profile_depth_prepass, true).average);
+            
+            ImGui::Text("Scene Pass: %.3f ms", (float)m_profiler.stats(m_profile_scene, true).average);
+            
+            // Overdraw of the forward pass: shaded fragments per pixel, 1.0 once the pre-pass rejects every hidden fragment.
+            float pixels = float(m_width) * float(m_height);
+            ImGui::Text("Shaded Fragments: %llu (%.2f/px) without pre-pass, %llu (%.2f/px) with pre-pass", (unsigned long long)m_shaded_fragments[0], m_shaded_fragments[0] / pixels,
+                        (unsigned long long)m_shaded_fragments[1], m_shaded_fragments[1] / pixels);
+            ImGui::Checkbox("CPU Shadow Maps", &m_cpu_shadows);
+            ImGui::Checkbox("SDSM", &m_csm.m_sdsm);
+            ImGui::Checkbox("Dirty Tracking", &m_csm.m_dirty_tracking);
+            
+            for (int i = 0; i < m_csm.m_split_count; i++)
+            {
+                std::string name = "Cascade " + std::to_string(i + 1) + " Refresh Interval";
+                ImGui::SliderInt(name.c_str(), &m_csm.m_refresh_intervals[i], 1, 8);
+            }
+            
+            if (m_csm.m_sdsm)
+            {
+                ImGui::Checkbox("SDSM Histogram", &m_sdsm.m_histogram_enabled);
+                ImGui::Text("Visible Depth Range: %.2f - %.2f", m_csm.m_depth_range.min_depth, m_csm.m_depth_range.max_depth);
+            }
+            
+            if (ImGui::Button("Validate GPU Shadow Maps"))
+                validate_shadow_map();
+            
+            for (int i = 0; i < m_shadow_lights.m_cascade_count; i++)
+                ImGui::Text("Cascade %d Mismatch: %.3f%%", i + 1, m_validation_error[i] * 100.0f);
             ImGui::Checkbox("Debug Camera", &m_debug_mode);
             ImGui::Checkbox("Show Frustum Splits", &m_show_frustum_splits);
             ImGui::Checkbox("Show Cascade Frustum", &m_show_cascade_frustums);
@@ -739,13 +2505,17 @@ private:
             if (split_count != m_csm.m_split_count)
                 m_csm.initialize(m_csm.m_lambda, m_csm.m_near_offset, split_count, m_csm.m_shadow_map_size, m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
             
-			float near_offset = m_csm.m_near_offset;
-			ImGui::SliderFloat("Near Offset", &near_offset, 100.0f, 1000.0f);
-
-			if (m_near_offset != near_offset)
+			// Cascades fitted to the scene bounds take their depth range from the casters, the near offset only applies without.
+			if (!m_csm.depth_clamp())
 			{
-				m_near_offset = near_offset;
-				m_csm.initialize(m_csm.m_lambda, m_near_offset, split_count, m_csm.m_shadow_map_size, m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
+				float near_offset = m_csm.m_near_offset;
+				ImGui::SliderFloat("Near Offset", &near_offset, 100.0f, 1000.0f);
+
+				if (m_near_offset != near_offset)
+				{
+					m_near_offset = near_offset;
+					m_csm.initialize(m_csm.m_lambda, m_near_offset, split_count, m_csm.m_shadow_map_size, m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
+				}
 			}
 
 			ImGui::SliderFloat("Light Direction X", &m_light_dir_x, 0.0f, 1.0f);
@@ -754,14 +2524,82 @@ private:
 			m_csm_uniforms.direction = glm::vec4(glm::vec3(m_light_dir_x, -1.0f, m_light_dir_z), 0.0f);
 			m_csm_uniforms.direction = glm::normalize(m_csm_uniforms.direction);
 
+            shadow_lights_gui();
+
             static const char* items[] = { "256", "512", "1024", "2048" };
             static const int shadow_map_sizes[] = { 256, 512, 1024, 2048 };
-            static int item_current = 3;
-            ImGui::Combo("Shadow Map Size", &item_current, items, IM_ARRAYSIZE(items));
+            int item_current = 0;
             
-            if (shadow_map_sizes[item_current] != m_csm.m_shadow_map_size)
+            // Follows the CSM, the size may also be set by a camera track.
+            for (int i = 0; i < IM_ARRAYSIZE(shadow_map_sizes); i++)
+            {
+                if (shadow_map_sizes[i] == m_csm.m_shadow_map_size)
+                    item_current = i;
+            }
+            
+            if (ImGui::Combo("Shadow Map Size", &item_current, items, IM_ARRAYSIZE(items)))
                 m_csm.initialize(m_csm.m_lambda, m_csm.m_near_offset, m_csm.m_split_count, shadow_map_sizes[item_current], m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
             
+            static const char* depth_formats[] = { "D16", "D24", "D32F" };
+            bool reallocate = ImGui::Combo("Depth Format", &m_csm.m_depth_format, depth_formats, IM_ARRAYSIZE(depth_formats));
+            
+            // Budget in MB, zero to keep every cascade at full resolution.
+            int budget = int(m_csm.m_memory_budget / (1024 * 1024));
+            
+            if (ImGui::SliderInt("Memory Budget (MB)", &budget, 0, 128))
+            {
+                m_csm.m_memory_budget = size_t(budget) * 1024 * 1024;
+                reallocate = true;
+            }
+            
+            if (reallocate)
+                m_csm.initialize(m_csm.m_lambda, m_csm.m_near_offset, m_csm.m_split_count, m_csm.m_shadow_map_size, m_main_camera.get(), m_width, m_height, glm::vec3(m_csm_uniforms.direction));
+            
+            ImGui::Text("Shadow Atlas: %dx%d, %.2f MB", m_csm.m_atlas.m_width, m_csm.m_atlas.m_height, m_csm.memory_used() / (1024.0f * 1024.0f));
+            ImGui::Text("Render Targets: %.2f MB in use, %.2f MB idle, %.2f MB peak", m_render_targets.m_used_bytes / (1024.0f * 1024.0f),
+                        m_render_targets.idle_bytes() / (1024.0f * 1024.0f), m_render_targets.m_peak_bytes / (1024.0f * 1024.0f));
+            ImGui::Text("Render Target Allocations: %u, Reuses: %u", m_render_targets.m_allocations, m_render_targets.m_reuses);
+            
+            for (int i = 0; i < m_shadow_lights.m_cascade_count; i++)
+            {
+                int size = m_shadow_lights.cascade_size(i);
+                int max_size = m_shadow_lights.max_cascade_size(i);
+                
+                if (size < max_size)
+                    ImGui::Text("Cascade %d: %dx%d (reduced from %dx%d by the budget)", i + 1, size, size, max_size, max_size);
+                else
+                    ImGui::Text("Cascade %d: %dx%d", i + 1, size, size);
+            }
+            
+            ImGui::Text("Frame Time: %.2f ms", (float)m_delta);
+            ImGui::Text("Shadow Draw Calls: %u", m_shadow_draw_calls);
+            ImGui::Text("Cascades Rendered: %d/%d", m_shadow_cascades_rendered, m_shadow_lights.m_cascade_count);
+            
+            // The LOD of a cascade only shows once it is redrawn, which dirty tracking leaves to the next change of its crop.
+            if (ImGui::Checkbox("Shadow Proxies", &m_shadow_proxies))
+                m_shadow_lights.invalidate();
+            
+            if (ImGui::SliderFloat("Proxy Tolerance (texels)", &m_shadow_proxy_tolerance, 0.25f, 4.0f))
+                m_shadow_lights.invalidate();
+            
+            for (int i = 0; i < m_shadow_lights.m_cascade_count; i++)
+            {
+                ImGui::Text("Cascade %d: %.3f units/texel, LOD %d, %u/%u triangles", i + 1, m_shadow_texel_sizes[i], m_shadow_lods[i],
+                            m_shadow_triangles[i], m_shadow_full_triangles[i]);
+            }
+            
+            if (m_packet && m_packet->caster_culling)
+            {
+                for (int i = 0; i < m_packet->casters.m_cascade_count; i++)
+                {
+                    const CasterCullStats& stats = m_packet->casters.m_stats[i];
+                    ImGui::Text("Cascade %d Culled: %u/%u draws, %u/%u triangles", i + 1, stats.culled_draws, stats.culled_draws + stats.visible_draws,
+                                stats.culled_triangles, stats.culled_triangles + stats.visible_triangles);
+                }
+            }
+            ImGui::Text("Uniform Upload: %.2f KB (%s)", m_uniform_ring.bytes_uploaded() / 1024.0f, m_uniform_ring.m_persistent ? "persistent" : "unsynchronized");
+            ImGui::Text("Uniform Stalls: %u (%.2f ms)", m_uniform_ring.stalls(), (float)m_uniform_ring.stall_ms());
+            
             static int current_view = 0;
             ImGui::RadioButton("Scene", &current_view, 0);
             
@@ -770,21 +2608,104 @@ private:
                 std::string name = "Cascade " + std::to_string(i + 1);
                 ImGui::RadioButton(name.c_str(), &current_view, i + 1);
             }
+            
+            ImGui::Checkbox("Show Profiler", &m_show_profiler);
+            
+            if (ImGui::CollapsingHeader("Camera Track"))
+                track_gui();
+            
+            if (ImGui::CollapsingHeader("Texel Density"))
+                texel_density_gui();
         }
         ImGui::End();
+        
+        if (m_show_profiler)
+            profiler_gui();
     }
     
     // -----------------------------------------------------------------------------------------------------------------------------------
     
-    void render_debug_view()
+    void profiler_gui()
     {
-        for (int i = 0; i < m_csm.m_split_count; i++)
+        if (ImGui::Begin("Profiler", &m_show_profiler))
         {
-            FrustumSplit& split = m_csm.frustum_splits()[i];
+            ImGui::Text("Last %d frames, %u dropped GPU timings", m_profiler.m_history_count, m_profiler.m_dropped_frames);
+            
+            ProfilerScope& frame = m_profiler.m_scopes[m_profile_frame];
+            int offset = m_profiler.m_history_count == PROFILER_HISTORY ? m_profiler.m_history_head : 0;
+            ImGui::PlotLines("Frame CPU (ms)", frame.cpu_history, m_profiler.m_history_count, offset, nullptr, 0.0f, 33.3f, ImVec2(0, 60));
+            
+            ImGui::Columns(7, "Timings");
+            ImGui::Text("Scope");    ImGui::NextColumn();
+            ImGui::Text("CPU Avg");  ImGui::NextColumn();
+            ImGui::Text("CPU P95");  ImGui::NextColumn();
+            ImGui::Text("GPU Avg");  ImGui::NextColumn();
+            ImGui::Text("GPU P50");  ImGui::NextColumn();
+            ImGui::Text("GPU P95");  ImGui::NextColumn();
+            ImGui::Text("GPU P99");  ImGui::NextColumn();
+            ImGui::Separator();
+            
+            for (int i = 0; i < (int)m_profiler.m_scopes.size(); i++)
+            {
+                ProfilerStats cpu = m_profiler.stats(i, false);
+                
+                // Hide scopes that did not run lately, e.g. cascades beyond the split count.
+                if (cpu.count == 0)
+                    continue;
+                
+                ImGui::Text("%s", m_profiler.m_scopes[i].name.c_str()); ImGui::NextColumn();
+                ImGui::Text("%.3f", (float)cpu.average);                  ImGui::NextColumn();
+                ImGui::Text("%.3f", (float)cpu.p95);                      ImGui::NextColumn();
+                
+                if (m_profiler.m_scopes[i].gpu)
+                {
+                    ProfilerStats gpu = m_profiler.stats(i, true);
+                    ImGui::Text("%.3f", (float)gpu.average); ImGui::NextColumn();
+                    ImGui::Text("%.3f", (float)gpu.p50);     ImGui::NextColumn();
+                    ImGui::Text("%.3f", (float)gpu.p95);     ImGui::NextColumn();
+                    ImGui::Text("%.3f", (float)gpu.p99);     ImGui::NextColumn();
+                }
+                else
+                {
+                    for (int j = 0; j < 4; j++)
+                    {
+                        ImGui::Text("-");
+                        ImGui::NextColumn();
+                    }
+                }
+            }
+            
+            ImGui::Columns(1);
+            ImGui::Separator();
             
+            // Per-frame rows for offline analysis.
+            ImGui::InputText("CSV Path", m_capture_path, sizeof(m_capture_path));
+            
+            if (m_profiler.capturing())
+            {
+                if (ImGui::Button("Stop CSV Capture"))
+                    m_profiler.stop_capture();
+                
+                ImGui::SameLine();
+                ImGui::Text("%u rows", m_profiler.m_csv_rows);
+            }
+            else if (ImGui::Button("Start CSV Capture"))
+                m_profiler.start_capture(m_capture_path);
+        }
+        ImGui::End();
+    }
+    
+    // -----------------------------------------------------------------------------------------------------------------------------------
+    
+    void render_debug_view()
+    {
+        for (int i = 0; i < m_packet->cascade_count; i++)
+        {
             // Render frustum splits.
-            if (m_show_frustum_splits)
+            if (m_show_frustum_splits && i < m_packet->split_count)
             {
+                const FrustumSplit& split = m_packet->splits[i];
+                
                 m_debug_draw.line(split.corners[0], split.corners[3], glm::vec3(1.0f));
                 m_debug_draw.line(split.corners[3], split.corners[2], glm::vec3(1.0f));
                 m_debug_draw.line(split.corners[2], split.corners[1], glm::vec3(1.0f));
@@ -803,11 +2724,11 @@ private:
             
             // Render shadow frustums.
             if (m_show_cascade_frustums)
-                m_debug_draw.frustum(m_csm.split_view_proj(i), glm::vec3(1.0f, 0.0f, 0.0f));
+                m_debug_draw.frustum(m_packet->crop_matrices[i], glm::vec3(1.0f, 0.0f, 0.0f));
         }
         
         if (m_debug_mode)
-            m_debug_draw.frustum(m_main_camera->m_projection, m_main_camera->m_view, glm::vec3(0.0f, 1.0f, 0.0f));
+            m_debug_draw.frustum(m_packet->main_projection, m_packet->main_view, glm::vec3(0.0f, 1.0f, 0.0f));
     }
     
     // -----------------------------------------------------------------------------------------------------------------------------------
@@ -817,17 +2738,39 @@ private:
 	float m_clear_color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
 
 	// General GPU resources.
-    std::unique_ptr<dw::Shader> m_vs;
-	std::unique_ptr<dw::Shader> m_fs;
-	std::unique_ptr<dw::Program> m_program;
-	std::unique_ptr<dw::UniformBuffer> m_object_ubo;
-    std::unique_ptr<dw::UniformBuffer> m_csm_ubo;
-    std::unique_ptr<dw::UniformBuffer> m_global_ubo;
+    ProgramCache m_program_cache;
+    RenderTargetPool m_render_targets; // Every texture rendered to, except the default framebuffer.
+	std::unique_ptr<CachedProgram> m_program;
+	UniformRing m_uniform_ring;
+    GLintptr m_csm_uniforms_offset = 0;
+    GLintptr m_global_uniforms_offset = 0;
+    GLintptr m_shadow_uniforms_offset = 0;
+    
+    // Scene render target.
+    RenderTarget* m_scene_color = nullptr;
+    RenderTarget* m_scene_depth = nullptr;
+    std::unique_ptr<dw::Framebuffer> m_scene_fbo;
+    bool m_blit_depth = false; // Default framebuffer has the depth format of the scene target.
+    
+    // Screen-space shadow mask.
+    RenderTarget* m_shadow_mask = nullptr;
+    RenderTarget* m_shadow_mask_depth = nullptr;
+    std::unique_ptr<dw::Framebuffer> m_shadow_mask_fbo;
+    std::unique_ptr<CachedProgram> m_shadow_mask_program;
+    GLuint m_shadow_mask_vao = 0;
+    int m_shadow_mask_mode = SHADOW_MASK_OFF;
+    
+    // Depth pre-pass, forced on by the shadow mask. Fragments shaded by the forward pass, without and with the pre-pass.
+    bool m_depth_prepass = false;
+    GLuint m_fragment_queries[FRAGMENT_QUERY_LATENCY] = { 0 };
+    bool m_fragment_query_prepass[FRAGMENT_QUERY_LATENCY] = { false };
+    bool m_fragment_query_pending[FRAGMENT_QUERY_LATENCY] = { false };
+    int m_fragment_query_index = 0;
+    uint64_t m_shaded_fragments[2] = { 0, 0 };
     
     // CSM shaders.
-    std::unique_ptr<dw::Shader> m_csm_vs;
-    std::unique_ptr<dw::Shader> m_csm_fs;
-    std::unique_ptr<dw::Program> m_csm_program;
+    std::unique_ptr<CachedProgram> m_csm_program;
+    std::unique_ptr<CachedProgram> m_csm_layered_program;
 
     // Camera.
     std::unique_ptr<dw::Camera> m_main_camera;
@@ -836,15 +2779,78 @@ private:
 	// Assets.
 	dw::Mesh* m_plane;
     dw::Mesh* m_suzanne;
+    IndirectMesh m_suzanne_draws;
+    CasterBVH m_caster_bvh;
+    bool m_caster_culling = true;
+    
+    // Frame pipeline.
+    JobSystem m_jobs;
+    JobGraph m_frame_graph;
+    FramePipeline<FramePacket> m_frame_pipeline;
+    FramePacket* m_packet = nullptr; // Packet being submitted.
+    int m_build_slot = 0;
+    std::chrono::high_resolution_clock::time_point m_build_start;
+    bool m_pipelined_frames = true;
+    double m_frame_build_ms = 0.0;
+    
+    // Profiling.
+    Profiler m_profiler;
+    int m_profile_frame = -1;
+    int m_profile_packet_wait = -1;
+    int m_profile_submit = -1;
+    int m_profile_debug_view = -1;
+    int m_profile_shadow_maps = -1;
+    int m_profile_cascades[MAX_SHADOW_CASCADES];
+    int m_profile_shadow_filter = -1;
+    int m_profile_depth_prepass = -1;
+    int m_profile_shadow_mask = -1;
+    int m_profile_scene = -1;
+    int m_profile_debug_draw = -1;
+    bool m_show_profiler = true;
+    char m_capture_path[256] = "csm_profile.csv";
+    
+    // Camera track and benchmark.
+    CameraTrack m_track;
+    int m_track_mode = TRACK_MODE_LIVE;
+    uint32_t m_track_frame = 0;
+    uint32_t m_track_pose = 0; // Track frame the camera was last set to plus one.
+    bool m_track_apply_settings = true;
+    char m_track_path[256] = "flythrough.track";
+    int m_benchmark_state = BENCHMARK_IDLE;
+    int m_benchmark_runs = 3;
+    int m_benchmark_run = 0;
+    bool m_benchmark_frame = false; // The frame being recorded is part of the benchmark.
+    std::vector<float> m_benchmark_frame_ms;
+    ProfilerStats m_benchmark_frame_stats;
+    std::vector<BenchmarkScope> m_benchmark_scopes;
+    uint64_t m_frame_count = 0;
+    std::chrono::high_resolution_clock::time_point m_last_update_start;
+    
+    // Texel density analysis and shadow settings tuning.
+    TexelDensityTuner m_density_tuner;
+    ShadowConfig m_shadow_config;
+    TexelDensityResult m_density_result = {}; // Current settings, from the last analysis.
+    bool m_density_analyzed = false;
+    bool m_density_tuned = false;
+    bool m_density_capture = false; // Depth of the replayed track frames is being captured.
+    char m_shadow_config_path[256] = "shadows.cfg";
+    
+    // Shadow filtering.
+    EVSM m_evsm;
+    int m_shadow_filter = SHADOW_FILTER_PCF;
+    int m_pcf_kernel = PCF_KERNEL_3X3;
+    float m_poisson_radius = 1.5f;
+    bool m_indirect_draws = true;
 
 	// Uniforms.
-	ObjectUniforms m_plane_transforms;
-    ObjectUniforms m_suzanne_transforms;
-    GlobalUniforms m_global_uniforms;
-    CSMUniforms m_csm_uniforms;
+    CSMUniforms m_csm_uniforms; // Light direction and options edited by the GUI, the rest is packed into every frame packet.
+    ShadowUniforms m_shadow_uniforms;
 
 	// Cascaded Shadow Mapping.
 	CSM m_csm;
+	ShadowLights m_shadow_lights; // Light 0 is m_csm, the secondary lights share its atlas.
+	CSMBatch m_csm_batch;
+    SDSMReduction m_sdsm;
     
     // Camera controls.
     bool m_mouse_look = false;
@@ -865,6 +2871,30 @@ private:
     // Debug options.
     bool m_show_frustum_splits = false;
     bool m_show_cascade_frustums = false;
+    
+    // Shadow pass options.
+    bool m_layered_shadows = false;
+    bool m_cpu_shadows = false;
+    
+    // Software rasterizer.
+    SoftwareRasterizer m_software_rasterizer;
+    std::vector<RasterizerDraw> m_rasterizer_draws;
+    
+    // Shadow proxies, level per cascade of the last shadow pass.
+    ShadowProxy m_shadow_proxy;
+    bool m_shadow_proxies = true;
+    float m_shadow_proxy_tolerance = 1.0f;
+    int m_shadow_lods[MAX_SHADOW_CASCADES] = { 0 };
+    float m_shadow_texel_sizes[MAX_SHADOW_CASCADES] = { 0.0f };
+    uint32_t m_shadow_triangles[MAX_SHADOW_CASCADES] = { 0 };
+    uint32_t m_shadow_full_triangles[MAX_SHADOW_CASCADES] = { 0 };
+    std::vector<uint32_t> m_layered_cascade_masks;
+    float m_validation_error[MAX_SHADOW_CASCADES] = { 0.0f };
+    
+    // Stats.
+    uint32_t m_draw_calls = 0;
+    uint32_t m_shadow_draw_calls = 0;
+    int m_shadow_cascades_rendered = 0;
 };
 
 DW_DECLARE_MAIN(Sample)
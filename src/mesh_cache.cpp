@@ -0,0 +1,354 @@
+#include "mesh_cache.h"
+#include <macros.h>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + MESH_CACHE_ALIGNMENT - 1) & ~uint64_t(MESH_CACHE_ALIGNMENT - 1);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+#if defined(_WIN32)
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		m_file = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!m_mapping)
+	{
+		close();
+		return false;
+	}
+
+	m_data = (uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	m_size = (size_t)size.QuadPart;
+#else
+	m_file = ::open(path.c_str(), O_RDONLY);
+
+	if (m_file < 0)
+		return false;
+
+	struct stat info;
+
+	if (fstat(m_file, &info) != 0 || info.st_size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+
+	if (data == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	m_data = (uint8_t*)data;
+	m_size = (size_t)info.st_size;
+#endif
+
+	if (!m_data)
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void MappedFile::close()
+{
+#if defined(_WIN32)
+	if (m_data)
+		UnmapViewOfFile(m_data);
+
+	if (m_mapping)
+		CloseHandle(m_mapping);
+
+	if (m_file)
+		CloseHandle(m_file);
+
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	if (m_data)
+		munmap(m_data, m_size);
+
+	if (m_file >= 0)
+		::close(m_file);
+
+	m_file = -1;
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool MeshCache::hash_file(const std::string& path, uint64_t& hash)
+{
+	MappedFile file;
+
+	if (!file.open(path))
+		return false;
+
+	// FNV-1a over 8 byte words, then the remaining bytes. Only used to detect changes, not for security.
+	hash = 0xcbf29ce484222325ull;
+
+	size_t words = file.m_size / 8;
+
+	for (size_t i = 0; i < words; i++)
+	{
+		uint64_t word;
+		memcpy(&word, file.m_data + i * 8, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+	}
+
+	for (size_t i = words * 8; i < file.m_size; i++)
+		hash = (hash ^ file.m_data[i]) * 0x100000001b3ull;
+
+	hash ^= (uint64_t)file.m_size;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+dw::Mesh* MeshCache::load(const std::string& path)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	std::string cache_path = path + MESH_CACHE_EXTENSION;
+	uint64_t source_hash = 0;
+
+	if (!hash_file(path, source_hash))
+	{
+		DW_LOG_ERROR("Failed to open mesh " + path);
+		return nullptr;
+	}
+
+	dw::Mesh* mesh = read(path, cache_path, source_hash);
+
+	if (mesh)
+	{
+		DW_LOG_INFO("Loaded " + path + " from the mesh cache in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()) + " ms");
+		return mesh;
+	}
+
+	// Missing or stale, parse the source and rebuild the cache. A failure to write only costs the next startup.
+	mesh = dw::Mesh::load(path, false);
+
+	if (!mesh)
+		return nullptr;
+
+	write(cache_path, mesh, source_hash);
+
+	DW_LOG_INFO("Loaded " + path + " in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()) + " ms, mesh cache rebuilt");
+
+	return mesh;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+dw::Mesh* MeshCache::read(const std::string& path, const std::string& cache_path, uint64_t source_hash)
+{
+	MappedFile file;
+
+	if (!file.open(cache_path))
+		return nullptr;
+
+	if (file.m_size < sizeof(MeshCacheHeader))
+		return nullptr;
+
+	const MeshCacheHeader* header = (const MeshCacheHeader*)file.m_data;
+
+	if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION || header->vertex_size != sizeof(dw::Vertex) ||
+		header->submesh_size != sizeof(MeshCacheSubMesh) || header->source_hash != source_hash)
+		return nullptr;
+
+	// Reject a truncated file before touching the arrays.
+	if (header->vertex_offset + uint64_t(header->vertex_count) * sizeof(dw::Vertex) > file.m_size ||
+		header->index_offset + uint64_t(header->index_count) * sizeof(uint32_t) > file.m_size ||
+		header->submesh_offset + uint64_t(header->submesh_count) * sizeof(MeshCacheSubMesh) > file.m_size)
+	{
+		DW_LOG_ERROR("Truncated mesh cache " + cache_path);
+		return nullptr;
+	}
+
+	// The mesh takes ownership of the arrays and delete[]s them on unload, so it gets copies rather than pointers into the mapping.
+	const MeshCacheSubMesh* cached = (const MeshCacheSubMesh*)(file.m_data + header->submesh_offset);
+	dw::Vertex* vertices = new dw::Vertex[header->vertex_count];
+	uint32_t* indices = new uint32_t[header->index_count];
+	dw::SubMesh* submeshes = new dw::SubMesh[header->submesh_count];
+
+	memcpy(vertices, file.m_data + header->vertex_offset, size_t(header->vertex_count) * sizeof(dw::Vertex));
+	memcpy(indices, file.m_data + header->index_offset, size_t(header->index_count) * sizeof(uint32_t));
+
+	// Materials are not loaded by the sample, only the grouping of submeshes by material is kept.
+	for (uint32_t i = 0; i < header->submesh_count; i++)
+	{
+		submeshes[i].mat = nullptr;
+		submeshes[i].index_count = cached[i].index_count;
+		submeshes[i].base_vertex = cached[i].base_vertex;
+		submeshes[i].base_index = cached[i].base_index;
+		submeshes[i].max_extents = glm::vec3(cached[i].max_extents[0], cached[i].max_extents[1], cached[i].max_extents[2]);
+		submeshes[i].min_extents = glm::vec3(cached[i].min_extents[0], cached[i].min_extents[1], cached[i].min_extents[2]);
+	}
+
+	return dw::Mesh::load(path,
+						  header->vertex_count,
+						  vertices,
+						  header->index_count,
+						  indices,
+						  header->submesh_count,
+						  submeshes,
+						  glm::vec3(header->max_extents[0], header->max_extents[1], header->max_extents[2]),
+						  glm::vec3(header->min_extents[0], header->min_extents[1], header->min_extents[2]));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool MeshCache::write(const std::string& cache_path, dw::Mesh* mesh, uint64_t source_hash)
+{
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.vertex_size = sizeof(dw::Vertex);
+	header.submesh_size = sizeof(MeshCacheSubMesh);
+	header.source_hash = source_hash;
+	header.vertex_count = mesh->vertex_count();
+	header.index_count = mesh->index_count();
+	header.submesh_count = mesh->sub_mesh_count();
+	header.vertex_offset = align_offset(sizeof(MeshCacheHeader));
+	header.index_offset = align_offset(header.vertex_offset + uint64_t(header.vertex_count) * sizeof(dw::Vertex));
+	header.submesh_offset = align_offset(header.index_offset + uint64_t(header.index_count) * sizeof(uint32_t));
+
+	glm::vec3 max_extents = mesh->max_extents();
+	glm::vec3 min_extents = mesh->min_extents();
+
+	for (int i = 0; i < 3; i++)
+	{
+		header.max_extents[i] = max_extents[i];
+		header.min_extents[i] = min_extents[i];
+	}
+
+	std::vector<MeshCacheSubMesh> submeshes(header.submesh_count);
+	std::vector<dw::Material*> materials;
+
+	for (uint32_t i = 0; i < header.submesh_count; i++)
+	{
+		dw::SubMesh& submesh = mesh->sub_meshes()[i];
+
+		submeshes[i].index_count = submesh.index_count;
+		submeshes[i].base_vertex = submesh.base_vertex;
+		submeshes[i].base_index = submesh.base_index;
+		submeshes[i].material = -1;
+
+		for (int j = 0; j < 3; j++)
+		{
+			submeshes[i].max_extents[j] = submesh.max_extents[j];
+			submeshes[i].min_extents[j] = submesh.min_extents[j];
+		}
+
+		if (!submesh.mat)
+			continue;
+
+		uint32_t material = 0;
+
+		while (material < materials.size() && materials[material] != submesh.mat)
+			material++;
+
+		if (material == materials.size())
+			materials.push_back(submesh.mat);
+
+		submeshes[i].material = (int32_t)material;
+	}
+
+	header.material_count = (uint32_t)materials.size();
+
+	// Written to a temporary file first so that an interrupted write never leaves a cache that passes the header checks.
+	std::string temp_path = cache_path + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+
+	if (!file)
+	{
+		DW_LOG_ERROR("Failed to open " + temp_path + " for writing");
+		return false;
+	}
+
+	static const uint8_t zeros[MESH_CACHE_ALIGNMENT] = {};
+
+	auto write_at = [&](uint64_t offset, const void* data, size_t size) {
+		long position = ftell(file);
+
+		if (position < 0 || uint64_t(position) > offset || fwrite(zeros, 1, size_t(offset - position), file) != size_t(offset - position))
+			return false;
+
+		return size == 0 || fwrite(data, 1, size, file) == size;
+	};
+
+	bool success = write_at(0, &header, sizeof(header)) &&
+				   write_at(header.vertex_offset, mesh->vertices(), size_t(header.vertex_count) * sizeof(dw::Vertex)) &&
+				   write_at(header.index_offset, mesh->indices(), size_t(header.index_count) * sizeof(uint32_t)) &&
+				   write_at(header.submesh_offset, submeshes.data(), submeshes.size() * sizeof(MeshCacheSubMesh));
+
+	success = fclose(file) == 0 && success;
+
+	if (success)
+	{
+		remove(cache_path.c_str());
+		success = rename(temp_path.c_str(), cache_path.c_str()) == 0;
+	}
+
+	if (!success)
+	{
+		DW_LOG_ERROR("Failed to write mesh cache " + cache_path);
+		remove(temp_path.c_str());
+	}
+
+	return success;
+}
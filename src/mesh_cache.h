@@ -0,0 +1,68 @@
+#pragma once
+
+#include <mesh.h>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MESH_CACHE_MAGIC 0x4843534d // "MSCH"
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_ALIGNMENT 16
+#define MESH_CACHE_EXTENSION ".meshcache"
+
+// File layout: header, then the vertex, index and submesh arrays at the given offsets, each aligned to MESH_CACHE_ALIGNMENT.
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_size;  // sizeof(dw::Vertex) when written, the cache is rebuilt if the layout changes.
+	uint32_t submesh_size;
+	uint64_t source_hash;  // Hash of the source file contents.
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t submesh_count;
+	uint32_t material_count;
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t submesh_offset;
+	float    max_extents[3];
+	float    min_extents[3];
+};
+
+struct MeshCacheSubMesh
+{
+	uint32_t index_count;
+	uint32_t base_vertex;
+	uint32_t base_index;
+	int32_t  material; // Index of the submesh material among the distinct materials of the mesh, -1 if it has none.
+	float    max_extents[3];
+	float    min_extents[3];
+};
+
+// Read-only view of a whole file.
+struct MappedFile
+{
+	uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+#if defined(_WIN32)
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+
+	~MappedFile();
+	bool open(const std::string& path);
+	void close();
+};
+
+// Binary cache of parsed meshes, stored next to the source as <source>.meshcache. The vertex and index arrays are laid out exactly
+// as dw::Vertex and uint32_t so that a cache hit maps the file and copies the arrays into the mesh, with no parsing. The cache
+// is keyed on a hash of the source file and rewritten whenever the source, the format version or the vertex layout change.
+struct MeshCache
+{
+	static dw::Mesh* load(const std::string& path);
+	static dw::Mesh* read(const std::string& path, const std::string& cache_path, uint64_t source_hash);
+	static bool write(const std::string& cache_path, dw::Mesh* mesh, uint64_t source_hash);
+	static bool hash_file(const std::string& path, uint64_t& hash);
+};
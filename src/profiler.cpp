@@ -0,0 +1,329 @@
+#include "profiler.h"
+#include <macros.h>
+#include <algorithm>
+#include <string.h>
+
+Profiler::Profiler()
+{
+	for (int i = 0; i < PROFILER_LATENCY; i++)
+	{
+		m_frames[i].index = 0;
+		m_frames[i].pending = false;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+Profiler::~Profiler()
+{
+	stop_capture();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::initialize()
+{
+	shutdown();
+
+	for (int i = 0; i < PROFILER_MAX_SCOPES; i++)
+		m_timers[i].initialize();
+
+	m_gpu = true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::shutdown()
+{
+	stop_capture();
+
+	if (m_gpu)
+	{
+		for (int i = 0; i < PROFILER_MAX_SCOPES; i++)
+			m_timers[i].shutdown();
+
+		m_gpu = false;
+	}
+
+	for (int i = 0; i < PROFILER_LATENCY; i++)
+		m_frames[i].pending = false;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int Profiler::scope(const std::string& name, bool gpu)
+{
+	if (m_scopes.size() == PROFILER_MAX_SCOPES)
+	{
+		DW_LOG_ERROR("Too many profiler scopes");
+		return -1;
+	}
+
+	ProfilerScope scope;
+	scope.name = name;
+	scope.gpu = gpu;
+
+	std::fill(scope.cpu_history, scope.cpu_history + PROFILER_HISTORY, -1.0f);
+	std::fill(scope.gpu_history, scope.gpu_history + PROFILER_HISTORY, -1.0f);
+
+	m_scopes.push_back(scope);
+
+	return (int)m_scopes.size() - 1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::begin_frame()
+{
+	int slot = int(m_frame_index % PROFILER_LATENCY);
+	ProfilerFrame& frame = m_frames[slot];
+
+	// The slot still holds the frame from PROFILER_LATENCY frames ago.
+	if (frame.pending)
+		resolve(frame, slot);
+
+	frame.index = m_frame_index;
+	frame.pending = false;
+
+	for (int i = 0; i < PROFILER_MAX_SCOPES; i++)
+	{
+		frame.used[i] = false;
+		frame.cpu_ms[i] = 0.0;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::end_frame()
+{
+	current_frame().pending = true;
+	m_frame_index++;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::begin(int scope)
+{
+	if (scope < 0)
+		return;
+
+	m_cpu_start[scope] = std::chrono::high_resolution_clock::now();
+
+	if (m_gpu && m_scopes[scope].gpu)
+		m_timers[scope].begin(int(m_frame_index % PROFILER_LATENCY));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::end(int scope)
+{
+	if (scope < 0)
+		return;
+
+	ProfilerFrame& frame = current_frame();
+
+	if (m_gpu && m_scopes[scope].gpu)
+		m_timers[scope].end(int(m_frame_index % PROFILER_LATENCY));
+
+	// A scope entered several times in a frame accumulates. Its GPU time only covers the last entry.
+	frame.cpu_ms[scope] += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_cpu_start[scope]).count();
+	frame.used[scope] = true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::resolve(ProfilerFrame& frame, int slot)
+{
+	double gpu_ms[PROFILER_MAX_SCOPES];
+	int scope_count = (int)m_scopes.size();
+
+	// Never wait: if any timestamp of the frame is still in flight its GPU timings are dropped.
+	bool available = m_gpu;
+
+	for (int i = 0; i < scope_count && available; i++)
+	{
+		if (!frame.used[i] || !m_scopes[i].gpu)
+			continue;
+
+		available = m_timers[i].available(slot);
+	}
+
+	if (m_gpu && !available)
+		m_dropped_frames++;
+
+	for (int i = 0; i < scope_count; i++)
+	{
+		gpu_ms[i] = -1.0;
+
+		if (!available || !frame.used[i] || !m_scopes[i].gpu)
+			continue;
+
+		gpu_ms[i] = m_timers[i].elapsed_ms(slot);
+	}
+
+	for (int i = 0; i < scope_count; i++)
+	{
+		m_scopes[i].cpu_history[m_history_head] = frame.used[i] ? float(frame.cpu_ms[i]) : -1.0f;
+		m_scopes[i].gpu_history[m_history_head] = float(gpu_ms[i]);
+	}
+
+	m_history_head = (m_history_head + 1) % PROFILER_HISTORY;
+	m_history_count = std::min(m_history_count + 1, PROFILER_HISTORY);
+	m_resolved_frames = frame.index + 1;
+
+	if (m_collecting && frame.index >= m_collect_first && frame.index <= m_collect_last)
+	{
+		m_collected_cpu.resize(scope_count);
+		m_collected_gpu.resize(scope_count);
+
+		for (int i = 0; i < scope_count; i++)
+		{
+			if (frame.used[i])
+				m_collected_cpu[i].push_back(float(frame.cpu_ms[i]));
+
+			if (gpu_ms[i] >= 0.0)
+				m_collected_gpu[i].push_back(float(gpu_ms[i]));
+		}
+	}
+
+	if (!m_csv)
+		return;
+
+	// Columns are fixed by the first row, scopes created later are not exported.
+	if (!m_csv_header)
+	{
+		fprintf(m_csv, "frame");
+
+		for (int i = 0; i < scope_count; i++)
+		{
+			fprintf(m_csv, ",%s cpu ms", m_scopes[i].name.c_str());
+
+			if (m_scopes[i].gpu)
+				fprintf(m_csv, ",%s gpu ms", m_scopes[i].name.c_str());
+		}
+
+		fprintf(m_csv, "\n");
+		m_csv_header = true;
+		m_csv_rows = 0;
+	}
+
+	// Scopes that did not run, or GPU timings that were dropped, are left empty.
+	fprintf(m_csv, "%llu", (unsigned long long)frame.index);
+
+	for (int i = 0; i < scope_count; i++)
+	{
+		if (frame.used[i])
+			fprintf(m_csv, ",%.4f", frame.cpu_ms[i]);
+		else
+			fprintf(m_csv, ",");
+
+		if (!m_scopes[i].gpu)
+			continue;
+
+		if (gpu_ms[i] >= 0.0)
+			fprintf(m_csv, ",%.4f", gpu_ms[i]);
+		else
+			fprintf(m_csv, ",");
+	}
+
+	fprintf(m_csv, "\n");
+	m_csv_rows++;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+ProfilerStats Profiler::stats(int scope, bool gpu)
+{
+	if (scope < 0)
+		return compute_stats(nullptr, 0);
+
+	const float* history = gpu ? m_scopes[scope].gpu_history : m_scopes[scope].cpu_history;
+	float samples[PROFILER_HISTORY];
+	int count = 0;
+
+	for (int i = 0; i < m_history_count; i++)
+	{
+		if (history[i] >= 0.0f)
+			samples[count++] = history[i];
+	}
+
+	return compute_stats(samples, count);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+ProfilerStats Profiler::compute_stats(float* samples, int count)
+{
+	ProfilerStats stats = { 0.0, 0.0, 0.0, 0.0, 0.0, 0 };
+
+	if (count == 0)
+		return stats;
+
+	std::sort(samples, samples + count);
+
+	double sum = 0.0;
+
+	for (int i = 0; i < count; i++)
+		sum += samples[i];
+
+	// Nearest rank percentiles.
+	auto percentile = [&](double p) { return samples[std::min(count - 1, int(p * count))]; };
+
+	stats.average = sum / count;
+	stats.p50 = percentile(0.50);
+	stats.p95 = percentile(0.95);
+	stats.p99 = percentile(0.99);
+	stats.max = samples[count - 1];
+	stats.count = count;
+
+	return stats;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool Profiler::start_capture(const std::string& path)
+{
+	stop_capture();
+
+	m_csv = fopen(path.c_str(), "w");
+
+	if (!m_csv)
+	{
+		DW_LOG_ERROR("Failed to open " + path + " for writing");
+		return false;
+	}
+
+	m_csv_header = false;
+	m_csv_rows = 0;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::stop_capture()
+{
+	if (m_csv)
+	{
+		fclose(m_csv);
+		m_csv = nullptr;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::begin_collect(uint64_t first_frame)
+{
+	m_collecting = true;
+	m_collect_first = first_frame;
+	m_collect_last = UINT64_MAX;
+	m_collected_cpu.clear();
+	m_collected_gpu.clear();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void Profiler::end_collect(uint64_t last_frame)
+{
+	m_collect_last = last_frame;
+}
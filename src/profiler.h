@@ -0,0 +1,100 @@
+#pragma once
+
+#include "gpu_timer.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+#define PROFILER_MAX_SCOPES 32
+#define PROFILER_LATENCY GPU_TIMER_LATENCY
+#define PROFILER_HISTORY 256 // Frames kept for the rolling statistics.
+
+// Rolling statistics of a scope over the frames kept in the history, in milliseconds.
+struct ProfilerStats
+{
+	double average;
+	double p50;
+	double p95;
+	double p99;
+	double max;
+	int count;
+};
+
+// A named section of the frame. Scopes may nest, e.g. a cascade within the shadow pass.
+struct ProfilerScope
+{
+	std::string name;
+	bool gpu;
+	float cpu_history[PROFILER_HISTORY]; // Negative when the scope did not run in that frame.
+	float gpu_history[PROFILER_HISTORY];
+};
+
+// Timings recorded during one frame, resolved once its timestamps are available.
+struct ProfilerFrame
+{
+	uint64_t index;
+	bool pending;
+	bool used[PROFILER_MAX_SCOPES];
+	double cpu_ms[PROFILER_MAX_SCOPES];
+};
+
+// Per-frame CPU and GPU timings of named scopes. CPU time is measured on the calling thread, GPU time with a GPUTimer per scope whose
+// slots follow the frames in flight. A frame whose timestamps are still not available when its slot comes around again loses its GPU
+// timings instead of stalling. Resolved frames feed the rolling history and, while a capture is running, one CSV row each.
+struct Profiler
+{
+	std::vector<ProfilerScope> m_scopes;
+	ProfilerFrame m_frames[PROFILER_LATENCY];
+	GPUTimer m_timers[PROFILER_MAX_SCOPES];
+	std::chrono::high_resolution_clock::time_point m_cpu_start[PROFILER_MAX_SCOPES];
+	uint64_t m_frame_index = 0;
+	int m_history_head = 0;   // Slot the next resolved frame is written to.
+	int m_history_count = 0;
+	uint32_t m_dropped_frames = 0;
+	bool m_gpu = false;
+	FILE* m_csv = nullptr;
+	bool m_csv_header = false;
+	uint32_t m_csv_rows = 0;
+	uint64_t m_resolved_frames = 0; // Frames resolved so far, i.e. index of the next frame to be resolved.
+
+	// Every sample of a range of frames, for measurements longer than the history. Frames with no sample for a scope are skipped.
+	bool m_collecting = false;
+	uint64_t m_collect_first = 0;
+	uint64_t m_collect_last = UINT64_MAX;
+	std::vector<std::vector<float>> m_collected_cpu;
+	std::vector<std::vector<float>> m_collected_gpu;
+
+	Profiler();
+	~Profiler();
+	void initialize();
+	void shutdown();
+	int scope(const std::string& name, bool gpu = true);
+	void begin_frame();
+	void end_frame();
+	void begin(int scope);
+	void end(int scope);
+	void resolve(ProfilerFrame& frame, int slot);
+	ProfilerStats stats(int scope, bool gpu);
+	bool start_capture(const std::string& path);
+	void stop_capture();
+	void begin_collect(uint64_t first_frame);
+	void end_collect(uint64_t last_frame);
+
+	static ProfilerStats compute_stats(float* samples, int count);
+
+	inline ProfilerFrame& current_frame() { return m_frames[m_frame_index % PROFILER_LATENCY]; }
+	inline bool capturing() { return m_csv != nullptr; }
+	inline bool collect_done() { return m_collect_last != UINT64_MAX && m_resolved_frames > m_collect_last; }
+};
+
+// Times the enclosing block.
+struct ProfileScope
+{
+	Profiler& m_profiler;
+	int m_scope;
+
+	inline ProfileScope(Profiler& profiler, int scope) : m_profiler(profiler), m_scope(scope) { m_profiler.begin(m_scope); }
+	inline ~ProfileScope() { m_profiler.end(m_scope); }
+};
@@ -0,0 +1,383 @@
+#include "program_cache.h"
+#include <macros.h>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+// On-disk header, followed by size bytes of program binary.
+struct ProgramCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t size;
+};
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	// FNV-1a.
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+
+	return hash;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+static uint64_t hash_string(uint64_t hash, const std::string& str)
+{
+	// The length separates consecutive strings, so that moving characters from one to the next changes the hash.
+	uint64_t size = str.size();
+	hash = hash_bytes(hash, &size, sizeof(size));
+
+	return hash_bytes(hash, str.data(), str.size());
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+static double elapsed_ms(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+CachedProgram::~CachedProgram()
+{
+	if (m_id)
+		glDeleteProgram(m_id);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CachedProgram::use()
+{
+	glUseProgram(m_id);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+GLint CachedProgram::location(const std::string& name)
+{
+	auto it = m_locations.find(name);
+
+	if (it != m_locations.end())
+		return it->second;
+
+	GLint location = glGetUniformLocation(m_id, name.c_str());
+	m_locations[name] = location;
+
+	return location;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CachedProgram::set_uniform(const std::string& name, int value)
+{
+	GLint loc = location(name);
+
+	if (loc < 0)
+		return false;
+
+	glUniform1i(loc, value);
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CachedProgram::set_uniform(const std::string& name, float value)
+{
+	GLint loc = location(name);
+
+	if (loc < 0)
+		return false;
+
+	glUniform1f(loc, value);
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CachedProgram::set_uniform(const std::string& name, const glm::vec2& value)
+{
+	GLint loc = location(name);
+
+	if (loc < 0)
+		return false;
+
+	glUniform2f(loc, value.x, value.y);
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CachedProgram::set_uniform(const std::string& name, const glm::vec3& value)
+{
+	GLint loc = location(name);
+
+	if (loc < 0)
+		return false;
+
+	glUniform3f(loc, value.x, value.y, value.z);
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CachedProgram::set_uniform(const std::string& name, const glm::vec4& value)
+{
+	GLint loc = location(name);
+
+	if (loc < 0)
+		return false;
+
+	glUniform4f(loc, value.x, value.y, value.z, value.w);
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool CachedProgram::set_uniform(const std::string& name, const glm::mat4& value)
+{
+	GLint loc = location(name);
+
+	if (loc < 0)
+		return false;
+
+	glUniformMatrix4fv(loc, 1, GL_FALSE, &value[0][0]);
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void CachedProgram::uniform_block_binding(const std::string& name, int binding)
+{
+	GLuint index = glGetUniformBlockIndex(m_id, name.c_str());
+
+	if (index == GL_INVALID_INDEX)
+	{
+		DW_LOG_ERROR("Failed to find uniform block " + name);
+		return;
+	}
+
+	glUniformBlockBinding(m_id, index, binding);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ProgramCache::initialize(const std::string& prefix)
+{
+	m_prefix = prefix;
+	m_hits = 0;
+	m_misses = 0;
+	m_load_ms = 0.0;
+	m_compile_ms = 0.0;
+
+	// A driver update may change the binary format without changing its enum, so the strings are part of the key.
+	const char* vendor = (const char*)glGetString(GL_VENDOR);
+	const char* renderer = (const char*)glGetString(GL_RENDERER);
+	const char* version = (const char*)glGetString(GL_VERSION);
+
+	m_driver = std::string(vendor ? vendor : "") + "|" + (renderer ? renderer : "") + "|" + (version ? version : "");
+
+	GLint format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	m_supported = format_count > 0;
+
+	if (!m_supported)
+		DW_LOG_WARNING("Program binaries are not supported by the driver, shaders will always be compiled");
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint64_t ProgramCache::key(const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	hash = hash_string(hash, m_driver);
+
+	for (const auto& stage : stages)
+	{
+		hash = hash_bytes(hash, &stage.type, sizeof(stage.type));
+		hash = hash_string(hash, stage.source);
+	}
+
+	for (const auto& define : defines)
+		hash = hash_string(hash, define);
+
+	return hash;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+std::unique_ptr<CachedProgram> ProgramCache::create(const std::string& name, const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	std::string path = m_prefix + name + ".bin";
+	uint64_t program_key = key(stages, defines);
+	std::unique_ptr<CachedProgram> program = std::make_unique<CachedProgram>();
+
+	if (m_supported)
+	{
+		program->m_id = glCreateProgram();
+
+		if (load(path, program_key, program->m_id))
+		{
+			double ms = elapsed_ms(start);
+
+			m_hits++;
+			m_load_ms += ms;
+			DW_LOG_INFO("Program " + name + " loaded from cache in " + std::to_string(ms) + " ms");
+
+			return program;
+		}
+
+		glDeleteProgram(program->m_id);
+		program->m_id = 0;
+	}
+
+	program->m_id = compile(name, stages, defines);
+
+	if (!program->m_id)
+		return nullptr;
+
+	double ms = elapsed_ms(start);
+
+	m_misses++;
+	m_compile_ms += ms;
+	DW_LOG_INFO("Program " + name + " compiled in " + std::to_string(ms) + " ms");
+
+	if (m_supported)
+		save(path, program_key, program->m_id);
+
+	return program;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ProgramCache::load(const std::string& path, uint64_t key, GLuint program)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+
+	if (!file)
+		return false;
+
+	ProgramCacheHeader header;
+	std::vector<uint8_t> binary;
+
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION &&
+				 header.key == key && header.size > 0;
+
+	if (valid)
+	{
+		binary.resize(header.size);
+		valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+
+	fclose(file);
+
+	if (!valid)
+		return false;
+
+	// The driver may still reject a binary it produced, e.g. after an update that kept the version string.
+	glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+	return status == GL_TRUE;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ProgramCache::save(const std::string& path, uint64_t key, GLuint program)
+{
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+
+	if (size <= 0)
+		return false;
+
+	std::vector<uint8_t> binary(size);
+	GLenum format = 0;
+	GLsizei length = 0;
+	glGetProgramBinary(program, size, &length, &format, binary.data());
+
+	if (length <= 0)
+		return false;
+
+	ProgramCacheHeader header;
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.size = (uint32_t)length;
+
+	FILE* file = fopen(path.c_str(), "wb");
+
+	if (!file)
+	{
+		DW_LOG_ERROR("Failed to open " + path + " for writing");
+		return false;
+	}
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, length, file) == size_t(length);
+	success = fclose(file) == 0 && success;
+
+	// A partial file fails the size check on the next load.
+	if (!success)
+		DW_LOG_ERROR("Failed to write program binary " + path);
+
+	return success;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+GLuint ProgramCache::compile(const std::string& name, const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines)
+{
+	std::vector<std::unique_ptr<dw::Shader>> shaders;
+
+	for (const auto& stage : stages)
+	{
+		shaders.push_back(std::make_unique<dw::Shader>(stage.type, stage.source, defines));
+
+		if (!shaders.back()->compiled())
+		{
+			DW_LOG_ERROR("Failed to compile shaders of program " + name);
+			return 0;
+		}
+	}
+
+	GLuint program = glCreateProgram();
+
+	for (auto& shader : shaders)
+		glAttachShader(program, shader->id());
+
+	if (m_supported)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	glLinkProgram(program);
+
+	for (auto& shader : shaders)
+		glDetachShader(program, shader->id());
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+
+	if (status != GL_TRUE)
+	{
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		DW_LOG_ERROR("Failed to link program " + name + ": " + log);
+		glDeleteProgram(program);
+
+		return 0;
+	}
+
+	return program;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <ogl.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#define PROGRAM_CACHE_MAGIC 0x42475250 // "PRGB"
+#define PROGRAM_CACHE_VERSION 1
+
+// One stage of a program, as embedded in the sources.
+struct ShaderStage
+{
+	GLenum type;
+	std::string source;
+};
+
+// Linked program object, compiled from source or restored from a cached binary. Offers the subset of dw::Program used by the sample,
+// which cannot be created from a binary.
+struct CachedProgram
+{
+	GLuint m_id = 0;
+	std::unordered_map<std::string, GLint> m_locations;
+
+	~CachedProgram();
+	void use();
+	GLint location(const std::string& name);
+	bool set_uniform(const std::string& name, int value);
+	bool set_uniform(const std::string& name, float value);
+	bool set_uniform(const std::string& name, const glm::vec2& value);
+	bool set_uniform(const std::string& name, const glm::vec3& value);
+	bool set_uniform(const std::string& name, const glm::vec4& value);
+	bool set_uniform(const std::string& name, const glm::mat4& value);
+	void uniform_block_binding(const std::string& name, int binding);
+
+	inline GLuint id() { return m_id; }
+};
+
+// On-disk cache of glGetProgramBinary blobs, one file per program named <prefix><name>.bin. Each file is keyed on a hash of the stage
+// sources, the defines and the driver (vendor, renderer and version strings). A missing, stale or rejected binary falls back to
+// compiling the sources and the file is rewritten.
+struct ProgramCache
+{
+	std::string m_prefix;
+	std::string m_driver;
+	bool m_supported = false; // The driver exposes at least one binary format.
+	uint32_t m_hits = 0;
+	uint32_t m_misses = 0;
+	double m_load_ms = 0.0;    // Total time spent restoring binaries.
+	double m_compile_ms = 0.0; // Total time spent compiling and linking.
+
+	void initialize(const std::string& prefix = "program_cache_");
+	std::unique_ptr<CachedProgram> create(const std::string& name, const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines = std::vector<std::string>());
+	uint64_t key(const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines);
+	bool load(const std::string& path, uint64_t key, GLuint program);
+	bool save(const std::string& path, uint64_t key, GLuint program);
+	GLuint compile(const std::string& name, const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines);
+};
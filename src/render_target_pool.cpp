@@ -0,0 +1,179 @@
+#include "render_target_pool.h"
+#include <macros.h>
+#include <algorithm>
+
+static size_t texel_size(GLenum internal_format)
+{
+	switch (internal_format)
+	{
+		case GL_R8:
+			return 1;
+		case GL_DEPTH_COMPONENT16:
+			return 2;
+		case GL_RG32F:
+		case GL_RGBA16F:
+			return 8;
+		case GL_RGBA32F:
+			return 16;
+		// D24 is padded to 32 bits by every implementation.
+		default:
+			return 4;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+size_t render_target_size(const RenderTargetDesc& desc)
+{
+	size_t size = 0;
+
+	for (int i = 0; i < desc.mip_levels; i++)
+		size += size_t(std::max(desc.width >> i, 1)) * std::max(desc.height >> i, 1);
+
+	return size * desc.layers * texel_size(desc.internal_format);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool RenderTargetDesc::operator==(const RenderTargetDesc& other) const
+{
+	return width == other.width && height == other.height && layers == other.layers && mip_levels == other.mip_levels &&
+		   internal_format == other.internal_format && format == other.format && type == other.type;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+RenderTarget::~RenderTarget()
+{
+	for (GLuint fbo : m_fbos)
+	{
+		if (fbo)
+			glDeleteFramebuffers(1, &fbo);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+GLuint RenderTarget::framebuffer(int layer)
+{
+	if (m_fbos[layer])
+		return m_fbos[layer];
+
+	GLenum attachment = GL_COLOR_ATTACHMENT0;
+
+	if (m_desc.format == GL_DEPTH_COMPONENT)
+		attachment = GL_DEPTH_ATTACHMENT;
+	else if (m_desc.format == GL_DEPTH_STENCIL)
+		attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+
+	glGenFramebuffers(1, &m_fbos[layer]);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[layer]);
+
+	if (m_texture->target() == GL_TEXTURE_2D_ARRAY)
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, attachment, m_texture->id(), 0, layer);
+	else
+		glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, m_texture->id(), 0);
+
+	if (attachment != GL_COLOR_ATTACHMENT0)
+	{
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return m_fbos[layer];
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+RenderTarget* RenderTargetPool::acquire(const RenderTargetDesc& desc, const std::string& name)
+{
+	for (auto& target : m_targets)
+	{
+		if (!target->m_in_use && target->m_desc == desc)
+		{
+			target->m_in_use = true;
+			m_used_bytes += target->m_bytes;
+			m_reuses++;
+
+			return target.get();
+		}
+	}
+
+	std::unique_ptr<RenderTarget> target = std::make_unique<RenderTarget>();
+
+	target->m_desc = desc;
+	target->m_texture = std::make_unique<dw::Texture2D>(desc.width, desc.height, desc.layers, desc.mip_levels, 1, desc.internal_format, desc.format, desc.type);
+	target->m_fbos.resize(desc.layers, 0);
+	target->m_bytes = render_target_size(desc);
+	target->m_in_use = true;
+
+	m_allocated_bytes += target->m_bytes;
+	m_used_bytes += target->m_bytes;
+	m_peak_bytes = std::max(m_peak_bytes, m_allocated_bytes);
+	m_allocations++;
+
+	DW_LOG_INFO("Allocated render target " + name + " (" + std::to_string(desc.width) + "x" + std::to_string(desc.height) + "x" +
+				std::to_string(desc.layers) + ", " + std::to_string(target->m_bytes / (1024.0 * 1024.0)) + " MB)");
+
+	m_targets.push_back(std::move(target));
+
+	return m_targets.back().get();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void RenderTargetPool::release(RenderTarget*& target)
+{
+	if (!target)
+		return;
+
+	target->m_in_use = false;
+	target->m_released_frame = m_frame;
+	m_used_bytes -= target->m_bytes;
+	target = nullptr;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void RenderTargetPool::end_frame()
+{
+	m_frame++;
+	trim(RENDER_TARGET_POOL_IDLE_FRAMES);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void RenderTargetPool::trim(uint32_t idle_frames)
+{
+	for (size_t i = 0; i < m_targets.size();)
+	{
+		RenderTarget* target = m_targets[i].get();
+
+		if (target->m_in_use || m_frame - target->m_released_frame < idle_frames)
+		{
+			i++;
+			continue;
+		}
+
+		m_allocated_bytes -= target->m_bytes;
+		m_targets[i] = std::move(m_targets.back());
+		m_targets.pop_back();
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void RenderTargetPool::shutdown()
+{
+	for (auto& target : m_targets)
+	{
+		if (target->m_in_use)
+			DW_LOG_WARNING("Render target still in use at shutdown");
+	}
+
+	m_targets.clear();
+	m_allocated_bytes = 0;
+	m_used_bytes = 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <ogl.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define RENDER_TARGET_POOL_IDLE_FRAMES 300 // Released targets not reacquired within this many frames are deleted.
+
+// Everything a pooled texture is keyed on. Filtering and wrapping are not part of it: owners set them after every acquire.
+struct RenderTargetDesc
+{
+	int width;
+	int height;
+	int layers;     // 1 for a plain 2D texture, otherwise a 2D array.
+	int mip_levels;
+	GLenum internal_format;
+	GLenum format;
+	GLenum type;
+
+	bool operator==(const RenderTargetDesc& other) const;
+	inline bool operator!=(const RenderTargetDesc& other) const { return !(*this == other); }
+};
+
+// Texture handed out by the pool, with one framebuffer per layer rendering into mip 0 of that layer alone. The framebuffers are
+// created on first use and live as long as the texture, so reacquiring a target costs no GL object creation at all.
+struct RenderTarget
+{
+	RenderTargetDesc m_desc;
+	std::unique_ptr<dw::Texture2D> m_texture;
+	std::vector<GLuint> m_fbos;
+	size_t m_bytes = 0;
+	bool m_in_use = false;
+	uint32_t m_released_frame = 0;
+
+	~RenderTarget();
+	GLuint framebuffer(int layer = 0);
+
+	inline dw::Texture2D* texture() { return m_texture.get(); }
+};
+
+// Pool of the render targets of the sample, keyed by RenderTargetDesc. Releasing a target keeps its texture and framebuffers alive so
+// that switching back and forth between configurations reuses them instead of reallocating, and only targets left idle for
+// RENDER_TARGET_POOL_IDLE_FRAMES are deleted. Tracks the video memory of every texture it holds.
+struct RenderTargetPool
+{
+	std::vector<std::unique_ptr<RenderTarget>> m_targets;
+	uint32_t m_frame = 0;
+	size_t m_allocated_bytes = 0; // Every texture of the pool, idle or not.
+	size_t m_used_bytes = 0;      // Acquired textures only.
+	size_t m_peak_bytes = 0;
+	uint32_t m_allocations = 0;   // Textures created.
+	uint32_t m_reuses = 0;        // Acquires served by an idle texture.
+
+	RenderTarget* acquire(const RenderTargetDesc& desc, const std::string& name);
+	void release(RenderTarget*& target);
+	void end_frame();
+	void trim(uint32_t idle_frames);
+	void shutdown();
+
+	inline size_t idle_bytes() { return m_allocated_bytes - m_used_bytes; }
+};
+
+size_t render_target_size(const RenderTargetDesc& desc);
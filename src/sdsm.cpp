@@ -0,0 +1,363 @@
+#include "sdsm.h"
+#include <macros.h>
+#include <string.h>
+
+// Full-screen triangle generated from gl_VertexID.
+const char* g_sdsm_vs_src = R"(
+
+void main()
+{
+    vec2 uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+)";
+
+// Reduces a 4x4 block of the previous level to its (min, max). The first pass reads the depth buffer directly and skips background
+// texels, which leave the neutral pair (1, 0).
+const char* g_sdsm_fs_src = R"(
+
+out vec2 PS_OUT_MinMax;
+
+uniform sampler2D s_Source; //#slot 0
+uniform int u_FirstPass;
+
+void main()
+{
+    ivec2 size = textureSize(s_Source, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * 4;
+    vec2 result = vec2(1.0, 0.0);
+
+    for (int y = 0; y < 4; y++)
+    {
+        for (int x = 0; x < 4; x++)
+        {
+            ivec2 coord = base + ivec2(x, y);
+
+            if (coord.x < size.x && coord.y < size.y)
+            {
+                vec2 s = texelFetch(s_Source, coord, 0).rg;
+
+                if (u_FirstPass == 1)
+                {
+                    if (s.r < 1.0)
+                        result = vec2(min(result.x, s.r), max(result.y, s.r));
+                }
+                else
+                    result = vec2(min(result.x, s.x), max(result.y, s.y));
+            }
+        }
+    }
+
+    PS_OUT_MinMax = result;
+}
+
+)";
+
+// One point per pixel of the depth buffer, moved onto the bin of its linear depth over the reduced range. Mirrors
+// build_depth_histogram.
+const char* g_sdsm_histogram_vs_src = R"(
+
+uniform sampler2D s_Depth; //#slot 0
+uniform sampler2D s_Range; //#slot 1
+uniform float u_Near;
+uniform float u_Far;
+uniform int u_Bins;
+
+float linearize_depth(float depth)
+{
+    float z_ndc = depth * 2.0 - 1.0;
+    return (2.0 * u_Near * u_Far) / (u_Far + u_Near - z_ndc * (u_Far - u_Near));
+}
+
+void main()
+{
+    ivec2 size = textureSize(s_Depth, 0);
+    float depth = texelFetch(s_Depth, ivec2(gl_VertexID % size.x, gl_VertexID / size.x), 0).r;
+    vec2 range = texelFetch(s_Range, ivec2(0), 0).rg;
+
+    // Background pixels are dropped outside of the viewport.
+    if (depth >= 1.0 || depth <= 0.0 || range.x > range.y)
+    {
+        gl_Position = vec4(2.0, 2.0, 0.0, 1.0);
+        return;
+    }
+
+    float min_depth = linearize_depth(range.x);
+    float extent = linearize_depth(range.y) - min_depth;
+    int bin = extent > 0.0 ? clamp(int((linearize_depth(depth) - min_depth) * float(u_Bins) / extent), 0, u_Bins - 1) : 0;
+
+    gl_Position = vec4((float(bin) + 0.5) * 2.0 / float(u_Bins) - 1.0, 0.0, 0.0, 1.0);
+}
+
+)";
+
+const char* g_sdsm_histogram_fs_src = R"(
+
+out float PS_OUT_Count;
+
+void main()
+{
+    PS_OUT_Count = 1.0;
+}
+
+)";
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+SDSMReduction::SDSMReduction()
+{
+	for (int i = 0; i < SDSM_READBACK_LATENCY; i++)
+	{
+		m_pbos[i] = 0;
+		m_fences[i] = nullptr;
+		m_tags[i] = 0;
+		m_histograms[i] = false;
+	}
+
+	m_range.min_depth = 0.0f;
+	m_range.max_depth = 0.0f;
+	m_range.valid = false;
+
+	memset(m_histogram, 0, sizeof(m_histogram));
+}
+
+SDSMReduction::~SDSMReduction()
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool SDSMReduction::initialize(ProgramCache& cache, RenderTargetPool& pool, int width, int height)
+{
+	shutdown();
+
+	m_pool = &pool;
+	m_width = width;
+	m_height = height;
+
+	if (!m_program)
+	{
+		m_program = cache.create("sdsm_reduction", { { GL_VERTEX_SHADER, g_sdsm_vs_src }, { GL_FRAGMENT_SHADER, g_sdsm_fs_src } });
+
+		if (!m_program)
+		{
+			DW_LOG_FATAL("Failed to create SDSM Shader Program");
+			return false;
+		}
+	}
+
+	if (!m_histogram_program)
+	{
+		m_histogram_program = cache.create("sdsm_histogram", { { GL_VERTEX_SHADER, g_sdsm_histogram_vs_src }, { GL_FRAGMENT_SHADER, g_sdsm_histogram_fs_src } });
+
+		if (!m_histogram_program)
+		{
+			DW_LOG_FATAL("Failed to create SDSM Histogram Shader Program");
+			return false;
+		}
+	}
+
+	// Reduction chain, each level a quarter of the previous one in both dimensions down to a single texel.
+	int w = width;
+	int h = height;
+
+	do
+	{
+		w = (w + SDSM_REDUCTION_FACTOR - 1) / SDSM_REDUCTION_FACTOR;
+		h = (h + SDSM_REDUCTION_FACTOR - 1) / SDSM_REDUCTION_FACTOR;
+
+		RenderTarget* level = pool.acquire({ w, h, 1, 1, GL_RG32F, GL_RG, GL_FLOAT }, "depth reduction");
+		level->texture()->set_min_filter(GL_NEAREST);
+		level->texture()->set_mag_filter(GL_NEAREST);
+		level->texture()->set_wrapping(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+
+		m_levels.push_back(level);
+	} while (w > 1 || h > 1);
+
+	// Pixel counts stay exact in 32-bit floats up to 2^24 pixels per bin.
+	m_histogram_target = pool.acquire({ DEPTH_HISTOGRAM_BINS, 1, 1, 1, GL_R32F, GL_RED, GL_FLOAT }, "depth histogram");
+
+	glGenVertexArrays(1, &m_vao);
+	glGenBuffers(SDSM_READBACK_LATENCY, &m_pbos[0]);
+
+	for (int i = 0; i < SDSM_READBACK_LATENCY; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(m_readback), nullptr, GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	m_write_index = 0;
+	m_range.valid = false;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SDSMReduction::shutdown()
+{
+	for (int i = 0; i < SDSM_READBACK_LATENCY; i++)
+	{
+		if (m_fences[i])
+		{
+			glDeleteSync(m_fences[i]);
+			m_fences[i] = nullptr;
+		}
+	}
+
+	if (m_pbos[0])
+	{
+		glDeleteBuffers(SDSM_READBACK_LATENCY, &m_pbos[0]);
+
+		for (int i = 0; i < SDSM_READBACK_LATENCY; i++)
+			m_pbos[i] = 0;
+	}
+
+	if (m_vao)
+	{
+		glDeleteVertexArrays(1, &m_vao);
+		m_vao = 0;
+	}
+
+	for (RenderTarget*& level : m_levels)
+		m_pool->release(level);
+
+	m_levels.clear();
+
+	if (m_pool)
+		m_pool->release(m_histogram_target);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SDSMReduction::reduce(dw::Texture2D* depth, float near_plane, float far_plane, uint32_t tag)
+{
+	// Every slot is still in flight, drop this frame rather than stalling.
+	if (m_fences[m_write_index])
+		return;
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	m_program->use();
+	m_program->set_uniform("s_Source", 0);
+
+	glBindVertexArray(m_vao);
+
+	for (uint32_t i = 0; i < m_levels.size(); i++)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_levels[i]->framebuffer());
+		glViewport(0, 0, m_levels[i]->m_desc.width, m_levels[i]->m_desc.height);
+
+		if (i == 0)
+			depth->bind(0);
+		else
+			m_levels[i - 1]->texture()->bind(0);
+
+		m_program->set_uniform("u_FirstPass", i == 0 ? 1 : 0);
+
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	// Bin every pixel over the range of the last level.
+	if (m_histogram_enabled)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_histogram_target->framebuffer());
+		glViewport(0, 0, DEPTH_HISTOGRAM_BINS, 1);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+
+		m_histogram_program->use();
+		m_histogram_program->set_uniform("s_Depth", 0);
+		m_histogram_program->set_uniform("s_Range", 1);
+		m_histogram_program->set_uniform("u_Near", near_plane);
+		m_histogram_program->set_uniform("u_Far", far_plane);
+		m_histogram_program->set_uniform("u_Bins", DEPTH_HISTOGRAM_BINS);
+
+		depth->bind(0);
+		m_levels.back()->texture()->bind(1);
+
+		glDrawArrays(GL_POINTS, 0, m_width * m_height);
+
+		glDisable(GL_BLEND);
+	}
+
+	// Queue the readback of the range and the histogram.
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[m_write_index]);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_levels.back()->framebuffer());
+	glReadPixels(0, 0, 1, 1, GL_RG, GL_FLOAT, nullptr);
+
+	if (m_histogram_enabled)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_histogram_target->framebuffer());
+		glReadPixels(0, 0, DEPTH_HISTOGRAM_BINS, 1, GL_RED, GL_FLOAT, (void*)(2 * sizeof(float)));
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	m_fences[m_write_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_near_planes[m_write_index] = near_plane;
+	m_far_planes[m_write_index] = far_plane;
+	m_tags[m_write_index] = tag;
+	m_histograms[m_write_index] = m_histogram_enabled;
+	m_write_index = (m_write_index + 1) % SDSM_READBACK_LATENCY;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glEnable(GL_DEPTH_TEST);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool SDSMReduction::poll()
+{
+	bool updated = false;
+
+	// Consume every completed readback, oldest first, without blocking.
+	for (int i = 0; i < SDSM_READBACK_LATENCY; i++)
+	{
+		int index = (m_write_index + i) % SDSM_READBACK_LATENCY;
+
+		if (!m_fences[index])
+			continue;
+
+		GLenum status = glClientWaitSync(m_fences[index], 0, 0);
+
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+
+		glDeleteSync(m_fences[index]);
+		m_fences[index] = nullptr;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[index]);
+		void* ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(m_readback), GL_MAP_READ_BIT);
+
+		if (ptr)
+		{
+			memcpy(m_readback, ptr, sizeof(m_readback));
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+			m_range = reduce_depth_min_max(m_readback, 1, m_near_planes[index], m_far_planes[index]);
+			m_result_tag = m_tags[index];
+			m_histogram_valid = m_histograms[index] && m_range.valid;
+
+			if (m_histogram_valid)
+			{
+				for (int j = 0; j < DEPTH_HISTOGRAM_BINS; j++)
+					m_histogram[j] = uint32_t(m_readback[2 + j]);
+			}
+
+			updated = true;
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	return updated;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "depth_reduction.h"
+#include "program_cache.h"
+#include "render_target_pool.h"
+#include <ogl.h>
+#include <memory>
+#include <vector>
+
+#define SDSM_REDUCTION_FACTOR 4
+#define SDSM_READBACK_LATENCY 3
+#define SDSM_READBACK_FLOATS (2 + DEPTH_HISTOGRAM_BINS) // (min, max) followed by the histogram.
+
+// GPU depth reduction for Sample Distribution Shadow Maps. Reduces the main camera's depth buffer to a single (min, max) texel with a
+// chain of 4x4 gather passes, then bins every pixel of the depth buffer by its linear depth over that range: one point per pixel,
+// accumulated into a DEPTH_HISTOGRAM_BINS x 1 target by additive blending. Both are read back through a ring of pixel buffers guarded
+// by fences so the CPU never waits on the GPU.
+struct SDSMReduction
+{
+	int m_width = 0;
+	int m_height = 0;
+	RenderTargetPool* m_pool = nullptr;
+	std::vector<RenderTarget*> m_levels;
+	RenderTarget* m_histogram_target = nullptr;
+	std::unique_ptr<CachedProgram> m_program;
+	std::unique_ptr<CachedProgram> m_histogram_program;
+	GLuint m_vao = 0;
+
+	// Async readback ring.
+	GLuint m_pbos[SDSM_READBACK_LATENCY];
+	GLsync m_fences[SDSM_READBACK_LATENCY];
+	float m_near_planes[SDSM_READBACK_LATENCY];
+	float m_far_planes[SDSM_READBACK_LATENCY];
+	uint32_t m_tags[SDSM_READBACK_LATENCY];
+	bool m_histograms[SDSM_READBACK_LATENCY]; // The slot holds a histogram.
+	int m_write_index = 0;
+	float m_readback[SDSM_READBACK_FLOATS];
+
+	// Latest completed result.
+	DepthRange m_range;
+	uint32_t m_histogram[DEPTH_HISTOGRAM_BINS]; // Pixels of the depth buffer in every bin.
+	bool m_histogram_valid = false;
+	uint32_t m_result_tag = 0; // Tag passed to the reduce the latest result comes from.
+	bool m_histogram_enabled = true;
+
+	SDSMReduction();
+	~SDSMReduction();
+	bool initialize(ProgramCache& cache, RenderTargetPool& pool, int width, int height);
+	void shutdown();
+	void reduce(dw::Texture2D* depth, float near_plane, float far_plane, uint32_t tag = 0);
+	bool poll();
+
+	inline const DepthRange& depth_range() { return m_range; }
+	inline const uint32_t* histogram() { return m_histogram_enabled && m_histogram_valid ? m_histogram : nullptr; }
+};
@@ -0,0 +1,215 @@
+#include "shadow_atlas.h"
+#include <macros.h>
+#include <algorithm>
+
+ShadowAtlas::ShadowAtlas()
+{
+	for (int i = 0; i < SHADOW_ATLAS_MAX_RECTS; i++)
+	{
+		m_sizes[i] = 0;
+		m_max_sizes[i] = 0;
+		m_rects[i] = { 0, 0, 0 };
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowAtlas::pack(const int* sizes, int count, int width, ShadowAtlasRect* rects, int& height)
+{
+	// Largest first, nearest cascade first among equal sizes.
+	int order[SHADOW_ATLAS_MAX_RECTS];
+
+	for (int i = 0; i < count; i++)
+		order[i] = i;
+
+	std::stable_sort(order, order + count, [&](int a, int b) { return sizes[a] > sizes[b]; });
+
+	int shelf_y = 0;
+	int shelf_height = 0;
+	int cursor_x = 0;
+	int column_x = 0;
+	int column_size = 0;
+	int column_y = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		int size = sizes[order[i]];
+
+		if (size > width)
+			return false;
+
+		ShadowAtlasRect& rect = rects[order[i]];
+		rect.size = size;
+
+		// Stack onto the current column if it holds rects of the same size and there is room left in the shelf.
+		if (size == column_size && column_y + size <= shelf_height)
+		{
+			rect.x = column_x;
+			rect.y = shelf_y + column_y;
+			column_y += size;
+			continue;
+		}
+
+		// Start a new column next to the previous one, or a new shelf on top of the previous one.
+		if (shelf_height == 0 || cursor_x + size > width)
+		{
+			shelf_y += shelf_height;
+			shelf_height = size;
+			cursor_x = 0;
+		}
+
+		column_x = cursor_x;
+		column_size = size;
+		column_y = size;
+		cursor_x += size;
+
+		rect.x = column_x;
+		rect.y = shelf_y;
+	}
+
+	height = shelf_y + shelf_height;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowAtlas::pack(const int* sizes, int count, int bytes_per_texel)
+{
+	int largest = 0;
+
+	for (int i = 0; i < count; i++)
+		largest = std::max(largest, sizes[i]);
+
+	if (largest <= 0)
+		return false;
+
+	size_t best_texels = 0;
+	int best_extent = 0;
+	bool found = false;
+
+	for (int width = largest; width <= SHADOW_ATLAS_MAX_SIZE; width *= 2)
+	{
+		ShadowAtlasRect rects[SHADOW_ATLAS_MAX_RECTS];
+		int height = 0;
+
+		if (!pack(sizes, count, width, rects, height) || height > SHADOW_ATLAS_MAX_SIZE)
+			continue;
+
+		// On a tie keep the squarer layout.
+		size_t texels = (size_t)width * height;
+		int extent = std::max(width, height);
+
+		if (found && (texels > best_texels || (texels == best_texels && extent >= best_extent)))
+			continue;
+
+		found = true;
+		best_texels = texels;
+		best_extent = extent;
+		m_width = width;
+		m_height = height;
+
+		for (int i = 0; i < count; i++)
+			m_rects[i] = rects[i];
+	}
+
+	if (!found)
+		return false;
+
+	for (int i = 0; i < count; i++)
+		m_sizes[i] = sizes[i];
+
+	m_count = count;
+	m_bytes_per_texel = bytes_per_texel;
+	m_memory_used = best_texels * bytes_per_texel;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowAtlas::allocate(int max_size, int count, size_t budget, int bytes_per_texel)
+{
+	int max_sizes[SHADOW_ATLAS_MAX_RECTS];
+
+	for (int i = 0; i < count; i++)
+		max_sizes[i] = max_size;
+
+	return allocate(max_sizes, count, budget, bytes_per_texel);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowAtlas::allocate(const int* max_sizes, int count, size_t budget, int bytes_per_texel)
+{
+	int sizes[SHADOW_ATLAS_MAX_RECTS];
+	int min_sizes[SHADOW_ATLAS_MAX_RECTS];
+
+	for (int i = 0; i < count; i++)
+	{
+		m_max_sizes[i] = max_sizes[i];
+		sizes[i] = max_sizes[i];
+		min_sizes[i] = std::min(max_sizes[i], SHADOW_ATLAS_MIN_CASCADE_SIZE);
+	}
+
+	while (true)
+	{
+		if (!pack(sizes, count, bytes_per_texel))
+		{
+			DW_LOG_FATAL("Failed to pack shadow atlas");
+			return false;
+		}
+
+		// A budget of zero disables the limit.
+		if (budget == 0 || m_memory_used <= budget)
+			return true;
+
+		// Halve the farthest of the largest cascades: distant cascades cover more of the scene per texel already, and halving the
+		// largest first keeps the resolution falloff gradual.
+		int victim = -1;
+
+		for (int i = 0; i < count; i++)
+		{
+			if (sizes[i] > min_sizes[i] && (victim < 0 || sizes[i] >= sizes[victim]))
+				victim = i;
+		}
+
+		if (victim < 0)
+		{
+			DW_LOG_WARNING("Shadow atlas does not fit the memory budget at the minimum cascade size");
+			return true;
+		}
+
+		sizes[victim] /= 2;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+glm::vec4 ShadowAtlas::uv_rect(int i)
+{
+	const ShadowAtlasRect& rect = m_rects[i];
+
+	return glm::vec4(float(rect.x) / float(m_width),
+					 float(rect.y) / float(m_height),
+					 float(rect.size) / float(m_width),
+					 float(rect.size) / float(m_height));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowAtlas::slice(const ShadowAtlas& atlas, int first, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		m_sizes[i] = atlas.m_sizes[first + i];
+		m_max_sizes[i] = atlas.m_max_sizes[first + i];
+		m_rects[i] = atlas.m_rects[first + i];
+	}
+
+	m_count = count;
+	m_width = atlas.m_width;
+	m_height = atlas.m_height;
+	m_bytes_per_texel = atlas.m_bytes_per_texel;
+	m_memory_used = atlas.m_memory_used;
+}
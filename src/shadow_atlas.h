@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glm.hpp>
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHADOW_ATLAS_MAX_RECTS 16
+#define SHADOW_ATLAS_MAX_SIZE 16384
+#define SHADOW_ATLAS_MIN_CASCADE_SIZE 256
+
+// Square region of the atlas, in texels.
+struct ShadowAtlasRect
+{
+	int x;
+	int y;
+	int size;
+};
+
+// Packs square cascades of power of two sizes into a single texture. Rects are placed on shelves as tall as their first (largest)
+// rect, smaller rects being stacked into columns within the shelf. Every power of two width from the largest rect up to
+// SHADOW_ATLAS_MAX_SIZE is tried and the layout using the least memory is kept.
+struct ShadowAtlas
+{
+	int m_count = 0;
+	int m_width = 0;
+	int m_height = 0;
+	int m_bytes_per_texel = 4;
+	size_t m_memory_used = 0;
+	int m_sizes[SHADOW_ATLAS_MAX_RECTS];
+	int m_max_sizes[SHADOW_ATLAS_MAX_RECTS]; // Requested sizes, before the memory budget.
+	ShadowAtlasRect m_rects[SHADOW_ATLAS_MAX_RECTS];
+
+	ShadowAtlas();
+	bool pack(const int* sizes, int count, int bytes_per_texel);
+	bool allocate(int max_size, int count, size_t budget, int bytes_per_texel);
+	bool allocate(const int* max_sizes, int count, size_t budget, int bytes_per_texel);
+	void slice(const ShadowAtlas& atlas, int first, int count); // Rects first to first + count of a shared atlas.
+	glm::vec4 uv_rect(int i); // xy: offset, zw: scale, in normalized atlas coordinates.
+
+	static bool pack(const int* sizes, int count, int width, ShadowAtlasRect* rects, int& height);
+};
@@ -0,0 +1,207 @@
+#include "shadow_lights.h"
+#include <macros.h>
+#include <string>
+
+void ShadowLights::initialize(CSM* primary)
+{
+	m_primary = primary;
+	m_primary->m_group = this;
+	m_lights[0].enabled = true;
+
+	for (int i = 0; i < MAX_SHADOW_LIGHTS - 1; i++)
+	{
+		m_secondary[i].m_group = this;
+		m_secondary[i].m_owns_atlas = false;
+	}
+
+	for (int i = 0; i < MAX_SHADOW_LIGHTS; i++)
+		m_first_cascade[i] = -1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowLights::shutdown()
+{
+	for (int i = 0; i < MAX_SHADOW_LIGHTS - 1; i++)
+		m_secondary[i].shutdown();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowLights::allocate(bool reacquire)
+{
+	int sizes[SHADOW_ATLAS_MAX_RECTS];
+	int count = 0;
+
+	for (int i = 0; i < MAX_SHADOW_LIGHTS; i++)
+	{
+		m_first_cascade[i] = -1;
+
+		if (!enabled(i))
+			continue;
+
+		CSM* csm = light(i);
+
+		if (count + csm->m_split_count > MAX_SHADOW_CASCADES)
+		{
+			DW_LOG_ERROR("Shadow light " + std::to_string(i) + " does not fit in the atlas, the lights have more than " + std::to_string(MAX_SHADOW_CASCADES) + " cascades");
+			m_lights[i].enabled = false;
+			continue;
+		}
+
+		m_first_cascade[i] = count;
+
+		for (int j = 0; j < csm->m_split_count; j++)
+			sizes[count++] = csm->m_shadow_map_size;
+	}
+
+	ShadowAtlas atlas;
+
+	// Every light shares the budget of the primary: the farthest of the largest cascades are halved first, whichever light they belong to.
+	bool packed = atlas.allocate(sizes, count, m_primary->m_memory_budget, m_primary->bytes_per_texel());
+
+	m_atlas = atlas;
+	m_cascade_count = count;
+
+	for (int i = 0; i < MAX_SHADOW_LIGHTS; i++)
+	{
+		if (m_first_cascade[i] < 0)
+			continue;
+
+		CSM* csm = light(i);
+
+		csm->m_atlas.slice(m_atlas, m_first_cascade[i], csm->m_split_count);
+		csm->update_atlas_matrices();
+		csm->invalidate();
+	}
+
+	if (reacquire && m_primary->m_atlas_target)
+		m_primary->update_resources();
+
+	// Every consumer of the layout keys on the generation of the primary.
+	m_primary->m_generation++;
+
+	return packed;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowLights::enable(int light, bool enabled, dw::Camera* camera, int width, int height)
+{
+	ShadowLight& settings = m_lights[light];
+	settings.enabled = enabled;
+
+	if (!enabled)
+	{
+		allocate(true);
+		return;
+	}
+
+	CSM& csm = m_secondary[light - 1];
+	csm.m_depth_format = m_primary->m_depth_format;
+	csm.initialize(m_primary->m_lambda, m_primary->m_near_offset, settings.split_count, settings.shadow_map_size, camera, width, height, settings.direction);
+	sync_settings();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowLights::resize(dw::Camera* camera, int width, int height)
+{
+	for (int i = 1; i < MAX_SHADOW_LIGHTS; i++)
+	{
+		if (m_lights[i].enabled)
+			enable(i, true, camera, width, height);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowLights::sync_settings()
+{
+	for (int i = 1; i < MAX_SHADOW_LIGHTS; i++)
+	{
+		if (!m_lights[i].enabled)
+			continue;
+
+		CSM& csm = m_secondary[i - 1];
+
+		if (csm.m_fit_scene_depth != m_primary->m_fit_scene_depth || csm.m_dirty_tracking != m_primary->m_dirty_tracking)
+			csm.invalidate();
+
+		// Lambda, stable PSSM and SDSM are part of the update state and trigger a solve on their own.
+		csm.m_lambda = m_primary->m_lambda;
+		csm.m_stable_pssm = m_primary->m_stable_pssm;
+		csm.m_sdsm = m_primary->m_sdsm;
+		csm.m_fit_scene_depth = m_primary->m_fit_scene_depth;
+		csm.m_dirty_tracking = m_primary->m_dirty_tracking;
+
+		for (int j = 0; j < csm.m_split_count; j++)
+			csm.m_refresh_intervals[j] = m_primary->m_refresh_intervals[j];
+
+		csm.set_depth_range(m_primary->m_depth_range, m_primary->m_depth_histogram_valid ? m_primary->m_depth_histogram : nullptr);
+
+		if (m_primary->m_scene_bounds_valid)
+			csm.set_scene_bounds(m_primary->m_caster_min, m_primary->m_caster_max, m_primary->m_receiver_min, m_primary->m_receiver_max);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int ShadowLights::views(dw::Camera* camera, glm::vec3 primary_direction, CSMBatchView* views)
+{
+	int count = 0;
+
+	for (int i = 0; i < MAX_SHADOW_LIGHTS; i++)
+	{
+		if (m_first_cascade[i] < 0)
+			continue;
+
+		views[count].csm = light(i);
+		views[count].camera = camera;
+		views[count].direction = i == 0 ? primary_direction : m_lights[i].direction;
+		count++;
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int ShadowLights::crop_matrices(glm::mat4* crop_matrices)
+{
+	for (int i = 0; i < MAX_SHADOW_LIGHTS; i++)
+	{
+		if (m_first_cascade[i] < 0)
+			continue;
+
+		CSM* csm = light(i);
+
+		for (int j = 0; j < csm->m_split_count; j++)
+			crop_matrices[m_first_cascade[i] + j] = csm->split_view_proj(j);
+	}
+
+	return m_cascade_count;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int ShadowLights::light_count()
+{
+	int count = 0;
+
+	for (int i = 0; i < MAX_SHADOW_LIGHTS; i++)
+	{
+		if (m_first_cascade[i] >= 0)
+			count++;
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowLights::invalidate()
+{
+	for (int i = 0; i < MAX_SHADOW_LIGHTS; i++)
+		light(i)->invalidate();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "csm.h"
+#include "csm_batch.h"
+
+#define MAX_SHADOW_LIGHTS 3
+#define MAX_SHADOW_CASCADES 16 // Cascades of every light together, as packed in the shared atlas.
+
+// Settings of one shadowed directional light. Light 0 is the primary light, whose direction is driven by the sample.
+struct ShadowLight
+{
+	glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	glm::vec3 color = glm::vec3(1.0f);
+	int split_count = 2;
+	int shadow_map_size = 1024; // Size of the largest cascade of the light, reduced like the others to fit the budget.
+	bool enabled = false;
+};
+
+// Several shadowed directional lights sharing the atlas of the primary CSM. Every light keeps its own split scheme and crop matrices,
+// solved together by CSMBatch, while its cascades are packed after those of the previous lights in a single depth texture under the
+// memory budget of the primary. Global cascade indices follow the packing order: light 0 first, then every enabled secondary light.
+struct ShadowLights
+{
+	CSM* m_primary = nullptr;
+	CSM m_secondary[MAX_SHADOW_LIGHTS - 1];
+	ShadowLight m_lights[MAX_SHADOW_LIGHTS];
+	ShadowAtlas m_atlas;
+	int m_first_cascade[MAX_SHADOW_LIGHTS]; // Global index of the first cascade of each light, -1 when disabled.
+	int m_cascade_count = 0;
+
+	void initialize(CSM* primary);
+	void shutdown();
+	bool allocate(bool reacquire);
+	void enable(int light, bool enabled, dw::Camera* camera, int width, int height);
+	void resize(dw::Camera* camera, int width, int height);
+	void sync_settings();
+	void invalidate(); // Redraws every cascade of every light on the next update.
+	int views(dw::Camera* camera, glm::vec3 primary_direction, CSMBatchView* views);
+	int crop_matrices(glm::mat4* crop_matrices);
+	int light_count();
+
+	inline CSM* light(int i) { return i == 0 ? m_primary : &m_secondary[i - 1]; }
+	inline bool enabled(int i) { return i == 0 || m_lights[i].enabled; }
+	inline const ShadowAtlasRect& atlas_rect(int cascade) { return m_atlas.m_rects[cascade]; }
+	inline int cascade_size(int cascade) { return m_atlas.m_sizes[cascade]; }
+	inline int max_cascade_size(int cascade) { return m_atlas.m_max_sizes[cascade]; }
+};
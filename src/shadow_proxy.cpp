@@ -0,0 +1,400 @@
+#include "shadow_proxy.h"
+#include "mesh_cache.h"
+#include <macros.h>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// On-disk header, followed by the commands of every level, then the positions and the indices.
+struct ShadowProxyHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash;
+	uint32_t level_count;
+	uint32_t submesh_count;
+	uint32_t position_count;
+	uint32_t index_count;
+	float    base_cell;
+	float    cell_growth;
+	float    cell_sizes[SHADOW_PROXY_LEVELS];
+	uint32_t padding;
+};
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+// Packs the integer coordinates of a grid cell, 21 bits per axis.
+static uint64_t cell_key(const glm::vec3& position, float cell_size)
+{
+	uint64_t x = uint64_t(int64_t(floorf(position.x / cell_size)) + (1 << 20)) & 0x1fffff;
+	uint64_t y = uint64_t(int64_t(floorf(position.y / cell_size)) + (1 << 20)) & 0x1fffff;
+	uint64_t z = uint64_t(int64_t(floorf(position.z / cell_size)) + (1 << 20)) & 0x1fffff;
+
+	return x | (y << 21) | (z << 42);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+ShadowProxy::ShadowProxy()
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+ShadowProxy::~ShadowProxy()
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowProxy::initialize(dw::Mesh* mesh, const std::string& source_path)
+{
+	shutdown();
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	m_submesh_count = mesh->sub_mesh_count();
+	m_source_triangles.resize(m_submesh_count);
+
+	for (uint32_t i = 0; i < m_submesh_count; i++)
+		m_source_triangles[i] = mesh->sub_meshes()[i].index_count / 3;
+
+	std::string cache_path = source_path + SHADOW_PROXY_EXTENSION;
+	uint64_t source_hash = 0;
+	bool hashed = MeshCache::hash_file(source_path, source_hash);
+
+	if (hashed && load(cache_path, source_hash))
+	{
+		DW_LOG_INFO("Loaded shadow proxies from " + cache_path + " in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()) + " ms");
+		return true;
+	}
+
+	build(mesh);
+
+	bool success = upload(m_positions.data(), (uint32_t)m_positions.size(), m_indices.data(), (uint32_t)m_indices.size());
+
+	if (success && hashed)
+		save(cache_path, source_hash);
+
+	m_positions.clear();
+	m_positions.shrink_to_fit();
+	m_indices.clear();
+	m_indices.shrink_to_fit();
+
+	DW_LOG_INFO("Built shadow proxies in " + std::to_string(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()) + " ms");
+
+	return success;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowProxy::shutdown()
+{
+	for (int i = 0; i < SHADOW_PROXY_LEVELS; i++)
+	{
+		m_levels[i].draws.shutdown();
+		m_levels[i].commands.clear();
+		m_levels[i].triangle_count = 0;
+
+		if (m_levels[i].vao)
+		{
+			glDeleteVertexArrays(1, &m_levels[i].vao);
+			m_levels[i].vao = 0;
+		}
+	}
+
+	if (m_vbo)
+	{
+		glDeleteBuffers(1, &m_vbo);
+		m_vbo = 0;
+	}
+
+	if (m_ibo)
+	{
+		glDeleteBuffers(1, &m_ibo);
+		m_ibo = 0;
+	}
+
+	m_positions.clear();
+	m_indices.clear();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void ShadowProxy::build(dw::Mesh* mesh)
+{
+	const dw::Vertex* vertices = mesh->vertices();
+	const uint32_t* indices = mesh->indices();
+	uint32_t vertex_count = mesh->vertex_count();
+
+	float diagonal = glm::length(mesh->max_extents() - mesh->min_extents());
+	float cell_size = diagonal / SHADOW_PROXY_BASE_CELL;
+
+	m_positions.clear();
+	m_indices.clear();
+
+	std::unordered_map<uint64_t, uint32_t> clusters;
+	std::vector<uint32_t> remap(vertex_count);
+	std::vector<glm::vec3> sums;
+	std::vector<uint32_t> counts;
+	std::unordered_set<uint64_t> triangles;
+
+	for (int l = 0; l < SHADOW_PROXY_LEVELS; l++, cell_size *= SHADOW_PROXY_CELL_GROWTH)
+	{
+		ShadowProxyLevel& level = m_levels[l];
+		level.cell_size = cell_size;
+		level.triangle_count = 0;
+		level.commands.resize(m_submesh_count);
+
+		// Merge the vertices of the whole mesh by cell, every submesh of the level indexes the same clusters.
+		clusters.clear();
+		sums.clear();
+		counts.clear();
+
+		for (uint32_t v = 0; v < vertex_count; v++)
+		{
+			auto result = clusters.emplace(cell_key(vertices[v].position, cell_size), (uint32_t)sums.size());
+
+			if (result.second)
+			{
+				sums.push_back(glm::vec3(0.0f));
+				counts.push_back(0);
+			}
+
+			remap[v] = result.first->second;
+			sums[remap[v]] += vertices[v].position;
+			counts[remap[v]]++;
+		}
+
+		uint32_t base_vertex = (uint32_t)m_positions.size();
+
+		for (uint32_t c = 0; c < sums.size(); c++)
+			m_positions.push_back(sums[c] / float(counts[c]));
+
+		for (uint32_t i = 0; i < m_submesh_count; i++)
+		{
+			const dw::SubMesh& submesh = mesh->sub_meshes()[i];
+			DrawElementsIndirectCommand& cmd = level.commands[i];
+
+			cmd.first_index = (uint32_t)m_indices.size();
+			cmd.instance_count = 1;
+			cmd.base_vertex = (int32_t)base_vertex;
+			cmd.base_instance = i;
+
+			triangles.clear();
+
+			for (uint32_t t = 0; t < submesh.index_count; t += 3)
+			{
+				uint32_t a = remap[submesh.base_vertex + indices[submesh.base_index + t]];
+				uint32_t b = remap[submesh.base_vertex + indices[submesh.base_index + t + 1]];
+				uint32_t c = remap[submesh.base_vertex + indices[submesh.base_index + t + 2]];
+
+				// Collapsed into a line or a point.
+				if (a == b || b == c || a == c)
+					continue;
+
+				// Drop duplicates, rotating the smallest index first to keep the winding.
+				uint64_t first = std::min(a, std::min(b, c));
+				uint64_t key = first == a ? (uint64_t(a) << 42) | (uint64_t(b) << 21) | c :
+							   first == b ? (uint64_t(b) << 42) | (uint64_t(c) << 21) | a :
+											(uint64_t(c) << 42) | (uint64_t(a) << 21) | b;
+
+				if (!triangles.insert(key).second)
+					continue;
+
+				m_indices.push_back(a);
+				m_indices.push_back(b);
+				m_indices.push_back(c);
+			}
+
+			cmd.count = (uint32_t)m_indices.size() - cmd.first_index;
+			level.triangle_count += cmd.count / 3;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowProxy::load(const std::string& path, uint64_t source_hash)
+{
+	MappedFile file;
+
+	if (!file.open(path) || file.m_size < sizeof(ShadowProxyHeader))
+		return false;
+
+	const ShadowProxyHeader* header = (const ShadowProxyHeader*)file.m_data;
+
+	if (header->magic != SHADOW_PROXY_MAGIC || header->version != SHADOW_PROXY_VERSION || header->source_hash != source_hash ||
+		header->level_count != SHADOW_PROXY_LEVELS || header->submesh_count != m_submesh_count ||
+		header->base_cell != SHADOW_PROXY_BASE_CELL || header->cell_growth != SHADOW_PROXY_CELL_GROWTH)
+		return false;
+
+	uint64_t commands_size = uint64_t(header->level_count) * header->submesh_count * sizeof(DrawElementsIndirectCommand);
+	uint64_t positions_offset = sizeof(ShadowProxyHeader) + commands_size;
+	uint64_t indices_offset = positions_offset + uint64_t(header->position_count) * sizeof(glm::vec3);
+
+	if (indices_offset + uint64_t(header->index_count) * sizeof(uint32_t) > file.m_size)
+	{
+		DW_LOG_ERROR("Truncated shadow proxy cache " + path);
+		return false;
+	}
+
+	const DrawElementsIndirectCommand* commands = (const DrawElementsIndirectCommand*)(file.m_data + sizeof(ShadowProxyHeader));
+
+	for (int l = 0; l < SHADOW_PROXY_LEVELS; l++)
+	{
+		ShadowProxyLevel& level = m_levels[l];
+		level.cell_size = header->cell_sizes[l];
+		level.commands.assign(commands + l * m_submesh_count, commands + (l + 1) * m_submesh_count);
+		level.triangle_count = 0;
+
+		for (const auto& cmd : level.commands)
+			level.triangle_count += cmd.count / 3;
+	}
+
+	// Uploaded straight from the mapping.
+	return upload((const glm::vec3*)(file.m_data + positions_offset), header->position_count, (const uint32_t*)(file.m_data + indices_offset), header->index_count);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowProxy::save(const std::string& path, uint64_t source_hash)
+{
+	ShadowProxyHeader header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = SHADOW_PROXY_MAGIC;
+	header.version = SHADOW_PROXY_VERSION;
+	header.source_hash = source_hash;
+	header.level_count = SHADOW_PROXY_LEVELS;
+	header.submesh_count = m_submesh_count;
+	header.position_count = (uint32_t)m_positions.size();
+	header.index_count = (uint32_t)m_indices.size();
+	header.base_cell = SHADOW_PROXY_BASE_CELL;
+	header.cell_growth = SHADOW_PROXY_CELL_GROWTH;
+
+	for (int l = 0; l < SHADOW_PROXY_LEVELS; l++)
+		header.cell_sizes[l] = m_levels[l].cell_size;
+
+	std::string temp_path = path + ".tmp";
+	FILE* file = fopen(temp_path.c_str(), "wb");
+
+	if (!file)
+	{
+		DW_LOG_ERROR("Failed to open " + temp_path + " for writing");
+		return false;
+	}
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	for (int l = 0; l < SHADOW_PROXY_LEVELS && success; l++)
+		success = fwrite(m_levels[l].commands.data(), sizeof(DrawElementsIndirectCommand), m_submesh_count, file) == m_submesh_count;
+
+	if (success && !m_positions.empty())
+		success = fwrite(m_positions.data(), sizeof(glm::vec3), m_positions.size(), file) == m_positions.size();
+
+	if (success && !m_indices.empty())
+		success = fwrite(m_indices.data(), sizeof(uint32_t), m_indices.size(), file) == m_indices.size();
+
+	success = fclose(file) == 0 && success;
+
+	if (success)
+	{
+		remove(path.c_str());
+		success = rename(temp_path.c_str(), path.c_str()) == 0;
+	}
+
+	if (!success)
+	{
+		DW_LOG_ERROR("Failed to write shadow proxy cache " + path);
+		remove(temp_path.c_str());
+	}
+
+	return success;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowProxy::upload(const glm::vec3* positions, uint32_t position_count, const uint32_t* indices, uint32_t index_count)
+{
+	glGenBuffers(1, &m_vbo);
+	glGenBuffers(1, &m_ibo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+	glBufferData(GL_ARRAY_BUFFER, size_t(position_count) * sizeof(glm::vec3), positions, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, size_t(index_count) * sizeof(uint32_t), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// One vertex array per level over the same buffers: the per-draw attributes are vertex array state, so levels sharing one would
+	// all read the draw data of the last level initialized.
+	for (int l = 0; l < SHADOW_PROXY_LEVELS; l++)
+	{
+		ShadowProxyLevel& level = m_levels[l];
+
+		glGenVertexArrays(1, &level.vao);
+		glBindVertexArray(level.vao);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+
+		// Position only, the shadow vertex shaders read nothing else from the vertex.
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		if (!level.draws.initialize(level.vao, level.commands.data(), m_submesh_count))
+			return false;
+	}
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+int ShadowProxy::select(float world_units_per_texel, float tolerance)
+{
+	int selected = 0;
+
+	for (int l = 0; l < SHADOW_PROXY_LEVELS; l++)
+	{
+		if (m_levels[l].cell_size > world_units_per_texel * tolerance)
+			break;
+
+		selected = l + 1;
+	}
+
+	return selected;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+uint32_t ShadowProxy::triangle_count(int level, const std::vector<uint32_t>* draws)
+{
+	uint32_t count = 0;
+
+	if (!draws)
+	{
+		if (level > 0)
+			return m_levels[level - 1].triangle_count;
+
+		for (uint32_t triangles : m_source_triangles)
+			count += triangles;
+
+		return count;
+	}
+
+	for (uint32_t draw : *draws)
+		count += level > 0 ? m_levels[level - 1].commands[draw].count / 3 : m_source_triangles[draw];
+
+	return count;
+}
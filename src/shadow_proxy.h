@@ -0,0 +1,55 @@
+#pragma once
+
+#include "indirect_draw.h"
+#include <mesh.h>
+#include <ogl.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define SHADOW_PROXY_MAGIC 0x58525053 // "SPRX"
+#define SHADOW_PROXY_VERSION 1
+#define SHADOW_PROXY_LEVELS 3          // Simplified levels, level 0 being the source mesh itself.
+#define SHADOW_PROXY_BASE_CELL 2048.0f // Cell size of the first level, as a fraction of the mesh diagonal.
+#define SHADOW_PROXY_CELL_GROWTH 4.0f  // Cell size ratio between consecutive levels.
+#define SHADOW_PROXY_EXTENSION ".shadowproxy"
+
+// One simplified level of the mesh. Keeps one command per submesh, in the order of the source, so that the caster visibility lists
+// apply to every level.
+struct ShadowProxyLevel
+{
+	float cell_size = 0.0f; // Clustering cell size in object space, an upper bound of the error along each axis.
+	uint32_t triangle_count = 0;
+	std::vector<DrawElementsIndirectCommand> commands;
+	GLuint vao = 0; // Shares the buffers of the proxy, but every level attaches its own per-draw data.
+	IndirectMesh draws;
+};
+
+// Position-only shadow casters simplified by vertex clustering: vertices of a submesh falling in the same cell of a grid are merged
+// into their average and the triangles that collapse are dropped. The grid is shared by every submesh so that neighbouring submeshes
+// stay welded. Cells grow by SHADOW_PROXY_CELL_GROWTH from one level to the next, and a cascade uses the coarsest level whose cells
+// are still smaller than its texels so that the simplification stays below the resolution of the shadow map. Built when the mesh is
+// loaded and cached next to the source as <source>.shadowproxy, keyed on the source hash.
+struct ShadowProxy
+{
+	ShadowProxyLevel m_levels[SHADOW_PROXY_LEVELS];
+	std::vector<glm::vec3> m_positions; // Every level, only kept until uploaded.
+	std::vector<uint32_t> m_indices;
+	std::vector<uint32_t> m_source_triangles; // Per submesh, for level 0.
+	uint32_t m_submesh_count = 0;
+	GLuint m_vbo = 0;
+	GLuint m_ibo = 0;
+
+	ShadowProxy();
+	~ShadowProxy();
+	bool initialize(dw::Mesh* mesh, const std::string& source_path);
+	void shutdown();
+	void build(dw::Mesh* mesh);
+	bool load(const std::string& path, uint64_t source_hash);
+	bool save(const std::string& path, uint64_t source_hash);
+	bool upload(const glm::vec3* positions, uint32_t position_count, const uint32_t* indices, uint32_t index_count);
+	int select(float world_units_per_texel, float tolerance); // 0 for the source mesh, otherwise level + 1.
+	uint32_t triangle_count(int level, const std::vector<uint32_t>* draws);
+
+	inline ShadowProxyLevel& level(int i) { return m_levels[i - 1]; }
+};
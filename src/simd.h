@@ -0,0 +1,133 @@
+#pragma once
+
+#include <math.h>
+
+// SIMD abstraction used by the CPU kernels. Every kernel is written once against these helpers and processes CSM_SIMD_WIDTH lanes
+// per iteration. Only operations with exactly defined IEEE results are provided (no reciprocal approximations, no fused multiply-add)
+// so that each lane reproduces the equivalent scalar code bit for bit.
+#if defined(CSM_SIMD_AVX) || defined(__AVX__)
+
+#include <immintrin.h>
+
+#define CSM_SIMD_WIDTH 8
+#define CSM_SIMD_NAME "AVX"
+
+typedef __m256 simd_float;
+
+inline simd_float simd_load(const float* p) { return _mm256_load_ps(p); }
+inline void       simd_store(float* p, simd_float a) { _mm256_store_ps(p, a); }
+inline simd_float simd_set1(float a) { return _mm256_set1_ps(a); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm256_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm256_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm256_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm256_div_ps(a, b); }
+inline simd_float simd_min(simd_float a, simd_float b) { return _mm256_min_ps(a, b); }
+inline simd_float simd_max(simd_float a, simd_float b) { return _mm256_max_ps(a, b); }
+inline simd_float simd_sqrt(simd_float a) { return _mm256_sqrt_ps(a); }
+inline simd_float simd_ceil(simd_float a) { return _mm256_ceil_ps(a); }
+inline simd_float simd_loadu(const float* p) { return _mm256_loadu_ps(p); }
+inline void       simd_storeu(float* p, simd_float a) { _mm256_storeu_ps(p, a); }
+inline simd_float simd_ramp() { return _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f); }
+inline simd_float simd_cmp_gt(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline simd_float simd_cmp_ge(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline simd_float simd_cmp_lt(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline simd_float simd_cmp_le(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline simd_float simd_cmp_eq(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+inline simd_float simd_and(simd_float a, simd_float b) { return _mm256_and_ps(a, b); }
+inline simd_float simd_or(simd_float a, simd_float b) { return _mm256_or_ps(a, b); }
+inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm256_blendv_ps(b, a, mask); }
+inline bool       simd_any(simd_float mask) { return _mm256_movemask_ps(mask) != 0; }
+inline int        simd_mask(simd_float mask) { return _mm256_movemask_ps(mask); }
+
+// Rounds half away from zero to match std::round (and therefore glm::round).
+inline simd_float simd_round(simd_float a)
+{
+	simd_float t = _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	simd_float d = _mm256_sub_ps(a, t);
+	simd_float one = _mm256_set1_ps(1.0f);
+	simd_float up = _mm256_and_ps(_mm256_cmp_ps(d, _mm256_set1_ps(0.5f), _CMP_GE_OQ), one);
+	simd_float down = _mm256_and_ps(_mm256_cmp_ps(d, _mm256_set1_ps(-0.5f), _CMP_LE_OQ), one);
+	return _mm256_sub_ps(_mm256_add_ps(t, up), down);
+}
+
+#elif defined(CSM_SIMD_SSE4) || defined(__SSE4_1__)
+
+#include <smmintrin.h>
+
+#define CSM_SIMD_WIDTH 4
+#define CSM_SIMD_NAME "SSE4.1"
+
+typedef __m128 simd_float;
+
+inline simd_float simd_load(const float* p) { return _mm_load_ps(p); }
+inline void       simd_store(float* p, simd_float a) { _mm_store_ps(p, a); }
+inline simd_float simd_set1(float a) { return _mm_set1_ps(a); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm_div_ps(a, b); }
+inline simd_float simd_min(simd_float a, simd_float b) { return _mm_min_ps(a, b); }
+inline simd_float simd_max(simd_float a, simd_float b) { return _mm_max_ps(a, b); }
+inline simd_float simd_sqrt(simd_float a) { return _mm_sqrt_ps(a); }
+inline simd_float simd_ceil(simd_float a) { return _mm_ceil_ps(a); }
+inline simd_float simd_loadu(const float* p) { return _mm_loadu_ps(p); }
+inline void       simd_storeu(float* p, simd_float a) { _mm_storeu_ps(p, a); }
+inline simd_float simd_ramp() { return _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f); }
+inline simd_float simd_cmp_gt(simd_float a, simd_float b) { return _mm_cmpgt_ps(a, b); }
+inline simd_float simd_cmp_ge(simd_float a, simd_float b) { return _mm_cmpge_ps(a, b); }
+inline simd_float simd_cmp_lt(simd_float a, simd_float b) { return _mm_cmplt_ps(a, b); }
+inline simd_float simd_cmp_le(simd_float a, simd_float b) { return _mm_cmple_ps(a, b); }
+inline simd_float simd_cmp_eq(simd_float a, simd_float b) { return _mm_cmpeq_ps(a, b); }
+inline simd_float simd_and(simd_float a, simd_float b) { return _mm_and_ps(a, b); }
+inline simd_float simd_or(simd_float a, simd_float b) { return _mm_or_ps(a, b); }
+inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return _mm_blendv_ps(b, a, mask); }
+inline bool       simd_any(simd_float mask) { return _mm_movemask_ps(mask) != 0; }
+inline int        simd_mask(simd_float mask) { return _mm_movemask_ps(mask); }
+
+// Rounds half away from zero to match std::round (and therefore glm::round).
+inline simd_float simd_round(simd_float a)
+{
+	simd_float t = _mm_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	simd_float d = _mm_sub_ps(a, t);
+	simd_float one = _mm_set1_ps(1.0f);
+	simd_float up = _mm_and_ps(_mm_cmpge_ps(d, _mm_set1_ps(0.5f)), one);
+	simd_float down = _mm_and_ps(_mm_cmple_ps(d, _mm_set1_ps(-0.5f)), one);
+	return _mm_sub_ps(_mm_add_ps(t, up), down);
+}
+
+#else
+
+#define CSM_SIMD_WIDTH 1
+#define CSM_SIMD_NAME "Scalar"
+
+typedef float simd_float;
+
+inline simd_float simd_load(const float* p) { return *p; }
+inline void       simd_store(float* p, simd_float a) { *p = a; }
+inline simd_float simd_set1(float a) { return a; }
+inline simd_float simd_add(simd_float a, simd_float b) { return a + b; }
+inline simd_float simd_sub(simd_float a, simd_float b) { return a - b; }
+inline simd_float simd_mul(simd_float a, simd_float b) { return a * b; }
+inline simd_float simd_div(simd_float a, simd_float b) { return a / b; }
+inline simd_float simd_min(simd_float a, simd_float b) { return a < b ? a : b; }
+inline simd_float simd_max(simd_float a, simd_float b) { return a > b ? a : b; }
+inline simd_float simd_sqrt(simd_float a) { return sqrtf(a); }
+inline simd_float simd_ceil(simd_float a) { return ceilf(a); }
+inline simd_float simd_round(simd_float a) { return roundf(a); }
+inline simd_float simd_loadu(const float* p) { return *p; }
+inline void       simd_storeu(float* p, simd_float a) { *p = a; }
+inline simd_float simd_ramp() { return 0.0f; }
+
+// Masks are 1.0 (true) or 0.0 (false) in the scalar build.
+inline simd_float simd_cmp_gt(simd_float a, simd_float b) { return a > b ? 1.0f : 0.0f; }
+inline simd_float simd_cmp_ge(simd_float a, simd_float b) { return a >= b ? 1.0f : 0.0f; }
+inline simd_float simd_cmp_lt(simd_float a, simd_float b) { return a < b ? 1.0f : 0.0f; }
+inline simd_float simd_cmp_le(simd_float a, simd_float b) { return a <= b ? 1.0f : 0.0f; }
+inline simd_float simd_cmp_eq(simd_float a, simd_float b) { return a == b ? 1.0f : 0.0f; }
+inline simd_float simd_and(simd_float a, simd_float b) { return (a != 0.0f && b != 0.0f) ? 1.0f : 0.0f; }
+inline simd_float simd_or(simd_float a, simd_float b) { return (a != 0.0f || b != 0.0f) ? 1.0f : 0.0f; }
+inline simd_float simd_select(simd_float mask, simd_float a, simd_float b) { return mask != 0.0f ? a : b; }
+inline bool       simd_any(simd_float mask) { return mask != 0.0f; }
+inline int        simd_mask(simd_float mask) { return mask != 0.0f ? 1 : 0; }
+
+#endif
@@ -0,0 +1,426 @@
+#include "software_rasterizer.h"
+#include "simd.h"
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+SoftwareRasterizer::SoftwareRasterizer()
+{
+	m_next_tile = 0;
+}
+
+SoftwareRasterizer::~SoftwareRasterizer()
+{
+	shutdown();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::initialize(int shadow_map_size, int cascade_count, int threads)
+{
+	std::vector<int> sizes(cascade_count, shadow_map_size);
+	initialize(sizes.data(), cascade_count, threads);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::initialize(const int* sizes, int cascade_count, int threads)
+{
+	m_cascade_count = cascade_count;
+	m_sizes.assign(sizes, sizes + cascade_count);
+	m_offsets.resize(cascade_count);
+
+	size_t texel_count = 0;
+	int max_size = 0;
+
+	for (int i = 0; i < cascade_count; i++)
+	{
+		// Rows are processed CSM_SIMD_WIDTH pixels at a time, tiles must never be split by a SIMD group.
+		assert(sizes[i] % CSM_SIMD_WIDTH == 0);
+
+		m_offsets[i] = texel_count;
+		texel_count += (size_t)sizes[i] * sizes[i];
+		max_size = std::max(max_size, sizes[i]);
+	}
+
+	m_depth.resize(texel_count);
+
+	if (m_threads.empty())
+	{
+		if (threads <= 0)
+			threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+		m_quit = false;
+
+		// The calling thread acts as worker 0.
+		for (int i = 1; i < threads; i++)
+			m_threads.push_back(std::thread(&SoftwareRasterizer::worker, this, i));
+	}
+
+	m_triangles.resize(thread_count());
+	m_bins.resize(thread_count());
+
+	// Bins are allocated for the largest cascade and reused by the smaller ones.
+	int max_tiles = (max_size + RASTERIZER_TILE_SIZE - 1) / RASTERIZER_TILE_SIZE;
+
+	for (auto& bins : m_bins)
+		bins.resize(max_tiles * max_tiles);
+
+	set_cascade(0);
+	clear();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+
+	m_job_cv.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+
+	m_threads.clear();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::set_cascade(int cascade)
+{
+	m_size = m_sizes[cascade];
+	m_tiles_x = (m_size + RASTERIZER_TILE_SIZE - 1) / RASTERIZER_TILE_SIZE;
+	m_tiles_y = m_tiles_x;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::clear()
+{
+	std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::run(std::function<void(int)> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = job;
+		m_pending = (int)m_threads.size();
+		m_job_generation++;
+	}
+
+	m_job_cv.notify_all();
+
+	job(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cv.wait(lock, [this]() { return m_pending == 0; });
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::worker(int index)
+{
+	uint64_t generation = 0;
+
+	while (true)
+	{
+		std::function<void(int)> job;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_job_cv.wait(lock, [&]() { return m_quit || m_job_generation != generation; });
+
+			if (m_quit)
+				return;
+
+			generation = m_job_generation;
+			job = m_job;
+		}
+
+		job(index);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending--;
+		}
+
+		m_done_cv.notify_one();
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::render(const glm::mat4* crop_matrices, int cascade_count, const glm::mat4& model, const void* positions, uint32_t position_stride, uint32_t vertex_count, const uint32_t* indices, const RasterizerDraw* draws, int draw_count)
+{
+	cascade_count = std::min(cascade_count, m_cascade_count);
+	m_screen_positions.resize(vertex_count);
+
+	for (int c = 0; c < cascade_count; c++)
+	{
+		set_cascade(c);
+		transform(crop_matrices[c] * model, positions, position_stride, vertex_count);
+
+		run([&](int thread) { bin(thread, indices, draws, draw_count); });
+
+		m_next_tile = 0;
+
+		run([&](int thread)
+		{
+			int tile_count = m_tiles_x * m_tiles_y;
+			int tile;
+
+			while ((tile = m_next_tile++) < tile_count)
+				rasterize_tile(c, tile);
+		});
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::transform(const glm::mat4& view_proj, const void* positions, uint32_t position_stride, uint32_t vertex_count)
+{
+	run([&](int thread)
+	{
+		uint32_t begin = (uint32_t)(((uint64_t)vertex_count * thread) / thread_count());
+		uint32_t end = (uint32_t)(((uint64_t)vertex_count * (thread + 1)) / thread_count());
+		float size = float(m_size);
+
+		for (uint32_t i = begin; i < end; i++)
+		{
+			const glm::vec3& position = *(const glm::vec3*)((const char*)positions + (size_t)i * position_stride);
+			glm::vec4 clip = view_proj * glm::vec4(position, 1.0f);
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+
+			// Viewport and default depth range transform.
+			m_screen_positions[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * size, (ndc.y * 0.5f + 0.5f) * size, ndc.z * 0.5f + 0.5f);
+		}
+	});
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::bin(int thread, const uint32_t* indices, const RasterizerDraw* draws, int draw_count)
+{
+	std::vector<RasterizerTriangle>& triangles = m_triangles[thread];
+	std::vector<std::vector<uint32_t>>& bins = m_bins[thread];
+
+	triangles.clear();
+
+	for (auto& bin : bins)
+		bin.clear();
+
+	// Every thread sets up an equal share of the triangles of all draws.
+	uint64_t triangle_count = 0;
+
+	for (int i = 0; i < draw_count; i++)
+		triangle_count += draws[i].index_count / 3;
+
+	uint64_t begin = (triangle_count * thread) / thread_count();
+	uint64_t end = (triangle_count * (thread + 1)) / thread_count();
+	uint64_t first = 0;
+
+	for (int d = 0; d < draw_count && first < end; d++)
+	{
+		const RasterizerDraw& draw = draws[d];
+		uint64_t count = draw.index_count / 3;
+
+		if (first + count <= begin)
+		{
+			first += count;
+			continue;
+		}
+
+		uint64_t t0 = begin > first ? begin - first : 0;
+		uint64_t t1 = std::min(count, end - first);
+
+		for (uint64_t t = t0; t < t1; t++)
+		{
+			const uint32_t* tri_indices = &indices[draw.base_index + t * 3];
+
+			glm::vec3 v0 = m_screen_positions[draw.base_vertex + tri_indices[0]];
+			glm::vec3 v1 = m_screen_positions[draw.base_vertex + tri_indices[1]];
+			glm::vec3 v2 = m_screen_positions[draw.base_vertex + tri_indices[2]];
+
+			// Entirely in front of the near or behind the far plane. With depth clamping nothing is clipped in z.
+			if (!m_depth_clamp && ((v0.z < 0.0f && v1.z < 0.0f && v2.z < 0.0f) || (v0.z > 1.0f && v1.z > 1.0f && v2.z > 1.0f)))
+				continue;
+
+			float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+
+			if (area == 0.0f)
+				continue;
+
+			// Culling is disabled in the shadow pass, flip clockwise triangles to counter-clockwise.
+			if (area < 0.0f)
+			{
+				std::swap(v1, v2);
+				area = -area;
+			}
+
+			// Pixels whose centers lie inside the bounding box.
+			RasterizerTriangle tri;
+
+			tri.min_x = std::max(0, (int)ceilf(std::min(v0.x, std::min(v1.x, v2.x)) - 0.5f));
+			tri.min_y = std::max(0, (int)ceilf(std::min(v0.y, std::min(v1.y, v2.y)) - 0.5f));
+			tri.max_x = std::min(m_size - 1, (int)floorf(std::max(v0.x, std::max(v1.x, v2.x)) - 0.5f));
+			tri.max_y = std::min(m_size - 1, (int)floorf(std::max(v0.y, std::max(v1.y, v2.y)) - 0.5f));
+
+			if (tri.min_x > tri.max_x || tri.min_y > tri.max_y)
+				continue;
+
+			// Edge k is opposite to vertex k.
+			const glm::vec3* v[3] = { &v0, &v1, &v2 };
+
+			for (int k = 0; k < 3; k++)
+			{
+				const glm::vec3& a = *v[(k + 1) % 3];
+				const glm::vec3& b = *v[(k + 2) % 3];
+
+				tri.edge_a[k] = a.y - b.y;
+				tri.edge_b[k] = b.x - a.x;
+				tri.edge_c[k] = -(tri.edge_a[k] * a.x + tri.edge_b[k] * a.y);
+
+				// Top-left fill rule for counter-clockwise triangles with y pointing up.
+				tri.top_left[k] = tri.edge_a[k] > 0.0f || (tri.edge_a[k] == 0.0f && tri.edge_b[k] < 0.0f);
+			}
+
+			// Depth interpolated with the normalized edge functions (barycentric coordinates).
+			tri.depth_a = (tri.edge_a[0] * v0.z + tri.edge_a[1] * v1.z + tri.edge_a[2] * v2.z) / area;
+			tri.depth_b = (tri.edge_b[0] * v0.z + tri.edge_b[1] * v1.z + tri.edge_b[2] * v2.z) / area;
+			tri.depth_c = (tri.edge_c[0] * v0.z + tri.edge_c[1] * v1.z + tri.edge_c[2] * v2.z) / area;
+
+			uint32_t index = (uint32_t)triangles.size();
+			triangles.push_back(tri);
+
+			int tile_x0 = tri.min_x / RASTERIZER_TILE_SIZE;
+			int tile_y0 = tri.min_y / RASTERIZER_TILE_SIZE;
+			int tile_x1 = tri.max_x / RASTERIZER_TILE_SIZE;
+			int tile_y1 = tri.max_y / RASTERIZER_TILE_SIZE;
+
+			for (int y = tile_y0; y <= tile_y1; y++)
+			{
+				for (int x = tile_x0; x <= tile_x1; x++)
+					bins[y * m_tiles_x + x].push_back(index);
+			}
+		}
+
+		first += count;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::rasterize_tile(int cascade, int tile)
+{
+	int tile_x0 = (tile % m_tiles_x) * RASTERIZER_TILE_SIZE;
+	int tile_y0 = (tile / m_tiles_x) * RASTERIZER_TILE_SIZE;
+	int tile_x1 = std::min(tile_x0 + RASTERIZER_TILE_SIZE, m_size) - 1;
+	int tile_y1 = std::min(tile_y0 + RASTERIZER_TILE_SIZE, m_size) - 1;
+
+	float* cascade_depth = depth(cascade);
+
+	// Depth testing is order independent, so bins can be consumed thread by thread.
+	for (int t = 0; t < thread_count(); t++)
+	{
+		const std::vector<RasterizerTriangle>& triangles = m_triangles[t];
+
+		for (uint32_t index : m_bins[t][tile])
+		{
+			const RasterizerTriangle& tri = triangles[index];
+
+			rasterize_triangle(tri,
+							   cascade_depth,
+							   std::max(tri.min_x, tile_x0),
+							   std::max(tri.min_y, tile_y0),
+							   std::min(tri.max_x, tile_x1),
+							   std::min(tri.max_y, tile_y1));
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void SoftwareRasterizer::rasterize_triangle(const RasterizerTriangle& tri, float* depth, int x0, int y0, int x1, int y1)
+{
+	simd_float zero = simd_set1(0.0f);
+	simd_float one = simd_set1(1.0f);
+	simd_float offsets = simd_add(simd_ramp(), simd_set1(0.5f));
+
+	simd_float edge_a[3];
+	simd_float top_left[3];
+
+	for (int k = 0; k < 3; k++)
+	{
+		edge_a[k] = simd_set1(tri.edge_a[k]);
+		top_left[k] = tri.top_left[k] ? simd_cmp_eq(zero, zero) : simd_cmp_gt(zero, zero);
+	}
+
+	simd_float depth_a = simd_set1(tri.depth_a);
+
+	// Groups start on a SIMD boundary. Tiles are multiples of the SIMD width so a group never leaves the tile.
+	int start_x = x0 - (x0 % CSM_SIMD_WIDTH);
+
+	for (int y = y0; y <= y1; y++)
+	{
+		float py = float(y) + 0.5f;
+		float* row = depth + (size_t)y * m_size;
+
+		simd_float edge_row[3];
+
+		for (int k = 0; k < 3; k++)
+			edge_row[k] = simd_set1(tri.edge_b[k] * py + tri.edge_c[k]);
+
+		simd_float depth_row = simd_set1(tri.depth_b * py + tri.depth_c);
+
+		for (int x = start_x; x <= x1; x += CSM_SIMD_WIDTH)
+		{
+			simd_float px = simd_add(simd_set1(float(x)), offsets);
+			simd_float mask = simd_cmp_eq(zero, zero);
+
+			for (int k = 0; k < 3; k++)
+			{
+				simd_float e = simd_add(simd_mul(edge_a[k], px), edge_row[k]);
+				mask = simd_and(mask, simd_or(simd_cmp_gt(e, zero), simd_and(simd_cmp_eq(e, zero), top_left[k])));
+			}
+
+			if (!simd_any(mask))
+				continue;
+
+			simd_float z = simd_add(simd_mul(depth_a, px), depth_row);
+			simd_float stored = simd_loadu(row + x);
+
+			// Clip against the near and far planes, or flatten onto them like GL_DEPTH_CLAMP, and depth test (GL_LESS).
+			if (m_depth_clamp)
+				z = simd_min(simd_max(z, zero), one);
+			else
+				mask = simd_and(mask, simd_and(simd_cmp_ge(z, zero), simd_cmp_le(z, one)));
+
+			mask = simd_and(mask, simd_cmp_lt(z, stored));
+
+			simd_storeu(row + x, simd_select(mask, z, stored));
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+float SoftwareRasterizer::compare(int cascade, const float* reference, float epsilon)
+{
+	const float* cascade_depth = depth(cascade);
+	size_t texel_count = (size_t)m_sizes[cascade] * m_sizes[cascade];
+	size_t mismatches = 0;
+
+	for (size_t i = 0; i < texel_count; i++)
+	{
+		if (fabsf(cascade_depth[i] - reference[i]) > epsilon)
+			mismatches++;
+	}
+
+	return float(mismatches) / float(texel_count);
+}
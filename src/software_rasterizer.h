@@ -0,0 +1,87 @@
+#pragma once
+
+#include "csm.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+#define RASTERIZER_TILE_SIZE 64
+
+// A range of indices to rasterize, mirroring dw::SubMesh.
+struct RasterizerDraw
+{
+	uint32_t index_count;
+	uint32_t base_index;
+	int32_t  base_vertex;
+};
+
+// Screen-space triangle prepared for rasterization. Edge functions and depth are planes of the form a * x + b * y + c.
+struct RasterizerTriangle
+{
+	float edge_a[3];
+	float edge_b[3];
+	float edge_c[3];
+	bool  top_left[3];
+	float depth_a;
+	float depth_b;
+	float depth_c;
+	int   min_x;
+	int   min_y;
+	int   max_x;
+	int   max_y;
+};
+
+// Depth-only tile-based CPU rasterizer for the cascades, each at its own resolution. Triangles are binned into RASTERIZER_TILE_SIZE tiles and the tiles are
+// rasterized in parallel with SIMD edge functions. Acts as a fallback on machines without a GPU and as a reference for validating the
+// GPU shadow maps.
+struct SoftwareRasterizer
+{
+	int m_size = 0; // Size of the cascade being rasterized.
+	int m_cascade_count = 0;
+	int m_tiles_x = 0;
+	int m_tiles_y = 0;
+	bool m_depth_clamp = false;
+	std::vector<int> m_sizes;
+	std::vector<size_t> m_offsets;
+	std::vector<float> m_depth; // Depths of every cascade one after the other, bottom row first like a GL texture.
+
+	// Per-thread binning state.
+	std::vector<glm::vec3> m_screen_positions;
+	std::vector<std::vector<RasterizerTriangle>> m_triangles;
+	std::vector<std::vector<std::vector<uint32_t>>> m_bins;
+
+	// Worker threads.
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_job_cv;
+	std::condition_variable m_done_cv;
+	std::function<void(int)> m_job;
+	uint64_t m_job_generation = 0;
+	int m_pending = 0;
+	bool m_quit = false;
+	std::atomic<int> m_next_tile;
+
+	SoftwareRasterizer();
+	~SoftwareRasterizer();
+	void initialize(int shadow_map_size, int cascade_count, int threads = 0);
+	void initialize(const int* sizes, int cascade_count, int threads = 0);
+	void shutdown();
+	void clear();
+	void render(const glm::mat4* crop_matrices, int cascade_count, const glm::mat4& model, const void* positions, uint32_t position_stride, uint32_t vertex_count, const uint32_t* indices, const RasterizerDraw* draws, int draw_count);
+	float compare(int cascade, const float* reference, float epsilon);
+	void set_cascade(int cascade);
+
+	inline float* depth(int cascade) { return &m_depth[m_offsets[cascade]]; }
+	inline int size(int cascade) { return m_sizes[cascade]; }
+	inline int thread_count() { return (int)m_threads.size() + 1; }
+
+	void run(std::function<void(int)> job);
+	void worker(int index);
+	void transform(const glm::mat4& view_proj, const void* positions, uint32_t position_stride, uint32_t vertex_count);
+	void bin(int thread, const uint32_t* indices, const RasterizerDraw* draws, int draw_count);
+	void rasterize_tile(int cascade, int tile);
+	void rasterize_triangle(const RasterizerTriangle& tri, float* depth, int x0, int y0, int x1, int y1);
+};
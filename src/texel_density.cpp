@@ -0,0 +1,378 @@
+#include "texel_density.h"
+#include <macros.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void TexelDensityHistogram::clear()
+{
+	memset(m_bins, 0, sizeof(m_bins));
+	memset(m_weights, 0, sizeof(m_weights));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void TexelDensityHistogram::add(int cascade, float density, double weight)
+{
+	float scale = TEXEL_DENSITY_BINS / (TEXEL_DENSITY_MAX_LOG2 - TEXEL_DENSITY_MIN_LOG2);
+	int bin = density > 0.0f ? int((log2f(density) - TEXEL_DENSITY_MIN_LOG2) * scale) : 0;
+
+	bin = std::min(std::max(bin, 0), TEXEL_DENSITY_BINS - 1);
+
+	m_bins[cascade][bin] += weight;
+	m_weights[cascade] += weight;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+float TexelDensityHistogram::percentile(int cascade, float p)
+{
+	if (m_weights[cascade] <= 0.0)
+		return -1.0f;
+
+	double threshold = m_weights[cascade] * p;
+	double sum = 0.0;
+	int bin = 0;
+
+	for (; bin < TEXEL_DENSITY_BINS - 1; bin++)
+	{
+		sum += m_bins[cascade][bin];
+
+		if (sum > threshold)
+			break;
+	}
+
+	// Lower edge of the bin, so that the density is never overestimated.
+	return exp2f(TEXEL_DENSITY_MIN_LOG2 + bin * (TEXEL_DENSITY_MAX_LOG2 - TEXEL_DENSITY_MIN_LOG2) / TEXEL_DENSITY_BINS);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void measure_texel_density(CSM& csm, dw::Camera* camera, int height, float min_distance, const TexelDensitySample& sample, TexelDensityHistogram& histogram)
+{
+	// World size of a screen pixel at a distance of one along the view axis.
+	float pixel_size = 2.0f / (camera->m_projection[1][1] * float(height));
+
+	// Shadow texels per world unit along either axis of the atlas, from the scale of the texture matrix.
+	float texels_per_unit[MAX_FRUSTUM_SPLITS];
+
+	for (int i = 0; i < csm.m_split_count; i++)
+	{
+		const glm::mat4& m = csm.m_texture_matrices[i];
+
+		float u = glm::length(glm::vec3(m[0][0], m[1][0], m[2][0])) * float(csm.m_atlas.m_width);
+		float v = glm::length(glm::vec3(m[0][1], m[1][1], m[2][1])) * float(csm.m_atlas.m_height);
+
+		texels_per_unit[i] = std::min(u, v);
+	}
+
+	auto add = [&](float depth, double weight)
+	{
+		// Same selection as the shaders, receivers beyond the last cascade are not shadowed.
+		int cascade = 0;
+
+		while (cascade < csm.m_split_count && depth > csm.m_splits[cascade].selection_far)
+			cascade++;
+
+		if (cascade < csm.m_split_count)
+			histogram.add(cascade, depth * pixel_size * texels_per_unit[cascade], weight);
+	};
+
+	if (sample.sampled)
+	{
+		if (!sample.range.valid)
+			return;
+
+		// Every bin weighs the number of pixels of the depth buffer in it, at its near edge, the lowest density of its pixels.
+		float extent = (sample.range.max_depth - sample.range.min_depth) / DEPTH_HISTOGRAM_BINS;
+
+		for (int i = 0; i < DEPTH_HISTOGRAM_BINS; i++)
+		{
+			if (sample.histogram[i])
+				add(sample.range.min_depth + i * extent, double(sample.histogram[i]));
+		}
+	}
+	else
+	{
+		// Without depth, receivers are assumed at every distance, spaced logarithmically like the practical split scheme.
+		float near_plane = std::max(min_distance, camera->m_near);
+		float ratio = camera->m_far / near_plane;
+
+		for (int i = 0; i < TEXEL_DENSITY_ANALYTIC_DEPTHS; i++)
+			add(near_plane * powf(ratio, float(i) / TEXEL_DENSITY_ANALYTIC_DEPTHS), 1.0);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void TexelDensityTuner::clear()
+{
+	m_samples.clear();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void TexelDensityTuner::add_track(CameraTrack& track)
+{
+	for (uint32_t i = 0; i < track.frame_count(); i++)
+	{
+		TexelDensitySample sample;
+
+		sample.pose = track.frame(i);
+		sample.range.min_depth = 0.0f;
+		sample.range.max_depth = 0.0f;
+		sample.range.valid = false;
+		sample.sampled = false;
+		memset(sample.histogram, 0, sizeof(sample.histogram));
+
+		m_samples.push_back(sample);
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void TexelDensityTuner::add_sample(const CameraTrackFrame& pose, const DepthRange& range, const uint32_t* histogram)
+{
+	TexelDensitySample sample;
+
+	sample.pose = pose;
+	sample.range = range;
+	sample.sampled = true;
+	memcpy(sample.histogram, histogram, sizeof(sample.histogram));
+
+	m_samples.push_back(sample);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool TexelDensityTuner::evaluate(float lambda, int split_count, int shadow_map_size, TexelDensityResult& result)
+{
+	if (m_samples.empty())
+		return false;
+
+	dw::Camera camera(m_fov, m_near, m_far, float(m_width) / float(m_height), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+
+	// Solve every pose from scratch, whatever the refresh intervals of the sample.
+	m_csm.m_dirty_tracking = false;
+
+	for (int i = 0; i < MAX_FRUSTUM_SPLITS; i++)
+		m_csm.m_refresh_intervals[i] = 1;
+
+	m_csm.configure(lambda, m_csm.m_near_offset, split_count, shadow_map_size, &camera, m_width, m_height);
+
+	TexelDensityHistogram histogram;
+	histogram.clear();
+
+	uint32_t count = std::min((uint32_t)m_max_samples, sample_count());
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const TexelDensitySample& sample = m_samples[(uint64_t)i * sample_count() / count];
+
+		CameraTrack::apply(&camera, sample.pose);
+		m_csm.set_depth_range(sample.range, sample.sampled ? sample.histogram : nullptr);
+		m_csm.update(&camera, sample.pose.light_direction);
+
+		measure_texel_density(m_csm, &camera, m_height, m_min_distance, sample, histogram);
+	}
+
+	result.min_density = -1.0f;
+	result.memory = m_csm.memory_used();
+	result.cost = result.memory + split_count * m_cascade_cost;
+
+	for (int i = 0; i < split_count; i++)
+	{
+		result.densities[i] = histogram.percentile(i, m_percentile);
+
+		if (result.densities[i] >= 0.0f && (result.min_density < 0.0f || result.densities[i] < result.min_density))
+			result.min_density = result.densities[i];
+	}
+
+	for (int i = split_count; i < MAX_FRUSTUM_SPLITS; i++)
+		result.densities[i] = -1.0f;
+
+	// Nothing shadowed at all, no way to tell whether the configuration is good enough.
+	if (result.min_density < 0.0f)
+		result.min_density = 0.0f;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool TexelDensityTuner::tune(ShadowConfig& config)
+{
+	if (m_samples.empty())
+	{
+		DW_LOG_ERROR("No camera poses to tune the shadow settings for");
+		return false;
+	}
+
+	struct Candidate
+	{
+		int split_count;
+		int shadow_map_size;
+		size_t cost;
+	};
+
+	// The atlas depends on the split count and size alone, so candidates can be ordered by cost before solving any of them.
+	std::vector<Candidate> candidates;
+
+	for (int split_count = 1; split_count <= m_max_split_count; split_count++)
+	{
+		for (int size = m_min_size; size <= m_max_size; size *= 2)
+		{
+			ShadowAtlas atlas;
+			atlas.allocate(size, split_count, m_csm.m_memory_budget, m_csm.bytes_per_texel());
+
+			candidates.push_back({ split_count, size, atlas.m_memory_used + split_count * m_cascade_cost });
+		}
+	}
+
+	std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.cost < b.cost; });
+
+	int lambda_steps = std::max(1, int(ceilf(1.0f / m_lambda_step)));
+	bool found = false;
+
+	config.result.min_density = -1.0f;
+
+	for (const Candidate& candidate : candidates)
+	{
+		for (int i = 0; i <= lambda_steps; i++)
+		{
+			float lambda = std::min(i * m_lambda_step, 1.0f);
+			TexelDensityResult result;
+
+			if (!evaluate(lambda, candidate.split_count, candidate.shadow_map_size, result))
+				return false;
+
+			// Keeps the closest configuration too, reported when none reaches the target.
+			if (result.min_density > config.result.min_density)
+			{
+				config.lambda = lambda;
+				config.split_count = candidate.split_count;
+				config.shadow_map_size = candidate.shadow_map_size;
+				config.result = result;
+				found = result.min_density >= m_target_density;
+			}
+		}
+
+		if (found)
+			break;
+	}
+
+	config.target_density = m_target_density;
+	config.percentile = m_percentile;
+	config.width = m_width;
+	config.height = m_height;
+
+	std::string summary = std::to_string(config.split_count) + " cascades of " + std::to_string(config.shadow_map_size) + ", lambda " + std::to_string(config.lambda) +
+						  ", " + std::to_string(config.result.min_density) + " texels per pixel";
+
+	if (!found)
+	{
+		DW_LOG_WARNING("No shadow settings reach " + std::to_string(m_target_density) + " texels per pixel, closest: " + summary);
+		return false;
+	}
+
+	DW_LOG_INFO("Tuned shadow settings over " + std::to_string(sample_count()) + " poses: " + summary);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowConfig::save(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "w");
+
+	if (!file)
+	{
+		DW_LOG_ERROR("Failed to open " + path + " for writing");
+		return false;
+	}
+
+	fprintf(file, "# Shadow settings tuned for %.2f shadow texels per pixel at the %.0fth percentile, %dx%d.\n", target_density, percentile * 100.0f, width, height);
+	fprintf(file, "version %d\n", SHADOW_CONFIG_VERSION);
+	fprintf(file, "lambda %.3f\n", lambda);
+	fprintf(file, "split_count %d\n", split_count);
+	fprintf(file, "shadow_map_size %d\n", shadow_map_size);
+	fprintf(file, "target_density %.3f\n", target_density);
+	fprintf(file, "percentile %.3f\n", percentile);
+	fprintf(file, "width %d\n", width);
+	fprintf(file, "height %d\n", height);
+
+	for (int i = 0; i < split_count; i++)
+		fprintf(file, "# cascade %d: %.2f texels per pixel\n", i + 1, result.densities[i]);
+
+	fprintf(file, "# atlas: %.2f MB\n", result.memory / (1024.0f * 1024.0f));
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+
+	if (!success)
+		DW_LOG_ERROR("Failed to write shadow config " + path);
+
+	return success;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool ShadowConfig::load(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "r");
+
+	if (!file)
+	{
+		DW_LOG_ERROR("Failed to open shadow config " + path);
+		return false;
+	}
+
+	ShadowConfig config;
+	int version = 0;
+	char line[256];
+
+	while (fgets(line, sizeof(line), file))
+	{
+		char key[64];
+		float value;
+
+		if (line[0] == '#' || sscanf(line, "%63s %f", key, &value) != 2)
+			continue;
+
+		if (strcmp(key, "version") == 0)
+			version = int(value);
+		else if (strcmp(key, "lambda") == 0)
+			config.lambda = value;
+		else if (strcmp(key, "split_count") == 0)
+			config.split_count = int(value);
+		else if (strcmp(key, "shadow_map_size") == 0)
+			config.shadow_map_size = int(value);
+		else if (strcmp(key, "target_density") == 0)
+			config.target_density = value;
+		else if (strcmp(key, "percentile") == 0)
+			config.percentile = value;
+		else if (strcmp(key, "width") == 0)
+			config.width = int(value);
+		else if (strcmp(key, "height") == 0)
+			config.height = int(value);
+		else
+			DW_LOG_WARNING("Unknown key " + std::string(key) + " in shadow config " + path);
+	}
+
+	fclose(file);
+
+	if (version != SHADOW_CONFIG_VERSION || config.lambda < 0.0f || config.lambda > 1.0f || config.split_count < 1 || config.split_count > MAX_FRUSTUM_SPLITS ||
+		config.shadow_map_size < SHADOW_ATLAS_MIN_CASCADE_SIZE || config.shadow_map_size > SHADOW_ATLAS_MAX_SIZE)
+	{
+		DW_LOG_ERROR("Invalid shadow config " + path);
+		return false;
+	}
+
+	*this = config;
+
+	return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "csm.h"
+#include "camera_track.h"
+#include <string>
+#include <vector>
+
+#define TEXEL_DENSITY_BINS 128        // Bins of the log2 density histograms.
+#define TEXEL_DENSITY_MIN_LOG2 -8.0f  // Range of the histograms, densities outside are clamped into the first or last bin.
+#define TEXEL_DENSITY_MAX_LOG2 8.0f
+#define TEXEL_DENSITY_ANALYTIC_DEPTHS 64 // Distances evaluated per pose without sampled depth.
+#define SHADOW_CONFIG_VERSION 1
+
+// Camera pose to measure the shadow texel density from. With sampled depth, the histogram of the view depth of every pixel of the
+// depth buffer as seen from the pose, binned over the depth range and read back by the SDSM reduction; without, distances between
+// the minimum distance and the far plane are spaced logarithmically and count the same.
+struct TexelDensitySample
+{
+	CameraTrackFrame pose;
+	DepthRange range;
+	uint32_t histogram[DEPTH_HISTOGRAM_BINS];
+	bool sampled;
+};
+
+// Texel density reached by one configuration: shadow texels per screen pixel along the coarser axis of the cascade, for a receiver
+// facing both the camera and the light. Below 1.0 a shadow texel covers several pixels and the shadow edges turn blocky.
+struct TexelDensityResult
+{
+	float densities[MAX_FRUSTUM_SPLITS]; // Percentile density of every cascade, negative when no sample fell into it.
+	float min_density;                   // Lowest density over every cascade.
+	size_t memory;                       // Bytes of the atlas, after the memory budget.
+	size_t cost;                         // Memory plus the weight of every cascade pass.
+};
+
+// Shadow settings picked by the tuner, loaded at startup. Stored as a small text file of "key value" lines so that the settings of
+// every platform can be reviewed and diffed.
+struct ShadowConfig
+{
+	float lambda = 0.3f;
+	int split_count = 4;
+	int shadow_map_size = 2048;
+
+	// Conditions the settings were tuned for, written for reference only.
+	float target_density = 1.0f;
+	float percentile = 0.05f;
+	int width = 0;
+	int height = 0;
+	TexelDensityResult result = {};
+
+	bool save(const std::string& path);
+	bool load(const std::string& path);
+};
+
+// Per cascade log2 histograms of the texel density. The weights are those passed to add(): pixel counts for sampled depth, so that
+// percentiles are fractions of the shadowed screen area, and a unit weight per distance otherwise.
+struct TexelDensityHistogram
+{
+	double m_bins[MAX_FRUSTUM_SPLITS][TEXEL_DENSITY_BINS];
+	double m_weights[MAX_FRUSTUM_SPLITS];
+
+	void clear();
+	void add(int cascade, float density, double weight);
+	float percentile(int cascade, float p);
+};
+
+// Adds the densities of the cascades of the CSM, as solved for the camera, over the depths of the sample. The screen pixel footprint
+// follows from the camera projection and the height of the screen, the shadow texel footprint from the texture matrix of the cascade
+// and the size of the atlas.
+void measure_texel_density(CSM& csm, dw::Camera* camera, int height, float min_distance, const TexelDensitySample& sample, TexelDensityHistogram& histogram);
+
+// Replays camera poses through headless copies of the CSM and searches for the cheapest split count, shadow map size and lambda whose
+// every cascade reaches the target density at the given percentile. Candidates are ordered by the memory of their atlas plus a weight
+// per cascade pass, and the first one with a lambda reaching the target wins, with the lambda that leaves the largest margin.
+struct TexelDensityTuner
+{
+	// Screen and camera the densities are measured for.
+	float m_fov = 60.0f;
+	float m_near = 0.1f;
+	float m_far = 1000.0f;
+	int m_width = 1920;
+	int m_height = 1080;
+
+	// Solver settings shared by every candidate: near offset, stable PSSM, SDSM, depth format, memory budget and scene bounds.
+	CSM m_csm;
+
+	// Search.
+	float m_target_density = 1.0f;
+	float m_percentile = 0.05f;    // Fraction of the shadowed pixels allowed below the target.
+	float m_min_distance = 1.0f;   // Closest receiver without sampled depth.
+	float m_lambda_step = 0.05f;
+	int m_min_size = 256;
+	int m_max_size = 2048;
+	int m_max_split_count = MAX_FRUSTUM_SPLITS;
+	size_t m_cascade_cost = 2 * 1024 * 1024; // Cost of a cascade pass, in bytes of atlas.
+	int m_max_samples = 256;                 // Poses evaluated per candidate, evenly picked from all of them.
+
+	std::vector<TexelDensitySample> m_samples;
+
+	void clear();
+	void add_track(CameraTrack& track);
+	void add_sample(const CameraTrackFrame& pose, const DepthRange& range, const uint32_t* histogram);
+	bool evaluate(float lambda, int split_count, int shadow_map_size, TexelDensityResult& result);
+	bool tune(ShadowConfig& config);
+
+	inline uint32_t sample_count() { return (uint32_t)m_samples.size(); }
+};
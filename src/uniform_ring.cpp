@@ -0,0 +1,186 @@
+#include "uniform_ring.h"
+#include <macros.h>
+#include <chrono>
+#include <string.h>
+
+UniformRing::UniformRing()
+{
+	for (int i = 0; i < UNIFORM_RING_FRAMES; i++)
+		m_fences[i] = nullptr;
+}
+
+UniformRing::~UniformRing()
+{
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+bool UniformRing::initialize(GLsizeiptr slot_size)
+{
+	shutdown();
+
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &m_alignment);
+
+	if (m_alignment <= 0)
+		m_alignment = 256;
+
+	m_slot_size = (slot_size + m_alignment - 1) / m_alignment * m_alignment;
+
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	m_persistent = major > 4 || (major == 4 && minor >= 4);
+
+	GLsizeiptr size = m_slot_size * UNIFORM_RING_FRAMES;
+
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+
+	if (m_persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+		m_mapped = (uint8_t*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+
+		if (!m_mapped)
+		{
+			DW_LOG_FATAL("Failed to persistently map uniform ring buffer");
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			return false;
+		}
+	}
+	else
+		glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	m_slot = 0;
+	m_head = 0;
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void UniformRing::shutdown()
+{
+	for (int i = 0; i < UNIFORM_RING_FRAMES; i++)
+	{
+		if (m_fences[i])
+		{
+			glDeleteSync(m_fences[i]);
+			m_fences[i] = nullptr;
+		}
+	}
+
+	if (m_buffer)
+	{
+		if (m_mapped)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			m_mapped = nullptr;
+		}
+
+		glDeleteBuffers(1, &m_buffer);
+		m_buffer = 0;
+	}
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void UniformRing::wait(int slot)
+{
+	if (!m_fences[slot])
+		return;
+
+	// Only count it as a stall if the GPU is actually still using the slot.
+	if (glClientWaitSync(m_fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		while (glClientWaitSync(m_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+			;
+
+		m_frame_stalls++;
+		m_frame_stall_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	glDeleteSync(m_fences[slot]);
+	m_fences[slot] = nullptr;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void UniformRing::begin_frame()
+{
+	m_slot = (m_slot + 1) % UNIFORM_RING_FRAMES;
+	m_head = 0;
+
+	m_frame_bytes = 0;
+	m_frame_stalls = 0;
+	m_frame_stall_ms = 0.0;
+
+	wait(m_slot);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void UniformRing::end_frame()
+{
+	m_fences[m_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	m_bytes_uploaded = m_frame_bytes;
+	m_stalls = m_frame_stalls;
+	m_stall_ms = m_frame_stall_ms;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+GLintptr UniformRing::upload(const void* data, GLsizeiptr size)
+{
+	GLsizeiptr aligned_size = (size + m_alignment - 1) / m_alignment * m_alignment;
+
+	// The slot is full: drain the GPU so the slot can be rewound without overwriting data of pending draws.
+	if (m_head + aligned_size > m_slot_size)
+	{
+		DW_LOG_ERROR("Uniform ring slot overflow, increase UNIFORM_RING_SLOT_SIZE");
+
+		auto start = std::chrono::high_resolution_clock::now();
+		glFinish();
+
+		m_frame_stalls++;
+		m_frame_stall_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		m_head = 0;
+	}
+
+	GLintptr offset = m_slot * m_slot_size + m_head;
+
+	if (m_persistent)
+		memcpy(m_mapped + offset, data, size);
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+		void* ptr = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		memcpy(ptr, data, size);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	m_head += aligned_size;
+	m_frame_bytes += size;
+
+	return offset;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------------
+
+void UniformRing::bind_range(GLuint index, GLintptr offset, GLsizeiptr size)
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, index, m_buffer, offset, size);
+}
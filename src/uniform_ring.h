@@ -0,0 +1,47 @@
+#pragma once
+
+#include <ogl.h>
+#include <stdint.h>
+
+#define UNIFORM_RING_FRAMES 3
+#define UNIFORM_RING_SLOT_SIZE (1024 * 1024)
+
+// Triple-buffered uniform buffer for per-draw data. The buffer is split into one slot per frame in flight; every upload is appended to
+// the current slot at the required offset alignment and bound with glBindBufferRange, so no buffer is ever remapped while the GPU is
+// reading it. A fence per slot makes sure a slot is only reused once the GPU is done with the frame that wrote it.
+//
+// With GL 4.4 the buffer is created with immutable storage and mapped persistently once. Older contexts fall back to an unsynchronized
+// glMapBufferRange per upload, which is still free of driver synchronization since slots are fenced.
+struct UniformRing
+{
+	GLuint m_buffer = 0;
+	uint8_t* m_mapped = nullptr;
+	bool m_persistent = false;
+	GLsizeiptr m_slot_size = 0;
+	GLint m_alignment = 256;
+	GLsync m_fences[UNIFORM_RING_FRAMES];
+	int m_slot = 0;
+	GLsizeiptr m_head = 0;
+
+	// Statistics of the last completed frame and of the frame being recorded.
+	uint64_t m_frame_bytes = 0;
+	uint32_t m_frame_stalls = 0;
+	double m_frame_stall_ms = 0.0;
+	uint64_t m_bytes_uploaded = 0;
+	uint32_t m_stalls = 0;
+	double m_stall_ms = 0.0;
+
+	UniformRing();
+	~UniformRing();
+	bool initialize(GLsizeiptr slot_size = UNIFORM_RING_SLOT_SIZE);
+	void shutdown();
+	void begin_frame();
+	void end_frame();
+	GLintptr upload(const void* data, GLsizeiptr size);
+	void bind_range(GLuint index, GLintptr offset, GLsizeiptr size);
+	void wait(int slot);
+
+	inline uint64_t bytes_uploaded() { return m_bytes_uploaded; }
+	inline uint32_t stalls() { return m_stalls; }
+	inline double stall_ms() { return m_stall_ms; }
+};